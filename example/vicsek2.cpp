@@ -80,8 +80,14 @@ int main() {
   io::output_particles(fout, particles.begin(), particles.end(), "\t")
       << "\n\n";
 
+  // In-situ analysis: polar order parameter every 10 steps
+  std::ofstream order_out("vicsek2_order.dat");
+  analysis::Pipeline<double, 2> pipeline;
+  pipeline.emplace<analysis::PolarOrder<double, 2>>(10, order_out, v0);
+
   random::UniformOnSphere<double, 2> eta_gen(eta);
   eta_gen.seed_dev();
+  std::vector<Vec<double, 2>> noise(N);
 
   // Time evolution!!
   for (int t = 0; t < 3000; ++t) {
@@ -89,10 +95,18 @@ int main() {
 
     // Create adjacency list for all particles
     searcher.search(adjacency_list, particles);
-
-    for (auto e : enumerate(particles)) {
-      auto  i = e.first;    // index of the particle
-      auto& p = e.second;   // i-th particle
+    pipeline(t, particles, adjacency_list);
+
+    // Noise is drawn in order beforehand, as the generator is not shared
+    // by threads
+    for (auto& xi : noise) xi = eta_gen();
+
+    // Update in parallel; particles with many neighbors cost more, so they
+    // are spread over threads by the number of neighbors
+    parallel::for_each_weighted(N, [&](std::size_t i) {
+      return adjacency_list[i].size();
+    }, [&](std::size_t i) {
+      const auto& p = particles[i];  // i-th particle
       const auto& x = p.position();
       const auto& v = p.velocity();
       auto& nx = new_particles[i].position();
@@ -106,9 +120,9 @@ int main() {
       // Get average velocity over neighbors
       auto iter = transform_iterator(neighbors.begin(), neighbors.end(),
                                      [](auto* p) { return p->velocity(); });
-      nv = average(iter.first, iter.second) + eta_gen();
+      nv = average(iter.first, iter.second) + noise[i];
       nv.normalize(v0);
-    };
+    }, 64);
 
     // Renew position and velocity of all particles
     particles.swap(new_particles);
@@ -0,0 +1,12 @@
+/**
+ * @file analysis.hpp
+ *
+ * @brief in-situ analysis of particle systems
+ */
+
+#pragma once
+
+#include "analysis/cluster.hpp"
+#include "analysis/pipeline.hpp"
+#include "analysis/rdf.hpp"
+#include "analysis/reduction.hpp"
@@ -0,0 +1,143 @@
+/**
+ * @file cluster.hpp
+ *
+ * @brief connected components of adjacency lists
+ */
+
+#pragma once
+
+#include "../parallel.hpp"
+#include "../particle.hpp"
+
+#include <atomic>
+#include <utility>
+#include <vector>
+
+namespace particles {
+namespace analysis {
+
+/**
+ * @brief result of cluster analysis
+ */
+struct Clusters {
+  /**
+   * @brief cluster id of each particle
+   *
+   * Ids are numbered in order of the first particle of each cluster.
+   */
+  std::vector<std::size_t> label;
+  /** @brief number of particles in each cluster */
+  std::vector<std::size_t> sizes;
+
+  std::size_t num_clusters() const { return sizes.size(); }
+
+  /** @brief number of clusters of each size: dist[s] clusters have size s */
+  std::vector<std::size_t> size_distribution() const {
+    std::size_t max = 0;
+    for (auto s : sizes) max = std::max(max, s);
+    std::vector<std::size_t> dist(max + 1);
+    for (auto s : sizes) dist[s]++;
+    return dist;
+  }
+};
+
+namespace internal {
+
+/**
+ * @brief lock-free union-find
+ *
+ * A root is always linked under a smaller root by CAS, so parent[x] <= x
+ * holds all the time and concurrent path halving is safe.
+ */
+class ConcurrentUnionFind {
+ public:
+  explicit ConcurrentUnionFind(std::size_t n) : parent_(n) {
+    parallel::for_each(n, [this](std::size_t i) {
+      parent_[i].store(i, std::memory_order_relaxed);
+    }, 1 << 14);
+  }
+
+  std::size_t find(std::size_t x) {
+    while (true) {
+      auto p = parent_[x].load(std::memory_order_relaxed);
+      if (p == x) return x;
+      const auto gp = parent_[p].load(std::memory_order_relaxed);
+      if (p != gp) parent_[x].compare_exchange_weak(p, gp);  // path halving
+      x = gp;
+    }
+  }
+
+  void unite(std::size_t a, std::size_t b) {
+    while (true) {
+      a = find(a);
+      b = find(b);
+      if (a == b) return;
+      if (a < b) std::swap(a, b);
+      auto expected = a;
+      if (parent_[a].compare_exchange_strong(expected, b)) return;
+    }
+  }
+
+ private:
+  std::vector<std::atomic<std::size_t>> parent_;
+};
+
+/**
+ * @brief label connected components of a graph
+ * @param for_each_neighbor for_each_neighbor(i, f) calls f(j) for edges (i, j)
+ */
+template <class ForEachNeighbor>
+Clusters label_components(std::size_t n, ForEachNeighbor for_each_neighbor) {
+  ConcurrentUnionFind uf(n);
+  parallel::for_each(n, [&](std::size_t i) {
+    for_each_neighbor(i, [&](std::size_t j) {
+      if (i != j) uf.unite(i, j);
+    });
+  }, 1 << 10);
+
+  Clusters res;
+  res.label.resize(n);
+  parallel::for_each(n, [&](std::size_t i) { res.label[i] = uf.find(i); },
+                     1 << 14);
+  // A root is the smallest index in its cluster, so it comes first.
+  for (std::size_t i = 0; i < n; i++) {
+    const auto root = res.label[i];
+    if (root == i) {
+      res.label[i] = res.sizes.size();
+      res.sizes.push_back(0);
+    } else {
+      res.label[i] = res.label[root];
+    }
+    res.sizes[res.label[i]]++;
+  }
+  return res;
+}
+
+}  // namespace internal
+
+/**
+ * @brief clusters of particles connected in an adjacency list
+ *
+ * Edges are merged in parallel with a lock-free union-find.
+ *
+ * @code
+ * searcher.search(adjacency_list, particles);
+ * auto c = analysis::clusters(particles, adjacency_list);
+ * c.label[i];              // cluster of i-th particle
+ * c.size_distribution();   // number of clusters for each size
+ * @endcode
+ *
+ * @param adjacency_list list of pointers to elements of particles
+ */
+template <class T, std::size_t N, class AdjacencyList>
+Clusters clusters(const std::vector<Particle<T, N>>& particles,
+                  const AdjacencyList& adjacency_list) {
+  const auto* base = particles.data();
+  return internal::label_components(
+      particles.size(), [&](std::size_t i, auto f) {
+        for (const auto* q : adjacency_list[i]) f(q - base);
+      });
+}
+
+}  // namespace analysis
+}  // namespace particles
@@ -0,0 +1,215 @@
+/**
+ * @file pipeline.hpp
+ *
+ * @brief analysis stages called from the time loop
+ *
+ * Stages observe the live particles and adjacency list every k steps and
+ * write only aggregated values, instead of dumping whole frames.
+ */
+
+#pragma once
+
+#include "../io.hpp"
+#include "../particle.hpp"
+#include "../details/adjacency_list.hpp"
+#include "reduction.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <ostream>
+#include <utility>
+#include <vector>
+
+namespace particles {
+namespace analysis {
+
+/**
+ * @brief interface of analysis stages
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class StageBase {
+ public:
+  typedef Particle<T, N> particle_type;
+  typedef search::AdjacencyList<particle_type> adjacency_list_type;
+
+  virtual ~StageBase() {}
+
+  /**
+   * @brief analyze a snapshot
+   * @param step current step of the time loop
+   */
+  virtual void observe(std::size_t step,
+                       const std::vector<particle_type>& particles,
+                       const adjacency_list_type& adjacency_list) = 0;
+};
+
+/**
+ * @brief run registered stages in the time loop
+ *
+ * @code
+ * analysis::Pipeline<double, 2> pipeline;
+ * pipeline.emplace<analysis::PolarOrder<double, 2>>(10, std::cout, v0);
+ *
+ * for (std::size_t t = 0; t < steps; ++t) {
+ *   searcher.search(adjacency_list, particles);
+ *   pipeline(t, particles, adjacency_list);  // every 10 steps
+ *   ...
+ * }
+ * @endcode
+ */
+template <class T, std::size_t N>
+class Pipeline {
+ public:
+  typedef StageBase<T, N> stage_type;
+  typedef typename stage_type::particle_type particle_type;
+  typedef typename stage_type::adjacency_list_type adjacency_list_type;
+
+  /**
+   * @brief register a stage
+   * @param every the stage runs when step is multiple of this
+   */
+  void add(std::shared_ptr<stage_type> stage, std::size_t every = 1) {
+    stages_.emplace_back(std::move(stage), std::max<std::size_t>(every, 1));
+  }
+
+  /** @brief construct and register a stage */
+  template <class Stage, class... Args>
+  Stage& emplace(std::size_t every, Args&&... args) {
+    auto stage = std::make_shared<Stage>(std::forward<Args>(args)...);
+    add(stage, every);
+    return *stage;
+  }
+
+  /** @brief run stages which are due at this step */
+  void operator()(std::size_t step, const std::vector<particle_type>& particles,
+                  const adjacency_list_type& adjacency_list) {
+    for (auto& s : stages_) {
+      if (step % s.second == 0) {
+        s.first->observe(step, particles, adjacency_list);
+      }
+    }
+  }
+
+  std::size_t size() const { return stages_.size(); }
+
+ private:
+  std::vector<std::pair<std::shared_ptr<stage_type>, std::size_t>> stages_;
+};
+
+/**
+ * @brief polar order parameter \f$|\sum_i \vec{v}_i| / (N v_0)\f$
+ *
+ * Writes "step value" per observation.
+ */
+template <class T, std::size_t N>
+class PolarOrder : public StageBase<T, N> {
+ public:
+  typedef typename StageBase<T, N>::particle_type particle_type;
+  typedef typename StageBase<T, N>::adjacency_list_type adjacency_list_type;
+
+  /** @param v0 speed of particles */
+  PolarOrder(std::ostream& os, T v0) : os_(os), v0_(v0), value_() {}
+
+  void observe(std::size_t step, const std::vector<particle_type>& particles,
+               const adjacency_list_type&) {
+    value_ = polar_order(particles, v0_);
+    os_ << step << " " << value_ << "\n";
+  }
+
+  /** @brief value at the last observation */
+  T value() const { return value_; }
+
+ private:
+  std::ostream& os_;
+  const T v0_;
+  T value_;
+};
+
+/**
+ * @brief statistics of the number of neighbors
+ *
+ * Writes "step mean variance min max" per observation.
+ */
+template <class T, std::size_t N>
+class NeighborCount : public StageBase<T, N> {
+ public:
+  typedef typename StageBase<T, N>::particle_type particle_type;
+  typedef typename StageBase<T, N>::adjacency_list_type adjacency_list_type;
+
+  NeighborCount(std::ostream& os) : os_(os), stat_() {}
+
+  void observe(std::size_t step, const std::vector<particle_type>&,
+               const adjacency_list_type& adjacency_list) {
+    stat_ = neighbor_statistics(adjacency_list);
+    os_ << step << " " << stat_.mean << " " << stat_.variance << " "
+        << stat_.min << " " << stat_.max << "\n";
+  }
+
+  double mean() const { return stat_.mean; }
+  double variance() const { return stat_.variance; }
+
+ private:
+  std::ostream& os_;
+  Statistics stat_;
+};
+
+/**
+ * @brief histogram of local densities
+ *
+ * The box \f$[lower, upper)\f$ is divided into cells^N boxes and particles in
+ * each box are counted. The stage writes "step h_0 h_1 ... h_m" where h_k is
+ * the number of boxes containing k particles.
+ */
+template <class T, std::size_t N>
+class DensityHistogram : public StageBase<T, N> {
+ public:
+  typedef typename StageBase<T, N>::particle_type particle_type;
+  typedef typename StageBase<T, N>::adjacency_list_type adjacency_list_type;
+
+  DensityHistogram(std::ostream& os, const Vec<T, N>& lower,
+                   const Vec<T, N>& upper, std::size_t cells)
+      : os_(os), lower_(lower), upper_(upper),
+        cells_(std::max<std::size_t>(cells, 1)), counts_(), histogram_() {}
+
+  void observe(std::size_t step, const std::vector<particle_type>& particles,
+               const adjacency_list_type&) {
+    std::size_t total = 1;
+    for (std::size_t d = 0; d < N; d++) total *= cells_;
+    counts_.assign(total, 0);
+
+    for (const auto& p : particles) {
+      std::size_t c = 0;
+      bool inside = true;
+      for (std::size_t d = 0; d < N; d++) {
+        const T x = (p.position(d) - lower_[d]) / (upper_[d] - lower_[d]);
+        if (!(x >= 0 && x < 1)) { inside = false; break; }
+        c = c * cells_ + static_cast<std::size_t>(x * cells_);
+      }
+      if (inside) counts_[c]++;
+    }
+
+    const auto max = *std::max_element(counts_.begin(), counts_.end());
+    histogram_.assign(max + 1, 0);
+    for (auto k : counts_) histogram_[k]++;
+
+    os_ << step << " ";
+    csv_out(os_, " ", histogram_) << "\n";
+  }
+
+  /** @brief histogram at the last observation */
+  const std::vector<std::size_t>& histogram() const { return histogram_; }
+
+ private:
+  std::ostream& os_;
+  const Vec<T, N> lower_;
+  const Vec<T, N> upper_;
+  const std::size_t cells_;
+  std::vector<std::size_t> counts_;
+  std::vector<std::size_t> histogram_;
+};
+
+}  // namespace analysis
+}  // namespace particles
@@ -0,0 +1,183 @@
+/**
+ * @file rdf.hpp
+ *
+ * @brief radial distribution function g(r)
+ */
+
+#pragma once
+
+#include "../boundary.hpp"
+#include "../parallel.hpp"
+#include "../particle.hpp"
+#include "../details/cell_list.hpp"
+
+#include <cmath>
+#include <vector>
+
+namespace particles {
+namespace analysis {
+
+/**
+ * @brief histogram of pair distances and g(r)
+ * @tparam T floating point
+ */
+template <class T>
+struct RDF {
+  std::vector<T> r;                  ///< center of bins
+  std::vector<T> g;                  ///< g(r)
+  std::vector<std::size_t> counts;   ///< number of ordered pairs in bins
+};
+
+namespace internal {
+
+/** @brief volume of N-dimensional unit ball */
+template <class T, std::size_t N>
+T unit_ball_volume() {
+  return std::pow(T(M_PI), T(N) / 2) / std::tgamma(T(N) / 2 + 1);
+}
+
+/**
+ * @brief normalize histogram of ordered pairs by that of the ideal gas
+ */
+template <class T, std::size_t N>
+RDF<T> normalize_rdf(std::vector<std::size_t>&& counts, std::size_t n,
+                     T volume, T r_max) {
+  RDF<T> res;
+  const auto bins = counts.size();
+  const T dr = r_max / bins;
+  const T c = unit_ball_volume<T, N>();
+  const T pairs = n > 1 ? T(n) * (n - 1) / volume : T(0);
+  res.r.resize(bins);
+  res.g.resize(bins);
+  for (std::size_t k = 0; k < bins; k++) {
+    const T r0 = dr * k, r1 = dr * (k + 1);
+    const T shell = c * (std::pow(r1, T(N)) - std::pow(r0, T(N)));
+    res.r[k] = (r0 + r1) / 2;
+    res.g[k] = pairs > 0 ? counts[k] / (pairs * shell) : T(0);
+  }
+  res.counts = std::move(counts);
+  return res;
+}
+
+inline std::vector<std::size_t> merge_histograms(
+    std::vector<std::size_t> a, const std::vector<std::size_t>& b) {
+  for (std::size_t k = 0; k < a.size(); k++) a[k] += b[k];
+  return a;
+}
+
+template <class T, std::size_t N>
+T box_volume(const boundary::PeriodicBoundary<T, N>& boundary) {
+  T v = 1;
+  for (std::size_t d = 0; d < N; d++) v *= boundary.length(d);
+  return v;
+}
+
+}  // namespace internal
+
+/**
+ * @brief g(r) from an adjacency list
+ *
+ * Distances are taken in the minimum image convention. Pairs which are not
+ * in the adjacency list are not counted, thus the adjacency list must hold
+ * all pairs within r_max across the periodic boundary. Searchers with a free
+ * boundary (e.g. KdTreeSearcher) miss pairs across the faces and bias g(r)
+ * near r_max; without such a list, use the overload without adjacency list,
+ * which runs its own periodic cell list. The particle itself in the list is
+ * ignored.
+ *
+ * @param r_max histogram covers [0, r_max)
+ * @param bins number of bins
+ */
+template <class T, std::size_t N, class AdjacencyList>
+RDF<T> rdf(const std::vector<Particle<T, N>>& particles,
+           const AdjacencyList& adjacency_list,
+           const boundary::PeriodicBoundary<T, N>& boundary, T r_max,
+           std::size_t bins) {
+  typedef std::vector<std::size_t> histogram_type;
+  const T scale = bins / r_max;
+  auto counts = parallel::reduce(
+      particles.size(), histogram_type(bins),
+      [&](std::size_t first, std::size_t last) {
+        histogram_type h(bins);
+        for (auto i = first; i < last; i++) {
+          const auto& p = particles[i];
+          for (const auto* q : adjacency_list[i]) {
+            if (q == &p) continue;
+            const T r = std::sqrt(
+                boundary.squared_distance(p.position(), q->position()));
+            const T b = r * scale;
+            if (b < bins) h[static_cast<std::size_t>(b)]++;
+          }
+        }
+        return h;
+      },
+      &internal::merge_histograms, 256);
+  return internal::normalize_rdf<T, N>(std::move(counts), particles.size(),
+                                       internal::box_volume(boundary), r_max);
+}
+
+/**
+ * Particles are sorted into cells of width at least r_max, and only pairs in
+ * adjacent cells are compared, so that the cost is \f$O(n)\f$ for a fixed
+ * density. Each thread fills its own histogram.
+ *
+ * @brief g(r) with a cell list pass
+ *
+ * @code
+ * boundary::PeriodicBoundary<double, 2> boundary(0, L, 0, L);
+ * auto g = analysis::rdf(particles, boundary, 3.0, 60);
+ * for (std::size_t k = 0; k < g.r.size(); k++) {
+ *   std::cout << g.r[k] << " " << g.g[k] << std::endl;
+ * }
+ * @endcode
+ *
+ * @pre r_max is less than half of the box length
+ */
+template <class T, std::size_t N>
+RDF<T> rdf(const std::vector<Particle<T, N>>& particles,
+           const boundary::PeriodicBoundary<T, N>& boundary, T r_max,
+           std::size_t bins) {
+  typedef std::vector<std::size_t> histogram_type;
+  Vec<T, N> lower, upper;
+  for (std::size_t d = 0; d < N; d++) {
+    lower[d] = boundary.left()[d];
+    upper[d] = boundary.right()[d];
+  }
+  search::internal::CellList<T, N> cells;
+  cells.build(particles.size(),
+              [&particles](std::size_t i) -> const Vec<T, N>& {
+                return particles[i].position();
+              },
+              lower, upper, r_max, true);
+
+  const T scale = bins / r_max;
+  const T r2_max = r_max * r_max;
+  const auto& indices = cells.indices();
+  auto counts = parallel::reduce(
+      cells.num_cells(), histogram_type(bins),
+      [&](std::size_t first, std::size_t last) {
+        histogram_type h(bins);
+        for (auto c = first; c < last; c++) {
+          cells.for_each_adjacent_cell(c, [&](std::size_t c2) {
+            for (auto a = cells.cell_begin(c); a < cells.cell_end(c); a++) {
+              const auto& x = particles[indices[a]].position();
+              for (auto b = cells.cell_begin(c2); b < cells.cell_end(c2); b++) {
+                if (indices[a] == indices[b]) continue;
+                const auto r2 = cells.squared_distance(
+                    x, particles[indices[b]].position());
+                if (r2 >= r2_max) continue;
+                const T k = std::sqrt(r2) * scale;
+                if (k < bins) h[static_cast<std::size_t>(k)]++;
+              }
+            }
+          });
+        }
+        return h;
+      },
+      &internal::merge_histograms, 16);
+  return internal::normalize_rdf<T, N>(std::move(counts), particles.size(),
+                                       internal::box_volume(boundary), r_max);
+}
+
+}  // namespace analysis
+}  // namespace particles
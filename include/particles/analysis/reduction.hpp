@@ -0,0 +1,125 @@
+/**
+ * @file reduction.hpp
+ *
+ * @brief reductions over particles and adjacency lists
+ *
+ * Reductions run in parallel over blocks. Sums are taken pairwise (see
+ * particles::sum) and variances are merged with Chan's formula, so that they
+ * keep precision for long ranges.
+ */
+
+#pragma once
+
+#include "../parallel.hpp"
+#include "../particle.hpp"
+#include "../range.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace particles {
+namespace analysis {
+
+/**
+ * @brief count, mean, variance, min and max of samples
+ */
+struct Statistics {
+  std::size_t count;
+  double mean;
+  double variance;  ///< population variance
+  double min;
+  double max;
+
+  Statistics()
+      : count(0), mean(0), variance(0),
+        min(std::numeric_limits<double>::infinity()),
+        max(-std::numeric_limits<double>::infinity()) {}
+
+  /** @brief add a sample (Welford's algorithm) */
+  void add(double x) {
+    count++;
+    const double d = x - mean;
+    mean += d / count;
+    variance += (d * (x - mean) - variance) / count;
+    min = std::min(min, x);
+    max = std::max(max, x);
+  }
+
+  /** @brief merge statistics of two sets of samples */
+  static Statistics merge(const Statistics& a, const Statistics& b) {
+    if (a.count == 0) return b;
+    if (b.count == 0) return a;
+    Statistics s;
+    s.count = a.count + b.count;
+    const double wa = double(a.count) / s.count;
+    const double wb = double(b.count) / s.count;
+    const double d = b.mean - a.mean;
+    s.mean = a.mean + d * wb;
+    s.variance = a.variance * wa + b.variance * wb + d * d * wa * wb;
+    s.min = std::min(a.min, b.min);
+    s.max = std::max(a.max, b.max);
+    return s;
+  }
+};
+
+/**
+ * @brief polar order parameter \f$|\sum_i \vec{v}_i| / (N v_0)\f$
+ * @param v0 speed of particles
+ */
+template <class T, std::size_t N, class I>
+T polar_order(const std::vector<Particle<T, N, I>>& particles, T v0) {
+  if (particles.empty()) return T(0);
+  const auto s = sum(particles.begin(), particles.end(),
+                     [](const Particle<T, N, I>& p) -> const Vec<T, N>& {
+                       return p.velocity();
+                     });
+  return s.length() / (particles.size() * v0);
+}
+
+/**
+ * @brief statistics of the number of neighbors in an adjacency list
+ */
+template <class AdjacencyList>
+Statistics neighbor_statistics(const AdjacencyList& adjacency_list) {
+  return parallel::reduce(
+      adjacency_list.size(), Statistics(),
+      [&adjacency_list](std::size_t first, std::size_t last) {
+        Statistics s;
+        for (auto i = first; i < last; i++) s.add(adjacency_list[i].size());
+        return s;
+      },
+      &Statistics::merge, 1 << 14);
+}
+
+/**
+ * @brief histogram of speeds \f$|\vec{v}|\f$
+ *
+ * [0, vmax) is divided into bins. Speeds out of the range are not counted.
+ * Each thread fills its own histogram and they are merged at the end.
+ */
+template <class T, std::size_t N, class I>
+std::vector<std::size_t> velocity_histogram(
+    const std::vector<Particle<T, N, I>>& particles, T vmax, std::size_t bins) {
+  typedef std::vector<std::size_t> histogram_type;
+  const T scale = bins / vmax;
+  return parallel::reduce(
+      particles.size(), histogram_type(bins),
+      [&](std::size_t first, std::size_t last) {
+        histogram_type h(bins);
+        for (auto i = first; i < last; i++) {
+          const T b = particles[i].velocity().length() * scale;
+          if (b >= 0 && b < bins) h[static_cast<std::size_t>(b)]++;
+        }
+        return h;
+      },
+      [](histogram_type a, const histogram_type& b) {
+        for (std::size_t k = 0; k < a.size(); k++) a[k] += b[k];
+        return a;
+      },
+      1 << 14);
+}
+
+}  // namespace analysis
+}  // namespace particles
@@ -6,6 +6,7 @@
 
 #pragma once
 
+#include "instrument.hpp"
 #include "vec.hpp"
 #include "particle.hpp"
 #include "range.hpp"
@@ -106,9 +107,37 @@ class PeriodicBoundary : public BoundaryBase<T, N> {
   }
 
   void apply(Particle<T, N>& p) {
+    PARTICLES_COUNT("boundary.periodic.apply", 1);
     internal::PeriodicRectImpl<T, N>::apply(p.position(), left_, right_);
   }
 
+  /** @brief lower bounds */
+  const std::array<T, N>& left() const { return left_; }
+  /** @brief upper bounds */
+  const std::array<T, N>& right() const { return right_; }
+  /** @brief length of the box in i-th dimension */
+  T length(std::size_t i) const { return right_[i] - left_[i]; }
+
+  /**
+   * @brief displacement from u to v in the minimum image convention
+   *
+   * Each element is moved into \f$[-L/2, L/2)\f$.
+   */
+  Vec<T, N> displacement(const Vec<T, N>& u, const Vec<T, N>& v) const {
+    Vec<T, N> d;
+    for (std::size_t i = 0; i < N; i++) {
+      const T L = length(i);
+      d[i] = v[i] - u[i];
+      d[i] -= L * std::floor(d[i] / L + T(0.5));
+    }
+    return d;
+  }
+
+  /** @brief squared distance in the minimum image convention */
+  T squared_distance(const Vec<T, N>& u, const Vec<T, N>& v) const {
+    return displacement(u, v).squared_length();
+  }
+
  private:
   std::array<T, N> left_;
   std::array<T, N> right_;
@@ -0,0 +1,306 @@
+/**
+ * @file adjacency_list.hpp
+ *
+ * @brief adjacency lists with rows allocated from a monotonic arena
+ */
+
+#pragma once
+
+#include "../instrument.hpp"
+#include "../util.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+
+namespace particles {
+namespace search {
+namespace internal {
+
+/**
+ * @brief monotonic arena handing out memory from large blocks
+ *
+ * Memory is never freed one by one but all at once by reset(). If more than
+ * one block was used since the last reset, the blocks are merged into one,
+ * so that the next round of a similar size allocates nothing. allocate() may
+ * be called from several threads.
+ */
+class Arena {
+ public:
+  explicit Arena(std::size_t block_size = 4096)
+      : blocks_(), sizes_(), used_(0), block_size_(block_size), mutex_() {}
+
+  /** @brief bytes aligned to align (a power of 2) */
+  void* allocate(std::size_t bytes, std::size_t align) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!blocks_.empty()) {
+      if (void* p = bump(bytes, align)) return p;
+    }
+    const std::size_t last = sizes_.empty() ? 0 : 2 * sizes_.back();
+    add_block(std::max(bytes + align, std::max(block_size_, last)));
+    return bump(bytes, align);
+  }
+
+  /** @brief release all memory for reuse */
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (blocks_.size() > 1) {
+      std::size_t total = 0;
+      for (auto size : sizes_) total += size;
+      blocks_.clear();
+      sizes_.clear();
+      add_block(total);
+    }
+    used_ = 0;
+  }
+
+  /** @brief bytes held by the arena */
+  std::size_t capacity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::size_t total = 0;
+    for (auto size : sizes_) total += size;
+    return total;
+  }
+
+  /** @brief number of blocks held by the arena */
+  std::size_t num_blocks() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return blocks_.size();
+  }
+
+ private:
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  std::vector<std::size_t> sizes_;
+  std::size_t used_;  // in the last block
+  std::size_t block_size_;
+  mutable std::mutex mutex_;
+
+  void add_block(std::size_t size) {
+    blocks_.emplace_back(new char[size]);
+    sizes_.push_back(size);
+    used_ = 0;
+  }
+
+  void* bump(std::size_t bytes, std::size_t align) {
+    const auto base = reinterpret_cast<std::uintptr_t>(blocks_.back().get());
+    const auto first = (base + used_ + align - 1) & ~(align - 1);
+    if (first + bytes > base + sizes_.back()) return nullptr;
+    used_ = first + bytes - base;
+    return reinterpret_cast<void*>(first);
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(Arena);
+};
+
+/**
+ * @brief allocator from an Arena, or from the heap without an arena
+ *
+ * Copies of containers get the heap, so that they do not depend on the
+ * arena. Moves and swaps take the arena along.
+ */
+template <class T>
+class ArenaAllocator {
+ public:
+  typedef T value_type;
+  typedef std::true_type propagate_on_container_move_assignment;
+  typedef std::true_type propagate_on_container_swap;
+
+  ArenaAllocator() noexcept : arena_(nullptr) {}
+  explicit ArenaAllocator(Arena* arena) noexcept : arena_(arena) {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U>& other) noexcept
+      : arena_(other.arena()) {}
+
+  T* allocate(std::size_t n) {
+    if (!arena_) return std::allocator<T>().allocate(n);
+    return static_cast<T*>(arena_->allocate(n * sizeof(T), alignof(T)));
+  }
+
+  void deallocate(T* p, std::size_t n) {
+    if (!arena_) std::allocator<T>().deallocate(p, n);
+  }
+
+  ArenaAllocator select_on_container_copy_construction() const {
+    return ArenaAllocator();
+  }
+
+  Arena* arena() const { return arena_; }
+
+ private:
+  Arena* arena_;
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return a.arena() == b.arena();
+}
+
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T>& a, const ArenaAllocator<U>& b) {
+  return !(a == b);
+}
+
+}  // namespace internal
+
+/**
+ * @brief adjacency list whose rows are allocated from its own arena
+ *
+ * A vector of rows (vectors of pointers to particles). Searchers call
+ * reset(n) at the beginning of each search, which releases all rows at once
+ * and reserves each new row for the number of neighbors it had at the last
+ * search (with some slack). So steady runs allocate nothing per step, and
+ * rows of a search lie next to each other in memory instead of being
+ * scattered over the heap.
+ *
+ * Rows are valid until the next reset. Copies of the list or of its rows
+ * are allocated on the heap and stay valid. The list wraps the vector of
+ * rows rather than deriving from it, so that rows can be added only by
+ * resize() and reset(), which give them the arena.
+ *
+ * @tparam P particle
+ */
+template <class P>
+class AdjacencyList {
+ public:
+  typedef internal::ArenaAllocator<const P*> allocator_type;
+  typedef std::vector<const P*, allocator_type> row_type;
+  typedef std::vector<row_type> rows_type;
+  typedef row_type value_type;
+  typedef typename rows_type::size_type size_type;
+  typedef typename rows_type::difference_type difference_type;
+  typedef typename rows_type::reference reference;
+  typedef typename rows_type::const_reference const_reference;
+  typedef typename rows_type::iterator iterator;
+  typedef typename rows_type::const_iterator const_iterator;
+
+  AdjacencyList() : rows_(), arena_(new internal::Arena()), counts_() {}
+
+  /** @brief n empty rows */
+  explicit AdjacencyList(std::size_t n) : AdjacencyList() { resize(n); }
+
+  AdjacencyList(const AdjacencyList& other)
+      : rows_(other.rows_), arena_(new internal::Arena()), counts_() {}
+
+  AdjacencyList(AdjacencyList&&) = default;
+
+  AdjacencyList& operator=(const AdjacencyList& other) {
+    rows_ = other.rows_;
+    return *this;
+  }
+
+  AdjacencyList& operator=(AdjacencyList&&) = default;
+
+  reference operator[](std::size_t i) { return rows_[i]; }
+  const_reference operator[](std::size_t i) const { return rows_[i]; }
+  reference front() { return rows_.front(); }
+  const_reference front() const { return rows_.front(); }
+  reference back() { return rows_.back(); }
+  const_reference back() const { return rows_.back(); }
+
+  iterator begin() { return rows_.begin(); }
+  iterator end() { return rows_.end(); }
+  const_iterator begin() const { return rows_.begin(); }
+  const_iterator end() const { return rows_.end(); }
+  const_iterator cbegin() const { return rows_.cbegin(); }
+  const_iterator cend() const { return rows_.cend(); }
+
+  std::size_t size() const { return rows_.size(); }
+  bool empty() const { return rows_.empty(); }
+  std::size_t capacity() const { return rows_.capacity(); }
+  void reserve(std::size_t n) { rows_.reserve(n); }
+  void clear() { rows_.clear(); }
+
+  /** @brief the vector of rows, e.g. for numa::distribute */
+  const rows_type& rows() const { return rows_; }
+
+  /** @brief allocator of rows in the arena */
+  allocator_type row_allocator() const { return allocator_type(arena_.get()); }
+
+  /** @brief new rows are allocated in the arena */
+  void resize(std::size_t n) {
+    if (n <= rows_.size()) {
+      rows_.resize(n);
+      return;
+    }
+    rows_.reserve(n);
+    while (rows_.size() < n) rows_.emplace_back(row_allocator());
+  }
+
+  /**
+   * @brief n empty rows reserved from the sizes of the current rows
+   *
+   * Memory of all rows is released, so references to rows and their
+   * elements are invalidated.
+   */
+  void reset(std::size_t n) {
+    PARTICLES_TIME("search.reset");
+    const std::size_t m = rows_.size();
+    counts_.resize(m);
+    std::size_t total = 0;
+    for (std::size_t i = 0; i < m; i++) {
+      counts_[i] = rows_[i].size();
+      total += counts_[i];
+      PARTICLES_HISTOGRAM("search.neighbors", counts_[i]);  // last search
+    }
+    rows_.clear();
+    if (arena_) arena_->reset();
+
+    resize(n);
+    const std::size_t mean = m > 0 ? total / m : 0;
+    for (std::size_t i = 0; i < n; i++) {
+      const std::size_t c = i < m ? counts_[i] : mean;
+      if (c > 0) rows_[i].reserve(c + c / 8 + 1);
+    }
+  }
+
+  /** @brief bytes held by the arena */
+  std::size_t arena_capacity() const {
+    return arena_ ? arena_->capacity() : 0;
+  }
+
+ private:
+  rows_type rows_;
+  std::unique_ptr<internal::Arena> arena_;
+  std::vector<std::size_t> counts_;
+};
+
+namespace internal {
+
+/** @brief n empty rows, reusing memory of the last search */
+template <class AdjacencyList>
+void reset_rows(AdjacencyList& adjacency_list, std::size_t n) {
+  adjacency_list.resize(n);
+  for (auto& row : adjacency_list) row.clear();
+}
+
+template <class P>
+void reset_rows(AdjacencyList<P>& adjacency_list, std::size_t n) {
+  adjacency_list.reset(n);
+}
+
+/**
+ * @brief cost hint of filling rows after reset_rows
+ *
+ * Rows keep (or are reserved for) the capacity of the last search, so the
+ * capacity hints at the number of neighbors a query will find. For
+ * parallel::for_each_weighted.
+ */
+template <class AdjacencyList>
+struct RowCapacity {
+  const AdjacencyList* adjacency_list;
+  std::size_t operator()(std::size_t i) const {
+    return (*adjacency_list)[i].capacity() + 1;
+  }
+};
+
+template <class AdjacencyList>
+RowCapacity<AdjacencyList> row_capacity(const AdjacencyList& adjacency_list) {
+  return RowCapacity<AdjacencyList>{&adjacency_list};
+}
+
+}  // namespace internal
+}  // namespace search
+}  // namespace particles
@@ -0,0 +1,176 @@
+/**
+ * @file cell_list.hpp
+ *
+ * @brief uniform grid of cells holding particle indices
+ */
+
+#pragma once
+
+#include "../vec.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <vector>
+
+namespace particles {
+namespace search {
+namespace internal {
+
+/**
+ * @brief particles sorted into a uniform grid of cells
+ *
+ * Indices of particles are stored contiguously for each cell (like CSR), so
+ * that a cell is a range [cell_begin(c), cell_end(c)) of indices().
+ *
+ * With periodic boundary, cells are adjacent across the faces of the box and
+ * squared_distance uses the minimum image convention.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class CellList {
+ public:
+  CellList()
+      : lower_(), length_(), dims_(), periodic_(false),
+        cell_start_(), indices_(), cell_of_() {}
+
+  /**
+   * @brief sort particles into cells whose width is at least r
+   * @param lower, upper box. Outside particles are put in the nearest cell
+   *        (or wrapped if periodic)
+   * @param positions positions(i) returns position of i-th particle
+   */
+  template <class Positions>
+  void build(std::size_t n, Positions positions, const Vec<T, N>& lower,
+             const Vec<T, N>& upper, T r, bool periodic) {
+    lower_ = lower;
+    periodic_ = periodic;
+    std::size_t num_cells = 1;
+    for (std::size_t d = 0; d < N; d++) {
+      length_[d] = upper[d] - lower[d];
+      const T m = r > 0 ? std::floor(length_[d] / r) : T(1);
+      dims_[d] = m >= 1 ? static_cast<std::size_t>(m) : 1;
+      num_cells *= dims_[d];
+    }
+
+    // counting sort of particles by cell
+    cell_of_.resize(n);
+    cell_start_.assign(num_cells + 1, 0);
+    for (std::size_t i = 0; i < n; i++) {
+      cell_of_[i] = cell_index(positions(i));
+      cell_start_[cell_of_[i] + 1]++;
+    }
+    for (std::size_t c = 0; c < num_cells; c++) {
+      cell_start_[c + 1] += cell_start_[c];
+    }
+    indices_.resize(n);
+    std::vector<std::size_t> fill(cell_start_.begin(), cell_start_.end() - 1);
+    for (std::size_t i = 0; i < n; i++) indices_[fill[cell_of_[i]]++] = i;
+  }
+
+  std::size_t num_cells() const { return cell_start_.size() - 1; }
+  std::size_t dim(std::size_t d) const { return dims_[d]; }
+  bool periodic() const { return periodic_; }
+
+  /** @brief width of cells in d-th dimension */
+  T width(std::size_t d) const { return length_[d] / dims_[d]; }
+
+  /** @brief particle indices sorted by cell */
+  const std::vector<std::size_t>& indices() const { return indices_; }
+  std::size_t cell_begin(std::size_t c) const { return cell_start_[c]; }
+  std::size_t cell_end(std::size_t c) const { return cell_start_[c + 1]; }
+
+  /** @brief cell of i-th particle */
+  std::size_t cell_of(std::size_t i) const { return cell_of_[i]; }
+
+  /** @brief cell containing x */
+  std::size_t cell_index(const Vec<T, N>& x) const {
+    std::size_t c = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      c = c * dims_[d] + coordinate(x[d], d);
+    }
+    return c;
+  }
+
+  /**
+   * @brief call f(c) for cells within reach cells from cell c (including c)
+   *
+   * Each cell is visited once even if the grid is narrower than the reach
+   * in periodic boundary.
+   */
+  template <class Function>
+  void for_each_adjacent_cell(std::size_t c, Function f,
+                              std::size_t reach = 1) const {
+    // visits (start[d] + k) % dims_[d] for k in [0, count[d])
+    std::array<std::size_t, N> start, count;
+    for (std::size_t d = N; d-- > 0;) {
+      const auto n = dims_[d];
+      const auto x = c % n;
+      c /= n;
+      if (periodic_ && 2 * reach + 1 >= n) {
+        start[d] = 0;
+        count[d] = n;
+      } else if (periodic_) {
+        start[d] = x + n - reach;
+        count[d] = 2 * reach + 1;
+      } else {
+        start[d] = x >= reach ? x - reach : 0;
+        count[d] = std::min(x + reach, n - 1) - start[d] + 1;
+      }
+    }
+    for_each_product(start, count, 0, 0, f);
+  }
+
+  /** @brief squared distance (minimum image convention if periodic) */
+  T squared_distance(const Vec<T, N>& u, const Vec<T, N>& v) const {
+    T s = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      T x = v[d] - u[d];
+      if (periodic_) x -= length_[d] * std::floor(x / length_[d] + T(0.5));
+      s += x * x;
+    }
+    return s;
+  }
+
+ private:
+  Vec<T, N> lower_;
+  std::array<T, N> length_;
+  std::array<std::size_t, N> dims_;
+  bool periodic_;
+  std::vector<std::size_t> cell_start_;
+  std::vector<std::size_t> indices_;
+  std::vector<std::size_t> cell_of_;
+
+  std::size_t coordinate(T x, std::size_t d) const {
+    const T u = (x - lower_[d]) / length_[d] * dims_[d];
+    const auto n = static_cast<long>(dims_[d]);
+    auto k = static_cast<long>(std::floor(u));
+    if (periodic_) {
+      k %= n;
+      if (k < 0) k += n;
+    } else {
+      k = std::min(std::max(k, 0L), n - 1);
+    }
+    return static_cast<std::size_t>(k);
+  }
+
+  template <class Function>
+  void for_each_product(const std::array<std::size_t, N>& start,
+                        const std::array<std::size_t, N>& count,
+                        std::size_t d, std::size_t c, Function& f) const {
+    if (d == N) {
+      f(c);
+      return;
+    }
+    for (std::size_t k = 0; k < count[d]; k++) {
+      const auto y = (start[d] + k) % dims_[d];
+      for_each_product(start, count, d + 1, c * dims_[d] + y, f);
+    }
+  }
+};
+
+}  // namespace internal
+}  // namespace search
+}  // namespace particles
@@ -0,0 +1,119 @@
+/**
+ * @file chebyshev.hpp
+ *
+ * @brief tensor product Chebyshev interpolation on cubes
+ */
+
+#pragma once
+
+#include "../vec.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace particles {
+namespace longrange {
+namespace internal {
+
+/**
+ * @brief Chebyshev interpolation of order p in N dimensions
+ *
+ * A function on \f$[-1, 1]^N\f$ is interpolated from its values at the
+ * \f$p^N\f$ tensor products of Chebyshev roots,
+ * \f$f(u) \approx \sum_m S(u, u_m) f(u_m)\f$, where
+ * \f$S(u, u_m) = \prod_d S_p(u_d, u_{m_d})\f$ and
+ * \f$S_p(x, y) = 1/p + 2/p \sum_{k=1}^{p-1} T_k(x) T_k(y)\f$.
+ * Multi-indices m are flattened with the first dimension fastest.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class Chebyshev {
+ public:
+  explicit Chebyshev(std::size_t order = 4) { set_order(order); }
+
+  void set_order(std::size_t order) {
+    p_ = std::max<std::size_t>(order, 1);
+    size_ = 1;
+    for (std::size_t d = 0; d < N; d++) size_ *= p_;
+    const T pi = std::acos(T(-1));
+    roots_.resize(p_);
+    polynomials_.resize(p_ * p_);
+    for (std::size_t m = 0; m < p_; m++) {
+      roots_[m] = std::cos((2 * m + 1) * pi / (2 * p_));
+      for (std::size_t k = 0; k < p_; k++) {
+        polynomials_[k * p_ + m] = std::cos(k * (2 * m + 1) * pi / (2 * p_));
+      }
+    }
+  }
+
+  /** @brief number of roots per dimension */
+  std::size_t order() const { return p_; }
+
+  /** @brief number of interpolation nodes, p^N */
+  std::size_t size() const { return size_; }
+
+  /** @brief position of m-th node in a cube of center c and half width h */
+  Vec<T, N> node(std::size_t m, const Vec<T, N>& c, T h) const {
+    Vec<T, N> x;
+    for (std::size_t d = 0; d < N; d++) {
+      x[d] = c[d] + h * roots_[m % p_];
+      m /= p_;
+    }
+    return x;
+  }
+
+  /**
+   * @brief S(u, u_m) for all nodes m
+   * @param u point in [-1, 1]^N (clamped)
+   * @param s array of size()
+   */
+  void weights(const Vec<T, N>& u, T* s) const {
+    T s1[N][max_order];
+    T* row[N];
+    std::vector<T> heap;
+    if (p_ > max_order) heap.resize(N * p_);
+    for (std::size_t d = 0; d < N; d++) {
+      row[d] = p_ > max_order ? &heap[d * p_] : s1[d];
+      const T x = std::min(std::max(u[d], T(-1)), T(1));
+      for (std::size_t m = 0; m < p_; m++) row[d][m] = T(1) / p_;
+      // T_k(x) by recurrence
+      T t0 = 1, t1 = x;
+      for (std::size_t k = 1; k < p_; k++) {
+        for (std::size_t m = 0; m < p_; m++) {
+          row[d][m] += T(2) / p_ * t1 * polynomials_[k * p_ + m];
+        }
+        const T t2 = 2 * x * t1 - t0;
+        t0 = t1;
+        t1 = t2;
+      }
+    }
+    for (std::size_t m = 0; m < size_; m++) {
+      T w = 1;
+      std::size_t k = m;
+      for (std::size_t d = 0; d < N; d++) {
+        w *= row[d][k % p_];
+        k /= p_;
+      }
+      s[m] = w;
+    }
+  }
+
+ private:
+  /** @brief orders up to this use the stack in weights */
+  static constexpr std::size_t max_order = 16;
+
+  std::size_t p_;
+  std::size_t size_;
+  std::vector<T> roots_;
+  std::vector<T> polynomials_;  // T_k(root_m) at k * p + m
+};
+
+template <class T, std::size_t N>
+constexpr std::size_t Chebyshev<T, N>::max_order;
+
+}  // namespace internal
+}  // namespace longrange
+}  // namespace particles
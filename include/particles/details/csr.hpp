@@ -0,0 +1,85 @@
+/**
+ * @file csr.hpp
+ *
+ * @brief results of batched queries in compressed sparse rows
+ */
+
+#pragma once
+
+#include "../parallel.hpp"
+
+#include <algorithm>
+#include <vector>
+
+namespace particles {
+namespace search {
+
+/**
+ * @brief indices found for each query in compressed sparse rows
+ *
+ * Indices of the q-th query are indices[offsets[q]] ... indices[offsets[q+1]]
+ * (exclusive), or [begin(q), end(q)).
+ */
+struct CSR {
+  typedef std::vector<std::size_t>::const_iterator const_iterator;
+
+  std::vector<std::size_t> offsets;
+  std::vector<std::size_t> indices;
+
+  /** @brief number of queries (rows) */
+  std::size_t size() const { return offsets.empty() ? 0 : offsets.size() - 1; }
+  /** @brief number of indices in q-th row */
+  std::size_t size(std::size_t q) const {
+    return offsets[q + 1] - offsets[q];
+  }
+
+  const_iterator begin(std::size_t q) const {
+    return indices.cbegin() + offsets[q];
+  }
+  const_iterator end(std::size_t q) const {
+    return indices.cbegin() + offsets[q + 1];
+  }
+};
+
+namespace internal {
+
+/** @brief appends found indices (assignable, unlike lambdas) */
+struct PushIndex {
+  std::vector<std::size_t>* indices;
+  void operator()(std::size_t j) const { indices->push_back(j); }
+};
+
+/**
+ * @brief run queries in parallel and gather results into csr
+ * @param visit visit(q, f) calls f(j) for each index j found by q-th query.
+ *        f is a PushIndex, which can be wrapped in an output iterator.
+ */
+template <class Visit>
+void fill_csr(std::size_t n, Visit visit, CSR& csr) {
+  const std::size_t grain = 256;
+  const auto blocks = parallel::num_blocks(n, grain);
+  std::vector<std::vector<std::size_t>> found(blocks);
+  csr.offsets.assign(n + 1, 0);
+
+  parallel::for_each_block(n, [&](std::size_t first, std::size_t last,
+                                  std::size_t b) {
+    auto& f = found[b];
+    for (auto q = first; q < last; q++) {
+      const auto before = f.size();
+      visit(q, PushIndex{&f});
+      csr.offsets[q + 1] = f.size() - before;
+    }
+  }, grain);
+
+  for (std::size_t q = 0; q < n; q++) csr.offsets[q + 1] += csr.offsets[q];
+  csr.indices.resize(csr.offsets[n]);
+  parallel::for_each_block(n, [&](std::size_t first, std::size_t,
+                                  std::size_t b) {
+    std::copy(found[b].begin(), found[b].end(),
+              csr.indices.begin() + csr.offsets[first]);
+  }, grain);
+}
+
+}  // namespace internal
+}  // namespace search
+}  // namespace particles
@@ -6,11 +6,21 @@
 
 #pragma once
 
+#include "../instrument.hpp"
+#include "adjacency_list.hpp"
+
 #include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/Delaunay_triangulation_2.h>
 #include <CGAL/Delaunay_triangulation_3.h>
 #include <CGAL/Triangulation_vertex_base_with_info_2.h>
 #include <CGAL/Triangulation_vertex_base_with_info_3.h>
+#include <boost/iterator/function_output_iterator.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+#include <limits>
+#include <vector>
 
 namespace particles {
 namespace search {
@@ -37,6 +47,18 @@ struct VecToPoint<Point, T, 3> {
   }
 };
 
+/** @brief output iterator function appending particle of a vertex */
+template <class Neighbors, class Particles>
+struct AppendVertex {
+  Neighbors* neighbors;
+  const Particles* particles;
+
+  template <class VertexHandle>
+  void operator()(const VertexHandle& v) const {
+    neighbors->push_back(&(*particles)[v->info()]);
+  }
+};
+
 /**
  * @brief Walk adjacent vertices in 2d
  */
@@ -70,63 +92,242 @@ template <std::size_t N, class Delaunay, class AdjacencyList, class Particles>
 typename std::enable_if<N==3, void>::type
   walk_adjacent_vertices(
       Delaunay& delaunay, AdjacencyList& adjacency_list, Particles& particles) {
-    typedef typename Delaunay::Vertex_handle Vertex_handle;
+    typedef typename AdjacencyList::value_type Neighbors;
+    typedef AppendVertex<Neighbors, Particles> Append;
 
-    std::vector<Vertex_handle> adjacent_vertices(particles.size());
     // Loop for all vertices
     auto vit = delaunay.finite_vertices_begin();
     while (vit != delaunay.finite_vertices_end()) {
       auto& neighbors = adjacency_list[vit->info()];
       neighbors.clear();
 
-      // Loop for adjacent vertices of the vertex
-      auto adjacent_end =
-          delaunay.finite_adjacent_vertices(vit, adjacent_vertices.begin());
-      auto it = adjacent_vertices.begin();
-      while (it != adjacent_end) {
-        neighbors.push_back(&(particles[(*it)->info()]));
-        ++it;
+      // Adjacent vertices are appended directly without a scratch array
+      delaunay.finite_adjacent_vertices(
+          vit, boost::make_function_output_iterator(
+                   Append{&neighbors, &particles}));
+      ++vit;
+    }
+  }
+
+/**
+ * @brief Walk Voronoi cells in 2d
+ *
+ * The Voronoi edge dual to a Delaunay edge (v, u) connects circumcenters of
+ * the two faces sharing it. The area of the cell is the sum of triangles
+ * spanned by v and its Voronoi edges: \f$\sum_u L_{vu} |x_u - x_v| / 4\f$.
+ * Cells on the convex hull are unbounded and get infinity.
+ */
+template <std::size_t N, class Delaunay, class AdjacencyList, class Particles,
+          class T>
+typename std::enable_if<N==2, void>::type
+  walk_voronoi_cells(
+      Delaunay& delaunay, AdjacencyList& adjacency_list, Particles& particles,
+      std::vector<T>& volumes, std::vector<std::vector<T>>& faces) {
+    typedef typename Delaunay::Vertex_handle Vertex_handle;
+    const T inf = std::numeric_limits<T>::infinity();
+
+    auto vit = delaunay.finite_vertices_begin();
+    while (vit != delaunay.finite_vertices_end()) {
+      Vertex_handle v = vit;
+      auto& neighbors = adjacency_list[v->info()];
+      auto& lengths = faces[v->info()];
+      neighbors.clear();
+      lengths.clear();
+      T area = 0;
+
+      // Loop for incident edges in circular way
+      auto ec = delaunay.incident_edges(v);
+      decltype(ec) done = ec;
+      if (ec != 0) {
+        do {
+          const auto f = ec->first;
+          const int k = ec->second;
+          auto u = f->vertex(delaunay.cw(k));
+          if (u == v) u = f->vertex(delaunay.ccw(k));
+          if (delaunay.is_infinite(u)) {
+            area = inf;
+            continue;
+          }
+          const auto g = f->neighbor(k);
+          T length = inf;
+          if (!delaunay.is_infinite(f) && !delaunay.is_infinite(g)) {
+            length = std::sqrt(
+                CGAL::squared_distance(delaunay.dual(f), delaunay.dual(g)));
+          }
+          const T h = std::sqrt(
+              CGAL::squared_distance(v->point(), u->point())) / 2;
+          area += length * h / 2;
+          neighbors.push_back(&(particles[u->info()]));
+          lengths.push_back(length);
+        } while(++ec != done);
+      }
+      volumes[v->info()] = area;
+      ++vit;
+    }
+  }
+
+/**
+ * @brief Walk Voronoi cells in 3d
+ *
+ * The Voronoi facet dual to a Delaunay edge (v, u) is the polygon of
+ * circumcenters of cells around the edge. The volume of the cell is the sum
+ * of pyramids spanned by v and its facets: \f$\sum_u A_{vu} |x_u - x_v| / 6\f$.
+ * Cells on the convex hull are unbounded and get infinity.
+ */
+template <std::size_t N, class Delaunay, class AdjacencyList, class Particles,
+          class T>
+typename std::enable_if<N==3, void>::type
+  walk_voronoi_cells(
+      Delaunay& delaunay, AdjacencyList& adjacency_list, Particles& particles,
+      std::vector<T>& volumes, std::vector<std::vector<T>>& faces) {
+    typedef typename Delaunay::Vertex_handle Vertex_handle;
+    typedef typename Delaunay::Edge Edge;
+    typedef typename Delaunay::Point Point;
+    typedef typename Delaunay::Geom_traits::Vector_3 Vector;
+    const T inf = std::numeric_limits<T>::infinity();
+
+    std::vector<Edge> edges;
+    std::vector<Point> polygon;
+    auto vit = delaunay.finite_vertices_begin();
+    while (vit != delaunay.finite_vertices_end()) {
+      Vertex_handle v = vit;
+      auto& neighbors = adjacency_list[v->info()];
+      auto& areas = faces[v->info()];
+      neighbors.clear();
+      areas.clear();
+      T volume = 0;
+
+      edges.clear();
+      delaunay.incident_edges(v, std::back_inserter(edges));
+      for (const auto& e : edges) {
+        auto u = e.first->vertex(e.second);
+        if (u == v) u = e.first->vertex(e.third);
+        if (delaunay.is_infinite(u)) {
+          volume = inf;
+          continue;
+        }
+
+        // Loop for cells around the edge
+        bool bounded = true;
+        polygon.clear();
+        auto cc = delaunay.incident_cells(e);
+        decltype(cc) done = cc;
+        do {
+          typename Delaunay::Cell_handle c = cc;
+          if (delaunay.is_infinite(c)) {
+            bounded = false;
+            break;
+          }
+          polygon.push_back(delaunay.dual(c));
+        } while (++cc != done);
+
+        T area = inf;
+        if (bounded) {
+          Vector s(0, 0, 0);
+          for (std::size_t k = 1; k + 1 < polygon.size(); k++) {
+            s = s + CGAL::cross_product(polygon[k] - polygon[0],
+                                        polygon[k + 1] - polygon[0]);
+          }
+          area = std::sqrt(s.squared_length()) / 2;
+        }
+        const T h = std::sqrt(
+            CGAL::squared_distance(v->point(), u->point())) / 2;
+        volume += area * h / 3;
+        neighbors.push_back(&(particles[u->info()]));
+        areas.push_back(area);
       }
+      volumes[v->info()] = volume;
       ++vit;
     }
   }
 
 /**
  * @brief Executes triangulation and creates adjacency list
+ *
+ * The triangulation and the buffer of input points are kept over searches.
+ *
  * @tparam Delaunay triangulation
  * @tparam T floating point
  * @tparam N dimension
  */
 template <class Delaunay, class T, std::size_t N>
-struct DelaunaySearchImpl {
+class DelaunaySearchImpl {
+ public:
   typedef typename Delaunay::Point Point;
 
+  DelaunaySearchImpl() : delaunay_(), point_info_() {}
+
+  template <class Particles>
+  void triangulate(const Particles& particles) {
+    PARTICLES_TIME("search.delaunay.triangulate");
+    point_info_.clear();
+    for (std::size_t i=0; i<particles.size(); i++) {
+      const auto& pos = particles[i].position();
+      point_info_.emplace_back(VecToPoint<Point,T,N>::generate(pos), i);
+    }
+    delaunay_.clear();
+    delaunay_.insert(point_info_.begin(), point_info_.end());
+  }
+
   /**
    * @brief execute searching
    * @tparam AdjacencyList
-   * @tparam Iterator random access iterator
+   * @tparam Particles random access container of particles
    */
   template <class AdjacencyList, class Particles>
-  static void search(Delaunay& delaunay, AdjacencyList& adjacency_list,
-                     const Particles& particles) {
+  void search(AdjacencyList& adjacency_list, const Particles& particles) {
     // Triangulation
-    std::vector<std::pair<Point, std::size_t>> point_info;
-    for (std::size_t i=0; i<particles.size(); i++) {
-      const auto& pos = particles[i].position();
-      auto point = VecToPoint<Point,T,N>::generate(pos);
-      point_info.emplace_back(point, i);
-    }
-    delaunay.clear();
-    delaunay.insert(point_info.begin(), point_info.end());
+    triangulate(particles);
 
     // Set adjacent vertices
-    adjacency_list.resize(particles.size());
-    walk_adjacent_vertices<N>(delaunay, adjacency_list, particles);
+    reset_rows(adjacency_list, particles.size());
+    PARTICLES_TIME("search.delaunay.fill");
+    walk_adjacent_vertices<N>(delaunay_, adjacency_list, particles);
+  }
+
+  /**
+   * @brief execute searching and compute Voronoi cells in the same pass
+   * @param volumes area (2d) or volume (3d) of Voronoi cell of each particle
+   * @param faces faces[i][k]: length (2d) or area (3d) of Voronoi face shared
+   *              by i-th particle and adjacency_list[i][k]
+   */
+  template <class AdjacencyList, class Particles>
+  void search(AdjacencyList& adjacency_list, const Particles& particles,
+              std::vector<T>& volumes, std::vector<std::vector<T>>& faces) {
+    triangulate(particles);
+
+    reset_rows(adjacency_list, particles.size());
+    volumes.resize(particles.size());
+    faces.resize(particles.size());
+    PARTICLES_TIME("search.delaunay.voronoi");
+    if (delaunay_.dimension() < static_cast<int>(N)) {
+      // too few particles or all on a plane (line): there are no cells to
+      // walk, and every Voronoi cell and face is unbounded
+      const T inf = std::numeric_limits<T>::infinity();
+      walk_adjacent_vertices<N>(delaunay_, adjacency_list, particles);
+      std::fill(volumes.begin(), volumes.end(), inf);
+      for (std::size_t i = 0; i < particles.size(); i++) {
+        faces[i].assign(adjacency_list[i].size(), inf);
+      }
+      return;
+    }
+    walk_voronoi_cells<N>(delaunay_, adjacency_list, particles, volumes,
+                          faces);
   }
+
+  const Delaunay& delaunay() const { return delaunay_; }
+
+ private:
+  Delaunay delaunay_;
+  std::vector<std::pair<Point, std::size_t>> point_info_;
 };
 
 /**
  * @brief Type of delaunay triangulation class.
+ *
+ * The kernel is Epick regardless of T. Its filtered predicates are exact only
+ * for double input, and a float kernel would break robustness of the
+ * triangulation.
  */
 template <class T, std::size_t N>
 struct DelaunayType;
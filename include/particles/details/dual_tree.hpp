@@ -0,0 +1,246 @@
+/**
+ * @file dual_tree.hpp
+ *
+ * @brief all pairs range search by dual-tree traversal of a kd-tree
+ */
+
+#pragma once
+
+#include "../parallel.hpp"
+#include "../vec.hpp"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace particles {
+namespace search {
+namespace internal {
+
+/**
+ * @brief kd-tree over particle indices with bounding boxes
+ *
+ * for_each_pair walks pairs of nodes instead of running a query per
+ * particle. A pair of nodes farther than r is pruned, and a pair whose
+ * farthest points are within r emits all of its pairs without computing
+ * distances, which is where clustered data gains the most.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class DualTree {
+ public:
+  typedef std::pair<std::size_t, std::size_t> pair_type;
+
+  DualTree() : leaf_size_(16), order_(), nodes_() {}
+
+  void set_leaf_size(std::size_t leaf_size) {
+    leaf_size_ = std::max<std::size_t>(leaf_size, 1);
+  }
+
+  /**
+   * @brief build the tree
+   * @param positions positions(i) returns position of i-th particle
+   */
+  template <class Positions>
+  void build(std::size_t n, Positions positions) {
+    order_.resize(n);
+    for (std::size_t i = 0; i < n; i++) order_[i] = i;
+    nodes_.clear();
+    if (n > 0) build_node(0, n, positions);
+  }
+
+  std::size_t num_nodes() const { return nodes_.size(); }
+
+  /**
+   * @brief collect pairs (i, j), i != j, within r
+   *
+   * Each unordered pair is found once. Node pairs are split into tasks
+   * processed in parallel, and each block of tasks writes to its own
+   * buffer.
+   *
+   * @param buffers pairs found by each block
+   */
+  template <class Positions>
+  void for_each_pair(Positions positions, T r,
+                     std::vector<std::vector<pair_type>>& buffers) const {
+    buffers.clear();
+    if (nodes_.empty()) return;
+    const T r2 = r * r;
+
+    // expand node pairs from the root until there are enough tasks
+    std::vector<std::pair<std::size_t, std::size_t>> tasks{{0, 0}}, next;
+    const std::size_t enough = 16 * parallel::num_threads();
+    bool expanded = true;
+    while (tasks.size() < enough && expanded) {
+      expanded = false;
+      next.clear();
+      for (const auto& t : tasks) {
+        std::size_t children[4][2];
+        const auto k = classify(t.first, t.second, r2) == Action::split
+            ? split(t.first, t.second, children) : 0;
+        if (k == 0) next.push_back(t);
+        for (std::size_t c = 0; c < k; c++) {
+          next.emplace_back(children[c][0], children[c][1]);
+        }
+        expanded = expanded || k > 0;
+      }
+      tasks.swap(next);
+    }
+
+    buffers.resize(parallel::num_blocks(tasks.size(), 1));
+    parallel::for_each_block(tasks.size(), [&](std::size_t first,
+                                               std::size_t last,
+                                               std::size_t b) {
+      auto& buffer = buffers[b];
+      buffer.clear();
+      for (auto t = first; t < last; t++) {
+        traverse(tasks[t].first, tasks[t].second, positions, r2, buffer);
+      }
+    }, 1);
+  }
+
+ private:
+  struct Node {
+    Vec<T, N> lower;
+    Vec<T, N> upper;
+    std::size_t first;  // range in order_
+    std::size_t last;
+    std::size_t left;   // children, or 0 for a leaf
+    std::size_t right;
+  };
+
+  enum class Action { prune, all, leaf, split };
+
+  std::size_t leaf_size_;
+  std::vector<std::size_t> order_;
+  std::vector<Node> nodes_;
+
+  template <class Positions>
+  std::size_t build_node(std::size_t first, std::size_t last,
+                         Positions& positions) {
+    const std::size_t index = nodes_.size();
+    nodes_.emplace_back();
+    Node node;
+    node.first = first;
+    node.last = last;
+    node.left = node.right = 0;
+    node.lower = node.upper = positions(order_[first]);
+    for (auto l = first + 1; l < last; l++) {
+      const auto& x = positions(order_[l]);
+      for (std::size_t d = 0; d < N; d++) {
+        node.lower[d] = std::min(node.lower[d], x[d]);
+        node.upper[d] = std::max(node.upper[d], x[d]);
+      }
+    }
+
+    if (last - first > leaf_size_) {
+      // split at the median of the widest dimension
+      std::size_t dim = 0;
+      for (std::size_t d = 1; d < N; d++) {
+        if (node.upper[d] - node.lower[d] > node.upper[dim] - node.lower[dim]) {
+          dim = d;
+        }
+      }
+      const auto middle = first + (last - first) / 2;
+      std::nth_element(order_.begin() + first, order_.begin() + middle,
+                       order_.begin() + last,
+                       [&positions, dim](std::size_t i, std::size_t j) {
+        return positions(i)[dim] < positions(j)[dim];
+      });
+      node.left = build_node(first, middle, positions);
+      node.right = build_node(middle, last, positions);
+    }
+    nodes_[index] = node;
+    return index;
+  }
+
+  bool is_leaf(const Node& node) const { return node.left == 0; }
+
+  /** @brief squared distance between boxes: nearest and farthest points */
+  std::pair<T, T> squared_distances(const Node& a, const Node& b) const {
+    T near = 0, far = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      const T gap = std::max({a.lower[d] - b.upper[d],
+                              b.lower[d] - a.upper[d], T(0)});
+      const T span = std::max(a.upper[d], b.upper[d]) -
+                     std::min(a.lower[d], b.lower[d]);
+      near += gap * gap;
+      far += span * span;
+    }
+    return std::make_pair(near, far);
+  }
+
+  Action classify(std::size_t a, std::size_t b, T r2) const {
+    const Node& na = nodes_[a];
+    const Node& nb = nodes_[b];
+    const auto d = squared_distances(na, nb);
+    if (d.first > r2) return Action::prune;
+    if (d.second <= r2) return Action::all;
+    if (is_leaf(na) && is_leaf(nb)) return Action::leaf;
+    return Action::split;
+  }
+
+  /**
+   * @brief child pairs of a node pair
+   *
+   * A node with itself gives (l, l), (l, r), (r, r). Otherwise the larger
+   * node which is not a leaf is split.
+   */
+  std::size_t split(std::size_t a, std::size_t b,
+                    std::size_t (&children)[4][2]) const {
+    const Node& na = nodes_[a];
+    const Node& nb = nodes_[b];
+    if (a == b) {
+      children[0][0] = na.left;  children[0][1] = na.left;
+      children[1][0] = na.left;  children[1][1] = na.right;
+      children[2][0] = na.right; children[2][1] = na.right;
+      return 3;
+    }
+    const bool split_a = !is_leaf(na) &&
+        (is_leaf(nb) || na.last - na.first >= nb.last - nb.first);
+    if (split_a) {
+      children[0][0] = na.left;  children[0][1] = b;
+      children[1][0] = na.right; children[1][1] = b;
+    } else {
+      children[0][0] = a; children[0][1] = nb.left;
+      children[1][0] = a; children[1][1] = nb.right;
+    }
+    return 2;
+  }
+
+  template <class Positions>
+  void traverse(std::size_t a, std::size_t b, Positions& positions, T r2,
+                std::vector<pair_type>& buffer) const {
+    const auto action = classify(a, b, r2);
+    if (action == Action::prune) return;
+    if (action == Action::split) {
+      std::size_t children[4][2];
+      const auto k = split(a, b, children);
+      for (std::size_t c = 0; c < k; c++) {
+        traverse(children[c][0], children[c][1], positions, r2, buffer);
+      }
+      return;
+    }
+
+    // all: every pair is within r, leaf: check distances
+    const bool check = action == Action::leaf;
+    const Node& na = nodes_[a];
+    const Node& nb = nodes_[b];
+    for (auto k = na.first; k < na.last; k++) {
+      const auto i = order_[k];
+      const auto& x = positions(i);
+      for (auto l = a == b ? k + 1 : nb.first; l < nb.last; l++) {
+        const auto j = order_[l];
+        if (!check || x.squared_distance(positions(j)) <= r2) {
+          buffer.emplace_back(i, j);
+        }
+      }
+    }
+  }
+};
+
+}  // namespace internal
+}  // namespace search
+}  // namespace particles
@@ -6,79 +6,210 @@
 
 #pragma once
 
+#include "../parallel.hpp"
+#include "../particle.hpp"
+#include "../instrument.hpp"
 #include "../range.hpp"
+#include "../util.hpp"
+#include "adjacency_list.hpp"
+#include "csr.hpp"
 
-#include <CGAL/Exact_predicates_inexact_constructions_kernel.h>
 #include <CGAL/basic.h>
-#include <CGAL/Cartesian_d.h>
+#include <CGAL/Search_traits.h>
 #include <CGAL/Search_traits_adapter.h>
 #include <CGAL/property_map.h>
-#include <boost/iterator/zip_iterator.hpp>
-#include <utility>
 #include <CGAL/Kd_tree.h>
 #include <CGAL/Fuzzy_sphere.h>
-#include <CGAL/Fuzzy_iso_box.h>
-#include <CGAL/Search_traits_d.h>
+#include <CGAL/Euclidean_distance.h>
+#include <CGAL/Distance_adapter.h>
+#include <CGAL/Orthogonal_k_neighbor_search.h>
+#include <boost/iterator/counting_iterator.hpp>
+#include <boost/iterator/function_output_iterator.hpp>
+#include <boost/property_map/property_map.hpp>
+
+#include <algorithm>
+#include <vector>
 
 namespace particles {
 namespace search {
 namespace internal {
 
+/** @brief cartesian iterators of Vec for CGAL::Search_traits */
+template <class T, std::size_t N>
+struct ConstructVecIterator {
+  typedef const T* result_type;
+  const T* operator()(const Vec<T, N>& v) const { return v.data(); }
+  const T* operator()(const Vec<T, N>& v, int) const { return v.data() + N; }
+};
+
+/**
+ * @brief arrays read by PositionMap
+ *
+ * Keys in [0, size) are particles in the tree, and keys from size are query
+ * points.
+ */
 template <class T, std::size_t N>
-struct KdTreeSearchImpl {
-  typedef CGAL::Cartesian_d<double> K;
-  typedef K::Point_d Point_d;
-  typedef boost::tuple<Point_d, std::size_t> Point_and_index;
-
-  typedef CGAL::Search_traits_d<K> Traits_base;
-  typedef CGAL::Search_traits_adapter<
-      Point_and_index, CGAL::Nth_of_tuple_property_map<0, Point_and_index>,
-      Traits_base> Traits;
+struct PositionSource {
+  const Particle<T, N>* particles;
+  std::size_t size;
+  const Vec<T, N>* queries;
+};
+
+/**
+ * @brief property map from index to position of a particle
+ *
+ * Positions are read from the arrays pointed by source, so the map does not
+ * hold coordinates and stays valid while the particles are replaced.
+ */
+template <class T, std::size_t N>
+struct PositionMap {
+  typedef std::size_t key_type;
+  typedef Vec<T, N> value_type;
+  typedef const value_type& reference;
+  typedef boost::readable_property_map_tag category;
+
+  const PositionSource<T, N>* source;
+
+  PositionMap() : source(nullptr) {}
+  explicit PositionMap(const PositionSource<T, N>* s) : source(s) {}
+
+  friend reference get(const PositionMap& m, key_type i) {
+    return i < m.source->size ? m.source->particles[i].position()
+                              : m.source->queries[i - m.source->size];
+  }
+};
+
+/** @brief output iterator function appending i-th particle to a list */
+template <class Neighbors, class Particles>
+struct AppendParticle {
+  Neighbors* neighbors;
+  const Particles* particles;
+
+  void operator()(std::size_t i) const {
+    neighbors->push_back(&(*particles)[i]);
+  }
+};
+
+/**
+ * @brief kdtree over indices of particles
+ *
+ * The tree stores only indices. Coordinates are read in place from
+ * Particle::position() through PositionMap, and the tree and its buffers
+ * are reused over searches.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class KdTreeSearchImpl {
+ public:
+  typedef CGAL::Search_traits<T, Vec<T, N>, const T*,
+                              ConstructVecIterator<T, N>,
+                              CGAL::Dimension_tag<N>> Traits_base;
+  typedef CGAL::Search_traits_adapter<std::size_t, PositionMap<T, N>,
+                                      Traits_base> Traits;
   typedef CGAL::Kd_tree<Traits> Tree;
   typedef CGAL::Fuzzy_sphere<Traits> Fuzzy_sphere;
+  typedef CGAL::Distance_adapter<std::size_t, PositionMap<T, N>,
+                                 CGAL::Euclidean_distance<Traits_base>>
+      Distance;
+  typedef CGAL::Orthogonal_k_neighbor_search<Traits, Distance> Knn;
+
+  KdTreeSearchImpl()
+      : source_{nullptr, 0, nullptr},
+        tree_(typename Tree::Splitter(), Traits(PositionMap<T, N>(&source_))) {}
 
-  static Point_d VecToPoint_d(const Vec<T, N>& v) {
-    return Point_d(N, v.cbegin(), v.cend());
+  /** @brief build the tree over particles, which must outlive queries */
+  template <class Particles>
+  void build(const Particles& particles) {
+    PARTICLES_TIME("search.kdtree.build");
+    source_.particles = particles.size() > 0 ? &particles[0] : nullptr;
+    source_.size = particles.size();
+    tree_.clear();  // keeps the capacity
+    tree_.insert(boost::counting_iterator<std::size_t>(0),
+                 boost::counting_iterator<std::size_t>(particles.size()));
+    if (particles.size() > 0) tree_.build();
+  }
+
+  /** @brief number of particles in the tree */
+  std::size_t size() const { return source_.size; }
+
+  /**
+   * @brief indices of particles within r from each point
+   *
+   * Points are given keys from size() so that Fuzzy_sphere reads them
+   * through the same property map. Queries run in parallel, but query() itself
+   * must not be called concurrently.
+   */
+  void query(const std::vector<Vec<T, N>>& points, const T r, CSR& csr) {
+    PARTICLES_TIME("search.kdtree.batch_query");
+    source_.queries = points.data();
+    internal::fill_csr(points.size(), [&](std::size_t q, auto f) {
+      if (source_.size == 0) return;
+      Fuzzy_sphere sphere(source_.size + q, r, T(0), tree_.traits());
+      tree_.search(boost::make_function_output_iterator(f), sphere);
+    }, csr);
   }
 
   /**
    * @brief search using kdtree
-   * 
-   * Point with info is expressed using boost::tuple and property_map.
    *
-   * See here for the detail.
+   * See here for search traits with a property map.
    * http://doc.cgal.org/latest/Spatial_searching/index.html#title11
    */
   template <class AdjacencyList, class Particles>
-  static void search(AdjacencyList& adjacency_list, const Particles& particles,
-                     const T r) {
-    std::vector<std::size_t> indices;
-    std::vector<Point_d> points;
-
-    for (std::size_t i = 0; i < particles.size(); i++) {
-      indices.push_back(i);
-      points.push_back(VecToPoint_d(particles[i].position()));
-    }
+  void search(AdjacencyList& adjacency_list, const Particles& particles,
+              const T r) {
+    typedef typename AdjacencyList::value_type Neighbors;
+    typedef AppendParticle<Neighbors, Particles> Append;
 
-    Tree tree(boost::make_zip_iterator(
-                  boost::make_tuple(points.begin(), indices.begin())),
-              boost::make_zip_iterator(
-                  boost::make_tuple(points.end(), indices.end())));
+    const std::size_t n = particles.size();
+    reset_rows(adjacency_list, n);
+    if (n == 0) return;
+    build(particles);
 
-    adjacency_list.resize(particles.size());
-    std::vector<Point_and_index> result;
-    for (std::size_t i = 0; i < particles.size(); i++) {
-      result.clear();
-      adjacency_list[i].clear();
+    PARTICLES_TIME("search.kdtree.query");
+    for (std::size_t i = 0; i < n; i++) {
+      Fuzzy_sphere query(i, r, T(0), tree_.traits());
+      tree_.search(boost::make_function_output_iterator(
+                       Append{&adjacency_list[i], &particles}),
+                   query);
+    }
+  }
 
-      Fuzzy_sphere query(VecToPoint_d(particles[i].position()), r);
-      tree.search(std::back_inserter(result), query);
+  /**
+   * @brief k nearest neighbors of each particle
+   *
+   * Each list holds the particle itself followed by its k nearest particles
+   * in order of distance. Queries run in parallel on the shared tree.
+   */
+  template <class AdjacencyList, class Particles>
+  void search_nearest(AdjacencyList& adjacency_list, const Particles& particles,
+                      const std::size_t k) {
+    const std::size_t n = particles.size();
+    reset_rows(adjacency_list, n);
+    if (n == 0) return;
+    build(particles);
 
-      for (const auto& t : result) {
-        adjacency_list[i].push_back(&particles[t.get<1>()]);
+    PARTICLES_TIME("search.knn.query");
+    const Distance distance{PositionMap<T, N>(&source_)};
+    const auto m = static_cast<unsigned int>(std::min(k + 1, n));
+    parallel::for_each(n, [&](std::size_t i) {
+      auto& neighbors = adjacency_list[i];
+      neighbors.push_back(&particles[i]);
+      Knn query(tree_, particles[i].position(), m, T(0), true, distance);
+      for (const auto& q : query) {
+        if (q.first != i) neighbors.push_back(&particles[q.first]);
       }
-    }
+      if (neighbors.size() > k + 1) neighbors.resize(k + 1);  // ties
+    }, 256);
   }
+
+ private:
+  PositionSource<T, N> source_;  // read by PositionMap
+  Tree tree_;
+
+  DISALLOW_COPY_AND_ASSIGN(KdTreeSearchImpl);
 };
 
 }  // namespace internal
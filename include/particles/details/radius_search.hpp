@@ -0,0 +1,181 @@
+/**
+ * @file radius_search.hpp
+ *
+ * @brief implemention of search with per-particle radius (multi-level grid)
+ */
+
+#pragma once
+
+#include "../instrument.hpp"
+#include "../parallel.hpp"
+#include "../vec.hpp"
+#include "adjacency_list.hpp"
+#include "cell_list.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+namespace particles {
+namespace search {
+
+/**
+ * @brief cutoff of a pair with radii r_i and r_j
+ *
+ * - sum: \f$|x_i - x_j| \le r_i + r_j\f$ (e.g. contact of disks)
+ * - max: \f$|x_i - x_j| \le \max(r_i, r_j)\f$
+ */
+enum class RadiusRule { sum, max };
+
+namespace internal {
+
+template <class T>
+inline T pair_cutoff(T ri, T rj, RadiusRule rule) {
+  return rule == RadiusRule::sum ? ri + rj : std::max(ri, rj);
+}
+
+/**
+ * @brief range search with per-particle radius
+ *
+ * Particles are bucketed into classes of radius, \f$(R/2^{c+1}, R/2^c]\f$
+ * for class c where R is the largest radius, and each class has its own
+ * cell list. A particle looks up each class only as far as the largest
+ * cutoff with that class, so small particles are not searched with the
+ * largest radius. Large particles find many more neighbors, so queries are
+ * spread over threads by the number found at the last search.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class RadiusClassSearchImpl {
+ public:
+  /** @brief radii smaller than R / 2^(max_classes - 1) share the last class */
+  static constexpr std::size_t max_classes = 8;
+
+  /**
+   * @param radius radius(p) returns radius of particle p
+   */
+  template <class AdjacencyList, class Particles, class Radius>
+  void search(AdjacencyList& adjacency_list, const Particles& particles,
+              Radius& radius, RadiusRule rule) {
+    const std::size_t n = particles.size();
+    reset_rows(adjacency_list, n);
+    if (n == 0) return;
+
+    {
+      PARTICLES_TIME("search.variable_radius.build");
+      classify(particles, radius);
+      build_cells(particles, rule);
+    }
+
+    PARTICLES_TIME("search.variable_radius.query");
+    parallel::for_each_weighted(n, row_capacity(adjacency_list),
+                                [&](std::size_t i) {
+      auto& neighbors = adjacency_list[i];
+      const auto& x = particles[i].position();
+      const T ri = radii_[i];
+
+      for (std::size_t c = 0; c < members_.size(); c++) {
+        if (members_[c].empty()) continue;
+        const auto& cells = cells_[c];
+        const auto& members = members_[c];
+        cells.for_each_adjacent_cell(cells.cell_index(x), [&](std::size_t k) {
+          for (auto l = cells.cell_begin(k); l < cells.cell_end(k); l++) {
+            const auto j = members[cells.indices()[l]];
+            const T r = pair_cutoff(ri, radii_[j], rule);
+            if (x.squared_distance(particles[j].position()) <= r * r) {
+              neighbors.push_back(&particles[j]);
+            }
+          }
+        }, reach(c, pair_cutoff(ri, bound_[c], rule)));
+      }
+    }, 1024);
+  }
+
+ private:
+  std::vector<T> radii_;
+  std::vector<T> bound_;                          // largest radius of class
+  std::vector<std::vector<std::size_t>> members_;  // particle indices
+  std::vector<CellList<T, N>> cells_;
+  Vec<T, N> lower_;
+  Vec<T, N> upper_;
+
+  template <class Particles, class Radius>
+  void classify(const Particles& particles, Radius& radius) {
+    const std::size_t n = particles.size();
+    radii_.resize(n);
+    T r_max = 0;
+    lower_ = particles[0].position();
+    upper_ = particles[0].position();
+    for (std::size_t i = 0; i < n; i++) {
+      radii_[i] = std::max<T>(radius(particles[i]), 0);
+      r_max = std::max(r_max, radii_[i]);
+      const auto& x = particles[i].position();
+      for (std::size_t d = 0; d < N; d++) {
+        lower_[d] = std::min(lower_[d], x[d]);
+        upper_[d] = std::max(upper_[d], x[d]);
+      }
+    }
+    for (std::size_t d = 0; d < N; d++) {
+      if (!(upper_[d] > lower_[d])) upper_[d] = lower_[d] + 1;
+    }
+
+    const std::size_t m = r_max > 0 ? max_classes : 1;
+    bound_.resize(m);
+    members_.resize(m);
+    cells_.resize(m);
+    for (std::size_t c = 0; c < m; c++) {
+      bound_[c] = std::ldexp(r_max, -static_cast<int>(c));
+      members_[c].clear();
+    }
+    for (std::size_t i = 0; i < n; i++) {
+      std::size_t c = m - 1;
+      if (radii_[i] > 0) {
+        const T level = std::floor(std::log2(r_max / radii_[i]));
+        if (level < m - 1) c = static_cast<std::size_t>(std::max<T>(level, 0));
+      }
+      members_[c].push_back(i);
+    }
+  }
+
+  template <class Particles>
+  void build_cells(const Particles& particles, RadiusRule rule) {
+    T volume = 1;
+    for (std::size_t d = 0; d < N; d++) volume *= upper_[d] - lower_[d];
+
+    for (std::size_t c = 0; c < members_.size(); c++) {
+      const auto& members = members_[c];
+      if (members.empty()) continue;
+      // cells as wide as the cutoff within the class, but not much more
+      // cells than particles in the class
+      const T spacing = std::pow(volume / members.size(), T(1) / N);
+      const T width = std::max(pair_cutoff(bound_[c], bound_[c], rule),
+                               spacing);
+      cells_[c].build(members.size(), [&](std::size_t k) -> const Vec<T, N>& {
+        return particles[members[k]].position();
+      }, lower_, upper_, width, false);
+    }
+  }
+
+  /** @brief number of cells to look around to cover distance r in class c */
+  std::size_t reach(std::size_t c, T r) const {
+    T width = std::numeric_limits<T>::max();
+    std::size_t dim = 1;
+    for (std::size_t d = 0; d < N; d++) {
+      width = std::min(width, cells_[c].width(d));
+      dim = std::max(dim, cells_[c].dim(d));
+    }
+    const T k = std::ceil(r / width);
+    return k < dim ? std::max<std::size_t>(static_cast<std::size_t>(k), 1)
+                   : dim;
+  }
+};
+
+template <class T, std::size_t N>
+constexpr std::size_t RadiusClassSearchImpl<T, N>::max_classes;
+
+}  // namespace internal
+}  // namespace search
+}  // namespace particles
@@ -0,0 +1,284 @@
+/**
+ * @file sparse_grid.hpp
+ *
+ * @brief hashed grid of occupied cells refined adaptively in crowded cells
+ */
+
+#pragma once
+
+#include "../util.hpp"
+#include "../vec.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace particles {
+namespace search {
+namespace internal {
+
+/**
+ * @brief sparse grid for fixed radius search
+ *
+ * Space is divided into cells of width r, and only occupied cells are stored
+ * in a hash table, so memory is proportional to the number of occupied cells
+ * whatever the extent of the system. A cell holding more than leaf_size
+ * particles is split recursively into 2^N boxes (a quadtree/octree local to
+ * the cell), and boxes farther than r from the query are pruned. Thus the
+ * cost of a query stays close to the number of neighbors in dense regions.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class SparseGrid {
+ public:
+  typedef std::array<std::int64_t, N> key_type;
+
+  SparseGrid()
+      : r_(), leaf_size_(16), max_depth_(8), keys_(), order_(), buffer_(),
+        nodes_(), cells_() {}
+
+  /**
+   * @param leaf_size cells (and boxes) with more particles are split
+   * @param max_depth maximum number of splits of a cell
+   */
+  void set_leaf_size(std::size_t leaf_size, std::size_t max_depth = 8) {
+    leaf_size_ = std::max<std::size_t>(leaf_size, 1);
+    max_depth_ = max_depth;
+  }
+
+  /**
+   * @brief sort particles into the grid
+   * @param positions positions(i) returns position of i-th particle
+   * @param r width of cells, which must be positive
+   */
+  template <class Positions>
+  void build(std::size_t n, Positions positions, T r) {
+    CHECK(r > 0) << "width of cells must be positive\n";
+    r_ = r;
+    keys_.resize(n);
+    order_.resize(n);
+    for (std::size_t i = 0; i < n; i++) {
+      keys_[i] = key(positions(i));
+      order_[i] = i;
+    }
+    std::sort(order_.begin(), order_.end(),
+              [this](std::size_t i, std::size_t j) {
+      return keys_[i] < keys_[j];
+    });
+
+    // one root node per occupied cell; clear keeps the buckets of the last
+    // build, which usually has about the same number of cells
+    nodes_.clear();
+    cells_.clear();
+    for (std::size_t first = 0; first < n;) {
+      const auto& k = keys_[order_[first]];
+      std::size_t last = first + 1;
+      while (last < n && keys_[order_[last]] == k) last++;
+
+      // bounding box of particles in the cell, which is tighter than the
+      // cell and free from rounding of x / r
+      Node node;
+      node.lower = positions(order_[first]);
+      node.upper = node.lower;
+      for (auto l = first + 1; l < last; l++) {
+        const auto& x = positions(order_[l]);
+        for (std::size_t d = 0; d < N; d++) {
+          node.lower[d] = std::min(node.lower[d], x[d]);
+          node.upper[d] = std::max(node.upper[d], x[d]);
+        }
+      }
+      node.first = first;
+      node.last = last;
+      node.child = 0;
+      cells_.emplace(k, nodes_.size());
+      nodes_.push_back(node);
+      first = last;
+    }
+    const std::size_t roots = nodes_.size();
+    for (std::size_t c = 0; c < roots; c++) split(c, positions, 0);
+  }
+
+  /** @brief number of occupied cells */
+  std::size_t num_cells() const { return cells_.size(); }
+
+  /** @brief number of nodes including refined boxes */
+  std::size_t num_nodes() const { return nodes_.size(); }
+
+  /** @brief width of cells */
+  T width() const { return r_; }
+
+  /**
+   * @brief call f(j) for particles j within r from x
+   * @param positions the same as given to build
+   */
+  template <class Positions, class Function>
+  void for_each_within(const Vec<T, N>& x, Positions positions,
+                       Function f) const {
+    for_each_within(x, r_, positions, f);
+  }
+
+  /** @brief call f(j) for particles j within distance from x */
+  template <class Positions, class Function>
+  void for_each_within(const Vec<T, N>& x, T distance, Positions positions,
+                       Function f) const {
+    if (cells_.empty() || !(distance >= 0)) return;
+    const T r2 = distance * distance;
+
+    // scan all cells when the neighborhood has more cells than are occupied,
+    // which also bounds reach below
+    const T cells = std::ceil(distance / r_);
+    T volume = 1;
+    for (std::size_t d = 0; d < N; d++) volume *= 2 * cells + 1;
+    if (volume >= T(cells_.size())) {
+      for (const auto& cell : cells_) visit(cell.second, x, r2, positions, f);
+      return;
+    }
+    const auto k = key(x);
+    const auto reach = static_cast<std::int64_t>(cells);
+    key_type offset;
+    offset.fill(-reach);
+    while (true) {
+      key_type neighbor;
+      for (std::size_t d = 0; d < N; d++) neighbor[d] = k[d] + offset[d];
+      const auto it = cells_.find(neighbor);
+      if (it != cells_.end()) visit(it->second, x, r2, positions, f);
+
+      // next offset in [-reach, reach]^N
+      std::size_t d = 0;
+      while (d < N && offset[d] == reach) offset[d++] = -reach;
+      if (d == N) break;
+      offset[d]++;
+    }
+  }
+
+ private:
+  struct Node {
+    Vec<T, N> lower;
+    Vec<T, N> upper;
+    std::size_t first;  // range in order_
+    std::size_t last;
+    std::size_t child;  // first of 2^N children, or 0 for a leaf
+  };
+
+  struct KeyHash {
+    std::size_t operator()(const key_type& k) const {
+      std::uint64_t h = 0;
+      for (std::size_t d = 0; d < N; d++) {
+        h = (h ^ static_cast<std::uint64_t>(k[d])) * 0x9e3779b97f4a7c15ULL;
+      }
+      return static_cast<std::size_t>(h ^ (h >> 32));
+    }
+  };
+
+  T r_;
+  std::size_t leaf_size_;
+  std::size_t max_depth_;
+  std::vector<key_type> keys_;
+  std::vector<std::size_t> order_;   // particle indices sorted by node
+  std::vector<std::size_t> buffer_;  // scratch for split
+  std::vector<Node> nodes_;
+  std::unordered_map<key_type, std::size_t, KeyHash> cells_;  // root nodes
+
+  /**
+   * @brief cell of x
+   *
+   * Indices are clamped so that far (or non-finite) positions share the
+   * outermost cells instead of overflowing; bounding boxes of nodes keep the
+   * search exact.
+   */
+  key_type key(const Vec<T, N>& x) const {
+    const std::int64_t m = std::int64_t(1) << 52;
+    key_type k;
+    for (std::size_t d = 0; d < N; d++) {
+      const T q = std::floor(x[d] / r_);
+      k[d] = !(q > T(-m)) ? -m : q < T(m) ? static_cast<std::int64_t>(q) : m;
+    }
+    return k;
+  }
+
+  /** @brief refine a crowded node into 2^N boxes (counting sort in place) */
+  template <class Positions>
+  void split(std::size_t index, Positions& positions, std::size_t depth) {
+    const Node node = nodes_[index];
+    if (node.last - node.first <= leaf_size_ || depth >= max_depth_) return;
+
+    const std::size_t m = std::size_t(1) << N;
+    Vec<T, N> middle;
+    for (std::size_t d = 0; d < N; d++) {
+      middle[d] = (node.lower[d] + node.upper[d]) / 2;
+    }
+    auto box = [&](std::size_t i) {
+      const auto& x = positions(i);
+      std::size_t b = 0;
+      for (std::size_t d = 0; d < N; d++) b |= (x[d] >= middle[d]) << d;
+      return b;
+    };
+
+    std::vector<std::size_t> count(m + 1, 0);
+    for (auto l = node.first; l < node.last; l++) count[box(order_[l]) + 1]++;
+    for (std::size_t b = 0; b < m; b++) count[b + 1] += count[b];
+    buffer_.resize(node.last - node.first);
+    for (auto l = node.first; l < node.last; l++) {
+      const auto i = order_[l];
+      buffer_[count[box(i)]++] = i;
+    }
+    std::copy(buffer_.begin(), buffer_.end(), order_.begin() + node.first);
+
+    const std::size_t child = nodes_.size();
+    nodes_[index].child = child;
+    std::size_t first = node.first;
+    for (std::size_t b = 0; b < m; b++) {
+      Node c;
+      for (std::size_t d = 0; d < N; d++) {
+        const bool high = (b >> d) & 1;
+        c.lower[d] = high ? middle[d] : node.lower[d];
+        c.upper[d] = high ? node.upper[d] : middle[d];
+      }
+      c.first = first;
+      c.last = node.first + count[b];
+      c.child = 0;
+      first = c.last;
+      nodes_.push_back(c);
+    }
+    for (std::size_t b = 0; b < m; b++) split(child + b, positions, depth + 1);
+  }
+
+  /** @brief squared distance from x to the box of a node */
+  T squared_distance(const Node& node, const Vec<T, N>& x) const {
+    T s = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      T e = 0;
+      if (x[d] < node.lower[d]) e = node.lower[d] - x[d];
+      else if (x[d] > node.upper[d]) e = x[d] - node.upper[d];
+      s += e * e;
+    }
+    return s;
+  }
+
+  template <class Positions, class Function>
+  void visit(std::size_t index, const Vec<T, N>& x, T r2,
+             Positions& positions, Function& f) const {
+    const Node& node = nodes_[index];
+    if (node.first == node.last || squared_distance(node, x) > r2) return;
+    if (node.child == 0) {
+      for (auto l = node.first; l < node.last; l++) {
+        const auto j = order_[l];
+        if (x.squared_distance(positions(j)) <= r2) f(j);
+      }
+      return;
+    }
+    const std::size_t m = std::size_t(1) << N;
+    for (std::size_t b = 0; b < m; b++) {
+      visit(node.child + b, x, r2, positions, f);
+    }
+  }
+};
+
+}  // namespace internal
+}  // namespace search
+}  // namespace particles
@@ -0,0 +1,193 @@
+/**
+ * @file topology.hpp
+ *
+ * @brief NUMA nodes and CPUs of the machine, and pinning of threads
+ */
+
+#pragma once
+
+#include "../util.hpp"
+
+#include <algorithm>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace particles {
+namespace numa {
+
+/**
+ * @brief NUMA nodes and the CPUs available to this process
+ *
+ * Read from /sys/devices/system/node on Linux. Elsewhere, or if it cannot be
+ * read, all hardware threads form a single node.
+ */
+class Topology {
+ public:
+  Topology() : cpus_(), nodes_(), physical_(), num_nodes_(1) {
+    std::vector<std::size_t> online;
+    if (read_list("/sys/devices/system/node/online", online)) {
+      for (auto node : online) {
+        std::vector<std::size_t> cpus;
+        read_list("/sys/devices/system/node/node" + std::to_string(node) +
+                      "/cpulist",
+                  cpus);
+        for (auto cpu : cpus) add(cpu, node);
+      }
+    }
+    if (cpus_.empty()) {
+      const std::size_t n = std::thread::hardware_concurrency();
+      for (std::size_t cpu = 0; cpu < std::max<std::size_t>(n, 1); cpu++) {
+        add(cpu, 0);
+      }
+    }
+
+    // CPUs usable by this process (e.g. in a cpuset), ordered by node
+    std::vector<std::size_t> order(cpus_.size());
+    for (std::size_t k = 0; k < order.size(); k++) order[k] = k;
+    std::stable_sort(order.begin(), order.end(),
+                     [this](std::size_t a, std::size_t b) {
+      return nodes_[a] < nodes_[b];
+    });
+    std::vector<std::size_t> cpus, nodes;
+    for (auto k : order) {
+      if (!allowed(cpus_[k])) continue;
+      cpus.push_back(cpus_[k]);
+      nodes.push_back(nodes_[k]);
+    }
+    if (!cpus.empty()) {
+      cpus_.swap(cpus);
+      nodes_.swap(nodes);
+    }
+
+    // renumber nodes with CPUs as 0, 1, ...
+    std::vector<std::size_t> ids(nodes_);
+    std::sort(ids.begin(), ids.end());
+    ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+    physical_ = ids;
+    for (auto& node : nodes_) {
+      node = std::lower_bound(ids.begin(), ids.end(), node) - ids.begin();
+    }
+    num_nodes_ = ids.size();
+  }
+
+  /** @brief number of nodes with usable CPUs */
+  std::size_t num_nodes() const { return num_nodes_; }
+
+  /** @brief usable CPUs ordered by node */
+  const std::vector<std::size_t>& cpus() const { return cpus_; }
+
+  /** @brief node (0, 1, ...) of k-th CPU in cpus() */
+  std::size_t node(std::size_t k) const { return nodes_[k]; }
+
+  /** @brief node number of the system (as in /sys) */
+  std::size_t physical_node(std::size_t node) const {
+    return physical_[node];
+  }
+
+ private:
+  std::vector<std::size_t> cpus_;
+  std::vector<std::size_t> nodes_;
+  std::vector<std::size_t> physical_;
+  std::size_t num_nodes_;
+
+  void add(std::size_t cpu, std::size_t node) {
+    cpus_.push_back(cpu);
+    nodes_.push_back(node);
+  }
+
+  /** @brief parse a list like "0-3,8,10-11" */
+  static bool read_list(const std::string& path,
+                        std::vector<std::size_t>& values) {
+    std::ifstream file(path);
+    std::string line;
+    if (!file || !std::getline(file, line)) return false;
+    const char* c = line.c_str();
+    while (*c) {
+      char* end;
+      const std::size_t first = std::strtoul(c, &end, 10);
+      if (end == c) return false;
+      std::size_t last = first;
+      c = end;
+      if (*c == '-') {
+        last = std::strtoul(c + 1, &end, 10);
+        if (end == c + 1) return false;
+        c = end;
+      }
+      for (auto v = first; v <= last; v++) values.push_back(v);
+      if (*c == ',') c++;
+      else if (*c && *c != '\n') return false;
+      else break;
+    }
+    return !values.empty();
+  }
+
+  static bool allowed(std::size_t cpu) {
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return true;
+    return cpu < CPU_SETSIZE && CPU_ISSET(cpu, &set);
+#else
+    (void)cpu;
+    return true;
+#endif
+  }
+};
+
+/** @brief topology of this machine, read once */
+inline const Topology& topology() {
+  static const Topology t;
+  return t;
+}
+
+namespace internal {
+
+/** @brief affinity of the calling thread, restored on destruction */
+class ScopedAffinity {
+ public:
+  ScopedAffinity() : saved_(false) {
+#if defined(__linux__)
+    saved_ = pthread_getaffinity_np(pthread_self(), sizeof(set_), &set_) == 0;
+#endif
+  }
+
+  ~ScopedAffinity() {
+#if defined(__linux__)
+    if (saved_) pthread_setaffinity_np(pthread_self(), sizeof(set_), &set_);
+#endif
+  }
+
+ private:
+  bool saved_;
+#if defined(__linux__)
+  cpu_set_t set_;
+#endif
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedAffinity);
+};
+
+/** @brief pin the calling thread to a CPU, false if not supported */
+inline bool pin_current_thread(std::size_t cpu) {
+#if defined(__linux__)
+  if (cpu >= CPU_SETSIZE) return false;
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu, &set);
+  return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+  (void)cpu;
+  return false;
+#endif
+}
+
+}  // namespace internal
+}  // namespace numa
+}  // namespace particles
@@ -0,0 +1,156 @@
+/**
+ * @file trace.hpp
+ *
+ * @brief per-thread ring buffers of trace events
+ */
+
+#pragma once
+
+#include "../util.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace particles {
+namespace instrument {
+namespace internal {
+
+/** @brief nanoseconds since the first call */
+inline std::int64_t trace_clock() {
+  static const auto start = std::chrono::steady_clock::now();
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+/** @brief a phase from begin to end, key is its timer */
+struct TraceEvent {
+  const void* key;
+  std::int64_t begin;
+  std::int64_t end;
+};
+
+/**
+ * @brief ring buffer keeping the last events of a thread
+ *
+ * Only one thread writes at a time, without locking. Events are read while
+ * no thread writes (e.g. between steps).
+ */
+class TraceBuffer {
+ public:
+  TraceBuffer(std::size_t id, std::size_t capacity)
+      : id_(id), events_(std::max<std::size_t>(capacity, 1)), head_(0) {}
+
+  void push(const TraceEvent& e) {
+    const auto h = head_.load(std::memory_order_relaxed);
+    events_[h % events_.size()] = e;
+    head_.store(h + 1, std::memory_order_release);
+  }
+
+  /** @brief call f(event) from the oldest kept event */
+  template <class Function>
+  void for_each(Function f) const {
+    const auto h = head_.load(std::memory_order_acquire);
+    for (auto i = h - std::min<std::size_t>(h, events_.size()); i < h; i++) {
+      f(events_[i % events_.size()]);
+    }
+  }
+
+  /** @brief number of events overwritten */
+  std::size_t dropped() const {
+    const auto h = head_.load(std::memory_order_acquire);
+    return h > events_.size() ? h - events_.size() : 0;
+  }
+
+  void clear() { head_.store(0, std::memory_order_release); }
+
+  /** @brief thread id in traces */
+  std::size_t id() const { return id_; }
+
+ private:
+  std::size_t id_;
+  std::vector<TraceEvent> events_;
+  std::atomic<std::size_t> head_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceBuffer);
+};
+
+/**
+ * @brief buffers of all threads
+ *
+ * A thread takes a buffer at its first event and gives it back when it
+ * ends. Threads of parallel loops are started for every loop, so reusing
+ * buffers keeps their number at the number of concurrent threads, and each
+ * buffer shows up as one lane of workers in traces.
+ */
+class TraceBuffers {
+ public:
+  TraceBuffers() : mutex_(), buffers_(), free_(), capacity_(1 << 14) {}
+
+  TraceBuffer* acquire() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_.empty()) {
+      auto buffer = free_.back();
+      free_.pop_back();
+      return buffer;
+    }
+    buffers_.emplace_back(new TraceBuffer(buffers_.size(), capacity_));
+    return buffers_.back().get();
+  }
+
+  void release(TraceBuffer* buffer) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(buffer);
+  }
+
+  /** @brief number of events kept per thread, for buffers made later */
+  void set_capacity(std::size_t capacity) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+  }
+
+  /** @brief call f(buffer) in order of ids */
+  template <class Function>
+  void for_each(Function f) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& b : buffers_) f(*b);
+  }
+
+  void clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& b : buffers_) b->clear();
+  }
+
+ private:
+  mutable std::mutex mutex_;
+  std::vector<std::unique_ptr<TraceBuffer>> buffers_;
+  std::vector<TraceBuffer*> free_;
+  std::size_t capacity_;
+
+  DISALLOW_COPY_AND_ASSIGN(TraceBuffers);
+};
+
+inline TraceBuffers& trace_buffers() {
+  static TraceBuffers buffers;
+  return buffers;
+}
+
+/** @brief buffer of the calling thread */
+inline TraceBuffer& thread_trace_buffer() {
+  struct Holder {
+    TraceBuffer* buffer;
+    Holder() : buffer(trace_buffers().acquire()) {}
+    ~Holder() { trace_buffers().release(buffer); }
+  };
+  thread_local Holder holder;
+  return *holder.buffer;
+}
+
+}  // namespace internal
+}  // namespace instrument
+}  // namespace particles
@@ -0,0 +1,533 @@
+/**
+ * @file domain.hpp
+ *
+ * @brief spatial domain decomposition of a periodic box
+ *
+ * The box is split into a grid of subdomains, each owned by a worker. At
+ * every step, workers hand particles which left their subdomain to the new
+ * owner (migration), and send copies of particles near their faces to the
+ * adjacent subdomains (halo exchange). All communication goes through a
+ * Transport, so that workers may live in threads (InProcessTransport) or in
+ * other processes with a backend of their own.
+ */
+
+#pragma once
+
+#include "boundary.hpp"
+#include "instrument.hpp"
+#include "particle.hpp"
+#include "util.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace particles {
+namespace domain {
+namespace internal {
+
+constexpr std::size_t pow3(std::size_t n) {
+  return n == 0 ? 1 : 3 * pow3(n - 1);
+}
+
+}  // namespace internal
+
+/**
+ * @brief point to point messages of particles between ranks (subdomains)
+ *
+ * send must not block, and receive blocks until a message from the rank
+ * with the tag arrives. Messages with the same sender, receiver and tag
+ * arrive in order.
+ *
+ * @tparam P type of particles
+ */
+template <class P>
+class Transport {
+ public:
+  virtual ~Transport() {}
+
+  /** @brief number of ranks */
+  virtual std::size_t size() const = 0;
+
+  virtual void send(std::size_t from, std::size_t to, std::size_t tag,
+                    std::vector<P> data) = 0;
+
+  virtual std::vector<P> receive(std::size_t to, std::size_t from,
+                                 std::size_t tag) = 0;
+};
+
+/**
+ * @brief transport between threads of a process through mailboxes
+ */
+template <class P>
+class InProcessTransport : public Transport<P> {
+ public:
+  explicit InProcessTransport(std::size_t size) : mailboxes_(size) {}
+
+  std::size_t size() const { return mailboxes_.size(); }
+
+  void send(std::size_t from, std::size_t to, std::size_t tag,
+            std::vector<P> data) {
+    Mailbox& box = mailboxes_[to];
+    {
+      std::lock_guard<std::mutex> lock(box.mutex);
+      box.messages[std::make_pair(from, tag)].push_back(std::move(data));
+    }
+    box.arrived.notify_all();
+  }
+
+  std::vector<P> receive(std::size_t to, std::size_t from, std::size_t tag) {
+    Mailbox& box = mailboxes_[to];
+    std::unique_lock<std::mutex> lock(box.mutex);
+    auto& queue = box.messages[std::make_pair(from, tag)];
+    box.arrived.wait(lock, [&queue] { return !queue.empty(); });
+    std::vector<P> data = std::move(queue.front());
+    queue.pop_front();
+    return data;
+  }
+
+ private:
+  struct Mailbox {
+    std::mutex mutex;
+    std::condition_variable arrived;
+    std::map<std::pair<std::size_t, std::size_t>,
+             std::deque<std::vector<P>>> messages;  // by sender and tag
+  };
+
+  std::vector<Mailbox> mailboxes_;
+
+  DISALLOW_COPY_AND_ASSIGN(InProcessTransport);
+};
+
+/**
+ * @brief regular grid of subdomains in a periodic box
+ *
+ * Ranks are numbered with the first dimension fastest.
+ */
+template <class T, std::size_t N>
+class Grid {
+ public:
+  typedef std::array<std::size_t, N> dims_type;
+
+  /** @param dims number of subdomains in each dimension */
+  Grid(const boundary::PeriodicBoundary<T, N>& boundary, const dims_type& dims)
+      : boundary_(boundary), dims_(dims) {
+    for (auto& d : dims_) d = std::max<std::size_t>(d, 1);
+  }
+
+  /**
+   * @brief count subdomains of shapes as close to cubes as possible
+   *
+   * Prime factors of count go to the dimension with the longest subdomains.
+   */
+  Grid(const boundary::PeriodicBoundary<T, N>& boundary, std::size_t count)
+      : boundary_(boundary), dims_() {
+    dims_.fill(1);
+    std::vector<std::size_t> factors;
+    for (std::size_t f = 2; count > 1; f++) {
+      while (count % f == 0) {
+        factors.push_back(f);
+        count /= f;
+      }
+    }
+    for (auto it = factors.rbegin(); it != factors.rend(); ++it) {
+      std::size_t longest = 0;
+      for (std::size_t d = 1; d < N; d++) {
+        if (width(d) > width(longest)) longest = d;
+      }
+      dims_[longest] *= *it;
+    }
+  }
+
+  const boundary::PeriodicBoundary<T, N>& boundary() const {
+    return boundary_;
+  }
+
+  /** @brief number of subdomains */
+  std::size_t size() const {
+    std::size_t n = 1;
+    for (auto d : dims_) n *= d;
+    return n;
+  }
+
+  const dims_type& dims() const { return dims_; }
+
+  /** @brief width of subdomains in d-th dimension */
+  T width(std::size_t d) const { return boundary_.length(d) / dims_[d]; }
+
+  /** @brief lower bound of a subdomain in d-th dimension */
+  T lower(std::size_t rank, std::size_t d) const {
+    return boundary_.left()[d] + coordinates(rank)[d] * width(d);
+  }
+
+  /** @brief upper bound of a subdomain in d-th dimension */
+  T upper(std::size_t rank, std::size_t d) const {
+    return lower(rank, d) + width(d);
+  }
+
+  std::array<long, N> coordinates(std::size_t rank) const {
+    std::array<long, N> c;
+    for (std::size_t d = 0; d < N; d++) {
+      c[d] = static_cast<long>(rank % dims_[d]);
+      rank /= dims_[d];
+    }
+    return c;
+  }
+
+  /** @brief rank at coordinates, which are wrapped periodically */
+  std::size_t rank(const std::array<long, N>& c) const {
+    std::size_t r = 0;
+    for (std::size_t d = N; d-- > 0;) {
+      const long n = static_cast<long>(dims_[d]);
+      r = r * dims_[d] + static_cast<std::size_t>(((c[d] % n) + n) % n);
+    }
+    return r;
+  }
+
+  /** @brief rank owning a position in the box */
+  std::size_t rank(const Vec<T, N>& x) const {
+    std::array<long, N> c;
+    for (std::size_t d = 0; d < N; d++) {
+      const long k = static_cast<long>(
+          std::floor((x[d] - boundary_.left()[d]) / width(d)));
+      c[d] = std::min(std::max(k, 0L), static_cast<long>(dims_[d]) - 1);
+    }
+    return rank(c);
+  }
+
+  /** @brief distinct ranks adjacent to a subdomain (faces, edges, corners) */
+  std::vector<std::size_t> neighbors(std::size_t rank) const {
+    std::vector<std::size_t> ranks;
+    const auto c = coordinates(rank);
+    for (std::size_t k = 0; k < num_offsets(); k++) {
+      if (k == center()) continue;
+      const auto r = this->rank(shifted(c, k));
+      if (r != rank) ranks.push_back(r);
+    }
+    std::sort(ranks.begin(), ranks.end());
+    ranks.erase(std::unique(ranks.begin(), ranks.end()), ranks.end());
+    return ranks;
+  }
+
+  /**
+   * @brief adjacent rank one step closer to a rank
+   *
+   * Each coordinate moves by one toward the target the shorter way around
+   * the periodic grid.
+   */
+  std::size_t next_hop(std::size_t from, std::size_t to) const {
+    auto c = coordinates(from);
+    const auto target = coordinates(to);
+    for (std::size_t d = 0; d < N; d++) {
+      const long n = static_cast<long>(dims_[d]);
+      long delta = ((target[d] - c[d]) % n + n) % n;  // in [0, n)
+      if (2 * delta > n) delta -= n;
+      if (delta > 0) c[d]++;
+      if (delta < 0) c[d]--;
+    }
+    return rank(c);
+  }
+
+  /** @brief steps of next_hop between the farthest ranks */
+  std::size_t max_hops() const {
+    std::size_t hops = 1;
+    for (auto d : dims_) hops = std::max(hops, d / 2);
+    return hops;
+  }
+
+  /** @brief number of offsets {-1, 0, 1}^N */
+  static constexpr std::size_t num_offsets() { return internal::pow3(N); }
+
+  /** @brief index of offset 0 */
+  static constexpr std::size_t center() { return (num_offsets() - 1) / 2; }
+
+  /** @brief d-th element of k-th offset in {-1, 0, 1} */
+  static int offset(std::size_t k, std::size_t d) {
+    for (std::size_t i = 0; i < d; i++) k /= 3;
+    return static_cast<int>(k % 3) - 1;
+  }
+
+  /** @brief coordinates moved by k-th offset (not wrapped) */
+  static std::array<long, N> shifted(std::array<long, N> c, std::size_t k) {
+    for (std::size_t d = 0; d < N; d++) c[d] += offset(k, d);
+    return c;
+  }
+
+ private:
+  const boundary::PeriodicBoundary<T, N> boundary_;
+  dims_type dims_;
+};
+
+/**
+ * @brief particles owned by a subdomain and ghosts around it
+ *
+ * particles() holds num_owned() owned particles followed by ghosts from the
+ * adjacent subdomains (shifted by the box length across the periodic
+ * boundary), so searchers see a free boundary.
+ */
+template <class T, std::size_t N, class I = void>
+class Subdomain {
+ public:
+  typedef Particle<T, N, I> particle_type;
+
+  Subdomain(const Grid<T, N>& grid, std::size_t rank)
+      : grid_(&grid), rank_(rank), num_owned_(0), particles_(),
+        neighbors_(grid.neighbors(rank)) {}
+
+  std::size_t rank() const { return rank_; }
+
+  /** @brief owned particles followed by ghosts */
+  std::vector<particle_type>& particles() { return particles_; }
+  const std::vector<particle_type>& particles() const { return particles_; }
+
+  std::size_t num_owned() const { return num_owned_; }
+
+  /** @brief replace owned particles and drop ghosts */
+  void assign(std::vector<particle_type> owned) {
+    particles_ = std::move(owned);
+    num_owned_ = particles_.size();
+  }
+
+  /**
+   * @brief hand particles which left the subdomain to their owners
+   *
+   * Ghosts are dropped and positions are wrapped into the box. Particles
+   * are passed between adjacent subdomains only, one step closer to their
+   * owners in each round (Grid::next_hop). Grid::max_hops() rounds take
+   * any particle to its owner, and one round is enough for grids with up
+   * to 3 subdomains in each dimension.
+   */
+  void migrate(Transport<particle_type>& transport) {
+    PARTICLES_TIME("domain.migrate");
+    particles_.resize(num_owned_);
+    const auto& box = grid_->boundary();
+    for (auto& p : particles_) {
+      auto& x = p.position();
+      for (std::size_t d = 0; d < N; d++) {
+        boundary::internal::apply_periodic_impl(x[d], box.left()[d],
+                                                box.right()[d]);
+      }
+    }
+
+    std::vector<particle_type> moving;
+    std::size_t kept = 0;
+    for (std::size_t i = 0; i < num_owned_; i++) {
+      if (grid_->rank(particles_[i].position()) == rank_) {
+        particles_[kept++] = particles_[i];
+      } else {
+        moving.push_back(particles_[i]);
+      }
+    }
+    particles_.resize(kept);
+
+    const auto rounds = grid_->max_hops();
+    for (std::size_t round = 0; round < rounds; round++) {
+      std::map<std::size_t, std::vector<particle_type>> outgoing;
+      for (auto r : neighbors_) outgoing[r];
+      for (const auto& p : moving) {
+        const auto owner = grid_->rank(p.position());
+        outgoing[grid_->next_hop(rank_, owner)].push_back(p);
+      }
+      moving.clear();
+
+      for (auto& o : outgoing) {
+        transport.send(rank_, o.first, migrate_tag, std::move(o.second));
+      }
+      for (auto r : neighbors_) {
+        for (const auto& p : transport.receive(rank_, r, migrate_tag)) {
+          if (grid_->rank(p.position()) == rank_) {
+            particles_.push_back(p);
+          } else {
+            moving.push_back(p);
+          }
+        }
+      }
+    }
+    num_owned_ = particles_.size();
+  }
+
+  /**
+   * @brief receive ghosts within cutoff from the adjacent subdomains
+   *
+   * cutoff must not exceed the width of subdomains.
+   */
+  void exchange_halo(Transport<particle_type>& transport, T cutoff) {
+    PARTICLES_TIME("domain.exchange_halo");
+    particles_.resize(num_owned_);
+    const auto& box = grid_->boundary();
+    const auto c = grid_->coordinates(rank_);
+
+    for (std::size_t k = 0; k < grid_->num_offsets(); k++) {
+      if (k == grid_->center()) continue;
+      const auto target = grid_->shifted(c, k);
+      Vec<T, N> shift;
+      for (std::size_t d = 0; d < N; d++) {
+        const long n = static_cast<long>(grid_->dims()[d]);
+        if (target[d] < 0) shift[d] = box.length(d);
+        if (target[d] >= n) shift[d] = -box.length(d);
+      }
+
+      std::vector<particle_type> ghosts;
+      for (std::size_t i = 0; i < num_owned_; i++) {
+        const auto& x = particles_[i].position();
+        bool near = true;
+        for (std::size_t d = 0; d < N && near; d++) {
+          const int o = grid_->offset(k, d);
+          if (o > 0) near = x[d] >= grid_->upper(rank_, d) - cutoff;
+          if (o < 0) near = x[d] < grid_->lower(rank_, d) + cutoff;
+        }
+        if (!near) continue;
+        ghosts.push_back(particles_[i]);
+        ghosts.back().position() += shift;
+      }
+      transport.send(rank_, grid_->rank(target), halo_tag + k,
+                     std::move(ghosts));
+    }
+
+    // the subdomain at -offset sends ghosts toward +offset
+    for (std::size_t k = 0; k < grid_->num_offsets(); k++) {
+      if (k == grid_->center()) continue;
+      const auto source = grid_->shifted(c, grid_->num_offsets() - 1 - k);
+      const auto incoming = transport.receive(rank_, grid_->rank(source),
+                                              halo_tag + k);
+      particles_.insert(particles_.end(), incoming.begin(), incoming.end());
+    }
+  }
+
+ private:
+  static constexpr std::size_t migrate_tag = 0;
+  static constexpr std::size_t halo_tag = 1;  // + index of offset
+
+  const Grid<T, N>* grid_;
+  std::size_t rank_;
+  std::size_t num_owned_;
+  std::vector<particle_type> particles_;
+  std::vector<std::size_t> neighbors_;
+};
+
+template <class T, std::size_t N, class I>
+constexpr std::size_t Subdomain<T, N, I>::migrate_tag;
+template <class T, std::size_t N, class I>
+constexpr std::size_t Subdomain<T, N, I>::halo_tag;
+
+/**
+ * @brief runs a simulation with a worker thread per subdomain
+ *
+ * @code
+ * domain::DomainDecomposition<double, 2> dd(boundary, 4, r);
+ * dd.scatter(particles);
+ * dd.run(steps, [&](domain::Subdomain<double, 2>& s, std::size_t t) {
+ *   searcher.search(adjacency_list, s.particles());  // one per worker
+ *   for (std::size_t i = 0; i < s.num_owned(); i++) {
+ *     // update s.particles()[i] from adjacency_list[i]
+ *   }
+ * });
+ * particles = dd.gather();
+ * @endcode
+ *
+ * Each step, workers migrate particles and exchange halos, then call the
+ * step function, which may read ghosts but updates owned particles only.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ * @tparam I info of particles
+ */
+template <class T, std::size_t N, class I = void>
+class DomainDecomposition {
+ public:
+  typedef Particle<T, N, I> particle_type;
+  typedef Subdomain<T, N, I> subdomain_type;
+
+  /**
+   * @param count number of subdomains (see Grid)
+   * @param cutoff width of halos
+   * @param transport communication between workers, in-process if null
+   */
+  DomainDecomposition(
+      const boundary::PeriodicBoundary<T, N>& boundary, std::size_t count,
+      T cutoff,
+      std::unique_ptr<Transport<particle_type>> transport = nullptr)
+      : grid_(boundary, count), cutoff_(cutoff),
+        transport_(std::move(transport)), subdomains_() {
+    if (!transport_) {
+      transport_.reset(new InProcessTransport<particle_type>(grid_.size()));
+    }
+    for (std::size_t r = 0; r < grid_.size(); r++) {
+      subdomains_.emplace_back(grid_, r);
+    }
+  }
+
+  const Grid<T, N>& grid() const { return grid_; }
+
+  std::size_t size() const { return subdomains_.size(); }
+
+  subdomain_type& subdomain(std::size_t rank) { return subdomains_[rank]; }
+
+  /** @brief distribute particles to their subdomains */
+  void scatter(const std::vector<particle_type>& particles) {
+    std::vector<std::vector<particle_type>> owned(size());
+    for (const auto& p : particles) {
+      auto q = p;
+      for (std::size_t d = 0; d < N; d++) {
+        boundary::internal::apply_periodic_impl(
+            q.position()[d], grid_.boundary().left()[d],
+            grid_.boundary().right()[d]);
+      }
+      owned[grid_.rank(q.position())].push_back(q);
+    }
+    for (std::size_t r = 0; r < size(); r++) {
+      subdomains_[r].assign(std::move(owned[r]));
+    }
+  }
+
+  /** @brief owned particles of all subdomains in order of ranks */
+  std::vector<particle_type> gather() const {
+    std::vector<particle_type> particles;
+    for (const auto& s : subdomains_) {
+      particles.insert(particles.end(), s.particles().begin(),
+                       s.particles().begin() + s.num_owned());
+    }
+    return particles;
+  }
+
+  /**
+   * @brief run steps in a worker per subdomain
+   * @param f f(subdomain, step) advances owned particles of a subdomain
+   */
+  template <class Function>
+  void run(std::size_t steps, Function f) {
+    std::vector<std::thread> workers;
+    workers.reserve(size());
+    for (std::size_t r = 0; r < size(); r++) {
+      workers.emplace_back([this, r, steps, &f] {
+        auto& s = subdomains_[r];
+        for (std::size_t t = 0; t < steps; t++) {
+          s.migrate(*transport_);
+          s.exchange_halo(*transport_, cutoff_);
+          f(s, t);
+        }
+        s.migrate(*transport_);
+      });
+    }
+    for (auto& w : workers) w.join();
+  }
+
+ private:
+  const Grid<T, N> grid_;
+  const T cutoff_;
+  std::unique_ptr<Transport<particle_type>> transport_;
+  std::vector<subdomain_type> subdomains_;
+
+  DISALLOW_COPY_AND_ASSIGN(DomainDecomposition);
+};
+
+}  // namespace domain
+}  // namespace particles
@@ -0,0 +1,205 @@
+/**
+ * @file halo.hpp
+ *
+ * @brief ghost particles (periodic images) around a periodic box
+ */
+
+#pragma once
+
+#include "boundary.hpp"
+#include "instrument.hpp"
+#include "parallel.hpp"
+#include "particle.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+namespace particles {
+namespace boundary {
+
+/**
+ * @brief periodic images of particles near the faces of a periodic box
+ *
+ * Particles within the cutoff of a face, edge or corner are copied to the
+ * other side(s) of the box. Particles followed by their ghosts are written
+ * to an extended array, so any searcher working with a free boundary (e.g.
+ * DelaunaySearcher) finds periodic neighbors in it. origin(k) maps an entry
+ * of the extended array back to the original particle.
+ *
+ * Ghosts are chosen within cutoff + skin. Until a particle moves skin / 2
+ * (in the minimum image convention) since the last rebuild, the same ghosts
+ * are kept and only their positions are updated, as with Verlet lists.
+ * Particles are expected in the box (PeriodicBoundary::apply) at every
+ * update, and crossing a face between rebuilds is fine.
+ *
+ * @code
+ * boundary::Halo<double, 2> halo(boundary, r, 0.1 * r);
+ * for (std::size_t t = 0; t < steps; ++t) {
+ *   halo.update(particles, extended);
+ *   searcher.search(adjacency_list, extended);
+ *   // forces on extended...
+ *   halo.fold(forces);  // add forces on ghosts to their origins
+ * }
+ * @endcode
+ *
+ * cutoff + skin must not exceed the length of the box.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class Halo {
+ public:
+  Halo(const PeriodicBoundary<T, N>& boundary, T cutoff, T skin = 0)
+      : boundary_(boundary), cutoff_(cutoff), skin_(std::max<T>(skin, 0)),
+        size_(0), origins_(), shifts_(), built_() {}
+
+  /** @brief set cutoff and skin, ghosts are chosen again at next update */
+  void set_cutoff(T cutoff, T skin = 0) {
+    cutoff_ = cutoff;
+    skin_ = std::max<T>(skin, 0);
+    built_.clear();
+  }
+
+  /**
+   * @brief update extended array, rebuilding ghosts only when needed
+   * @param extended particles followed by ghosts
+   * @return whether ghosts are chosen again
+   */
+  template <class I>
+  bool update(const std::vector<Particle<T, N, I>>& particles,
+              std::vector<Particle<T, N, I>>& extended) {
+    PARTICLES_TIME("boundary.halo.update");
+    if (needs_rebuild(particles)) {
+      rebuild(particles, extended);
+      return true;
+    }
+    const std::size_t n = particles.size();
+    extended.resize(n + origins_.size());
+    std::copy(particles.begin(), particles.end(), extended.begin());
+    parallel::for_each(origins_.size(), [&](std::size_t g) {
+      const auto i = origins_[g];
+      const auto& x = particles[i].position();
+      const auto moved = boundary_.displacement(built_[i], x);
+      // an origin wrapped into the box moves by a box length. The image
+      // at the old side becomes the new image, and an image which would
+      // land on the origin itself goes to the side it came from.
+      int wrap[N], image[N];
+      bool zero = true;
+      for (std::size_t d = 0; d < N; d++) {
+        const T L = boundary_.length(d);
+        wrap[d] = static_cast<int>(
+            std::round((x[d] - built_[i][d] - moved[d]) / L));
+        image[d] = static_cast<int>(std::round(shifts_[g][d] / L)) - wrap[d];
+        zero = zero && image[d] == 0;
+      }
+      auto& ghost = extended[n + g];
+      ghost = particles[i];
+      for (std::size_t d = 0; d < N; d++) {
+        ghost.position()[d] += (zero ? -wrap[d] : image[d]) *
+                               boundary_.length(d);
+      }
+    }, 1024);
+    return false;
+  }
+
+  /** @brief choose ghosts and write extended array */
+  template <class I>
+  void rebuild(const std::vector<Particle<T, N, I>>& particles,
+               std::vector<Particle<T, N, I>>& extended) {
+    PARTICLES_TIME("boundary.halo.rebuild");
+    const std::size_t n = particles.size();
+    size_ = n;
+    origins_.clear();
+    shifts_.clear();
+    built_.resize(n);
+    const T r = cutoff_ + skin_;
+
+    for (std::size_t i = 0; i < n; i++) {
+      const auto& x = particles[i].position();
+      built_[i] = x;
+      // -1, 0 or +1 image in each dimension if close to the face
+      int side[N];
+      for (std::size_t d = 0; d < N; d++) {
+        side[d] = x[d] < boundary_.left()[d] + r ? 1
+            : (x[d] >= boundary_.right()[d] - r ? -1 : 0);
+      }
+      // every nonzero combination of sides (faces, edges and corners)
+      for (std::size_t mask = 1; mask < (std::size_t(1) << N); mask++) {
+        Vec<T, N> shift;
+        bool valid = true;
+        for (std::size_t d = 0; d < N && valid; d++) {
+          if (!((mask >> d) & 1)) continue;
+          valid = side[d] != 0;
+          shift[d] = side[d] * boundary_.length(d);
+        }
+        if (!valid) continue;
+        origins_.push_back(i);
+        shifts_.push_back(shift);
+      }
+    }
+
+    extended.resize(n + origins_.size());
+    std::copy(particles.begin(), particles.end(), extended.begin());
+    parallel::for_each(origins_.size(), [&](std::size_t g) {
+      auto& ghost = extended[n + g];
+      ghost = particles[origins_[g]];
+      ghost.position() += shifts_[g];
+    }, 1024);
+  }
+
+  /** @brief number of ghosts */
+  std::size_t size() const { return origins_.size(); }
+
+  /** @brief index of the original of k-th particle in extended array */
+  std::size_t origin(std::size_t k) const {
+    return k < size_ ? k : origins_[k - size_];
+  }
+
+  /** @brief indices of the originals of ghosts */
+  const std::vector<std::size_t>& origins() const { return origins_; }
+
+  /** @brief ghost g was at its original position + shifts()[g] at rebuild */
+  const std::vector<Vec<T, N>>& shifts() const { return shifts_; }
+
+  /**
+   * @brief add values of ghosts (e.g. forces) to their originals
+   * @param values array parallel to extended array, resized to particles
+   */
+  template <class U>
+  void fold(std::vector<U>& values) const {
+    if (values.size() < size_) return;
+    const std::size_t m = std::min(origins_.size(), values.size() - size_);
+    for (std::size_t g = 0; g < m; g++) {
+      values[origins_[g]] += values[size_ + g];
+    }
+    values.resize(size_);
+  }
+
+ private:
+  const PeriodicBoundary<T, N> boundary_;
+  T cutoff_;
+  T skin_;
+  std::size_t size_;                  // number of particles at rebuild
+  std::vector<std::size_t> origins_;
+  std::vector<Vec<T, N>> shifts_;
+  std::vector<Vec<T, N>> built_;      // positions at rebuild
+
+  template <class I>
+  bool needs_rebuild(const std::vector<Particle<T, N, I>>& particles) const {
+    if (particles.size() != size_ || built_.size() != size_) return true;
+    const T limit = skin_ * skin_ / 4;
+    return parallel::reduce(particles.size(), false,
+                            [&](std::size_t first, std::size_t last) {
+      for (auto i = first; i < last; i++) {
+        const auto& x = particles[i].position();
+        if (boundary_.squared_distance(built_[i], x) > limit) return true;
+      }
+      return false;
+    }, [](bool a, bool b) { return a || b; });
+  }
+};
+
+}  // namespace boundary
+}  // namespace particles
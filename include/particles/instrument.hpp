@@ -0,0 +1,541 @@
+/**
+ * @file instrument.hpp
+ *
+ * @brief timers, counters and histograms of library phases
+ *
+ * Define PARTICLES_INSTRUMENT before including particles to record phases of
+ * searchers, boundaries, random number generators and I/O, as well as your
+ * own. Otherwise the macros expand to nothing (their arguments are not
+ * evaluated) and reports are empty. Define it in all translation units or
+ * in none.
+ *
+ * @code
+ * #define PARTICLES_INSTRUMENT
+ * #include "particles/particles.hpp"
+ *
+ * instrument::write_csv_header(csv);
+ * for (int t = 0; t < steps; t++) {
+ *   {
+ *     PARTICLES_TIME("driver.step");
+ *     searcher.search(adjacency_list, particles);
+ *     ...
+ *   }
+ *   instrument::write_csv(csv, t);  // this step only
+ *   instrument::reset();
+ * }
+ * @endcode
+ *
+ * Without reset(), reports hold totals from the start.
+ *
+ * Names are given by the call site (one per site), like "search.kdtree.build"
+ * for phases of the library and "io.particles" for counts.
+ *
+ * Define PARTICLES_TRACE (which implies PARTICLES_INSTRUMENT) to also record
+ * each timed phase as an event of the thread running it, including blocks
+ * of parallel loops, and write them for a trace viewer (chrome://tracing,
+ * Perfetto) to see load imbalance and serial parts.
+ *
+ * @code
+ * #define PARTICLES_TRACE
+ * #include "particles/particles.hpp"
+ *
+ * ...  // time loop
+ * std::ofstream trace("trace.json");
+ * instrument::write_trace(trace);
+ * @endcode
+ */
+
+#pragma once
+
+#include "util.hpp"
+#include "details/trace.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+
+#define PARTICLES_INSTRUMENT_CAT_IMPL(a, b) a##b
+#define PARTICLES_INSTRUMENT_CAT(a, b) PARTICLES_INSTRUMENT_CAT_IMPL(a, b)
+
+#if defined(PARTICLES_TRACE) && !defined(PARTICLES_INSTRUMENT)
+#define PARTICLES_INSTRUMENT
+#endif
+
+#ifdef PARTICLES_TRACE
+#define PARTICLES_INSTRUMENT_SCOPE ::particles::instrument::ScopedTrace
+#else
+#define PARTICLES_INSTRUMENT_SCOPE ::particles::instrument::ScopedTimer
+#endif
+
+#ifdef PARTICLES_INSTRUMENT
+
+/** @brief time the rest of the scope */
+#define PARTICLES_TIME(name)                                                \
+  static auto& PARTICLES_INSTRUMENT_CAT(particles_timer_, __LINE__) =       \
+      ::particles::instrument::registry().timer(name);                      \
+  PARTICLES_INSTRUMENT_SCOPE PARTICLES_INSTRUMENT_CAT(                      \
+      particles_scoped_timer_, __LINE__)(                                   \
+      PARTICLES_INSTRUMENT_CAT(particles_timer_, __LINE__))
+
+/** @brief add n to a counter */
+#define PARTICLES_COUNT(name, n)                                         \
+  do {                                                                   \
+    static auto& particles_counter_ =                                    \
+        ::particles::instrument::registry().counter(name);               \
+    particles_counter_.add(n);                                           \
+  } while (0)
+
+/** @brief add a non-negative integer to a histogram */
+#define PARTICLES_HISTOGRAM(name, value)                                 \
+  do {                                                                   \
+    static auto& particles_histogram_ =                                  \
+        ::particles::instrument::registry().histogram(name);             \
+    particles_histogram_.add(value);                                     \
+  } while (0)
+
+#else
+
+#define PARTICLES_TIME(name) static_cast<void>(0)
+#define PARTICLES_COUNT(name, n) static_cast<void>(0)
+#define PARTICLES_HISTOGRAM(name, value) static_cast<void>(0)
+
+#endif
+
+namespace particles {
+namespace instrument {
+namespace internal {
+
+/** @brief slot of the calling thread among n */
+inline std::size_t thread_slot(std::size_t n) {
+  static std::atomic<std::size_t> next(0);
+  thread_local const std::size_t slot = next.fetch_add(1);
+  return slot % n;
+}
+
+/** @brief atomic value on its own cache line */
+struct PaddedAtomic {
+  std::atomic<std::int64_t> value;
+  char padding[64 - sizeof(std::atomic<std::int64_t>)];
+
+  PaddedAtomic() : value(0) {}
+};
+
+inline void atomic_min(std::atomic<std::int64_t>& a, std::int64_t v) {
+  auto old = a.load(std::memory_order_relaxed);
+  while (v < old && !a.compare_exchange_weak(old, v)) {}
+}
+
+inline void atomic_max(std::atomic<std::int64_t>& a, std::int64_t v) {
+  auto old = a.load(std::memory_order_relaxed);
+  while (v > old && !a.compare_exchange_weak(old, v)) {}
+}
+
+}  // namespace internal
+
+/**
+ * @brief sum of values added from any thread
+ *
+ * Threads add to separate slots, so that counting in parallel loops does
+ * not contend on a single cache line.
+ */
+class Counter {
+ public:
+  static constexpr std::size_t num_slots = 16;
+
+  Counter() : slots_() {}
+
+  void add(std::int64_t n) {
+    slots_[internal::thread_slot(num_slots)].value.fetch_add(
+        n, std::memory_order_relaxed);
+  }
+
+  std::int64_t value() const {
+    std::int64_t sum = 0;
+    for (const auto& s : slots_) {
+      sum += s.value.load(std::memory_order_relaxed);
+    }
+    return sum;
+  }
+
+  void reset() {
+    for (auto& s : slots_) s.value.store(0, std::memory_order_relaxed);
+  }
+
+ private:
+  internal::PaddedAtomic slots_[num_slots];
+
+  DISALLOW_COPY_AND_ASSIGN(Counter);
+};
+
+/** @brief number, total, min and max of durations in nanoseconds */
+class Timer {
+ public:
+  Timer() : count_(0), total_(0), min_(), max_(0) { reset(); }
+
+  void add(std::int64_t ns) {
+    count_.fetch_add(1, std::memory_order_relaxed);
+    total_.fetch_add(ns, std::memory_order_relaxed);
+    internal::atomic_min(min_, ns);
+    internal::atomic_max(max_, ns);
+  }
+
+  std::int64_t count() const { return count_.load(); }
+  std::int64_t total() const { return total_.load(); }
+  /** @brief 0 if nothing is recorded */
+  std::int64_t min() const { return count() > 0 ? min_.load() : 0; }
+  std::int64_t max() const { return max_.load(); }
+
+  void reset() {
+    count_ = 0;
+    total_ = 0;
+    min_ = std::numeric_limits<std::int64_t>::max();
+    max_ = 0;
+  }
+
+ private:
+  std::atomic<std::int64_t> count_;
+  std::atomic<std::int64_t> total_;
+  std::atomic<std::int64_t> min_;
+  std::atomic<std::int64_t> max_;
+
+  DISALLOW_COPY_AND_ASSIGN(Timer);
+};
+
+/**
+ * @brief distribution of non-negative integers in bins of powers of 2
+ *
+ * Bin 0 holds 0, and bin k holds \f$[2^{k-1}, 2^k)\f$.
+ */
+class Histogram {
+ public:
+  static constexpr std::size_t num_bins = 64;
+
+  Histogram() : bins_(), count_(0), sum_(0), max_(0) { reset(); }
+
+  void add(std::uint64_t value) {
+    bins_[bin(value)].fetch_add(1, std::memory_order_relaxed);
+    count_.fetch_add(1, std::memory_order_relaxed);
+    sum_.fetch_add(static_cast<std::int64_t>(value), std::memory_order_relaxed);
+    internal::atomic_max(max_, static_cast<std::int64_t>(value));
+  }
+
+  static std::size_t bin(std::uint64_t value) {
+    std::size_t k = 0;
+    while (value > 0 && k + 1 < num_bins) {
+      value >>= 1;
+      k++;
+    }
+    return k;
+  }
+
+  /** @brief smallest value of bin k */
+  static std::uint64_t lower(std::size_t k) {
+    return k == 0 ? 0 : std::uint64_t(1) << (k - 1);
+  }
+
+  std::int64_t bin_count(std::size_t k) const { return bins_[k].load(); }
+  std::int64_t count() const { return count_.load(); }
+  std::int64_t sum() const { return sum_.load(); }
+  std::int64_t max() const { return max_.load(); }
+
+  void reset() {
+    for (auto& b : bins_) b = 0;
+    count_ = 0;
+    sum_ = 0;
+    max_ = 0;
+  }
+
+ private:
+  std::atomic<std::int64_t> bins_[num_bins];
+  std::atomic<std::int64_t> count_;
+  std::atomic<std::int64_t> sum_;
+  std::atomic<std::int64_t> max_;
+
+  DISALLOW_COPY_AND_ASSIGN(Histogram);
+};
+
+/**
+ * @brief named timers, counters and histograms
+ *
+ * Entries are created on first use and live until the end of the program,
+ * so call sites keep references to them.
+ */
+class Registry {
+ public:
+  Registry() : mutex_(), timers_(), counters_(), histograms_() {}
+
+  Timer& timer(const std::string& name) { return get(timers_, name); }
+  Counter& counter(const std::string& name) { return get(counters_, name); }
+  Histogram& histogram(const std::string& name) {
+    return get(histograms_, name);
+  }
+
+  /** @brief set all values to zero */
+  void reset() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (auto& t : timers_) t.second->reset();
+    for (auto& c : counters_) c.second->reset();
+    for (auto& h : histograms_) h.second->reset();
+  }
+
+  /** @brief call f(name, entry) in order of names */
+  template <class Function>
+  void for_each_timer(Function f) const { for_each(timers_, f); }
+  template <class Function>
+  void for_each_counter(Function f) const { for_each(counters_, f); }
+  template <class Function>
+  void for_each_histogram(Function f) const { for_each(histograms_, f); }
+
+ private:
+  template <class Entry>
+  using Map = std::map<std::string, std::unique_ptr<Entry>>;
+
+  mutable std::mutex mutex_;
+  Map<Timer> timers_;
+  Map<Counter> counters_;
+  Map<Histogram> histograms_;
+
+  template <class Entry>
+  Entry& get(Map<Entry>& map, const std::string& name) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    auto& entry = map[name];
+    if (!entry) entry.reset(new Entry());
+    return *entry;
+  }
+
+  template <class Entry, class Function>
+  void for_each(const Map<Entry>& map, Function f) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (const auto& e : map) f(e.first, *e.second);
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(Registry);
+};
+
+/** @brief registry of the program */
+inline Registry& registry() {
+  static Registry r;
+  return r;
+}
+
+/** @brief set all timers, counters and histograms to zero */
+inline void reset() { registry().reset(); }
+
+/** @brief adds the lifetime of the object to a timer */
+class ScopedTimer {
+ public:
+  explicit ScopedTimer(Timer& timer)
+      : timer_(timer), start_(std::chrono::steady_clock::now()) {}
+
+  ~ScopedTimer() {
+    const auto d = std::chrono::steady_clock::now() - start_;
+    timer_.add(
+        std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+  }
+
+ private:
+  Timer& timer_;
+  std::chrono::steady_clock::time_point start_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTimer);
+};
+
+/** @brief ScopedTimer also adding an event to the trace of the thread */
+class ScopedTrace {
+ public:
+  explicit ScopedTrace(Timer& timer)
+      : timer_(timer), begin_(internal::trace_clock()) {}
+
+  ~ScopedTrace() {
+    const auto end = internal::trace_clock();
+    timer_.add(end - begin_);
+    internal::thread_trace_buffer().push({&timer_, begin_, end});
+  }
+
+ private:
+  Timer& timer_;
+  std::int64_t begin_;
+
+  DISALLOW_COPY_AND_ASSIGN(ScopedTrace);
+};
+
+/**
+ * @brief number of events kept per thread
+ *
+ * Older events are overwritten. Applies to threads tracing their first
+ * event after the call.
+ */
+inline void set_trace_capacity(std::size_t capacity) {
+  internal::trace_buffers().set_capacity(capacity);
+}
+
+/** @brief remove all events */
+inline void clear_trace() { internal::trace_buffers().clear(); }
+
+namespace internal {
+
+inline double seconds(std::int64_t ns) { return ns * 1e-9; }
+
+/** @brief names are given in code, so only quotes and backslashes escaped */
+inline void write_json_string(std::ostream& os, const std::string& s) {
+  os << '"';
+  for (char c : s) {
+    if (c == '"' || c == '\\') os << '\\';
+    os << c;
+  }
+  os << '"';
+}
+
+}  // namespace internal
+
+/**
+ * @brief write all entries as a JSON object in one line
+ *
+ * Times are in seconds. Histograms list [lower bound, count] of non-empty
+ * bins.
+ *
+ * @code
+ * {"step": 3, "timers": {"search.kdtree.build": {"count": 1, "total": 0.01,
+ *  "mean": 0.01, "min": 0.01, "max": 0.01}}, "counters": {"io.particles":
+ *  1000}, "histograms": {"search.neighbors": {"count": 1000, "sum": 5012,
+ *  "max": 11, "bins": [[4, 120], [8, 880]]}}}
+ * @endcode
+ *
+ * @param step written unless negative
+ */
+inline void write_json(std::ostream& os, long step = -1) {
+  const auto& r = registry();
+  os << "{";
+  if (step >= 0) os << "\"step\": " << step << ", ";
+
+  const char* separator = "";
+  os << "\"timers\": {";
+  r.for_each_timer([&](const std::string& name, const Timer& t) {
+    os << separator;
+    internal::write_json_string(os, name);
+    const auto n = t.count();
+    os << ": {\"count\": " << n
+       << ", \"total\": " << internal::seconds(t.total())
+       << ", \"mean\": " << (n > 0 ? internal::seconds(t.total()) / n : 0.)
+       << ", \"min\": " << internal::seconds(t.min())
+       << ", \"max\": " << internal::seconds(t.max()) << "}";
+    separator = ", ";
+  });
+
+  separator = "";
+  os << "}, \"counters\": {";
+  r.for_each_counter([&](const std::string& name, const Counter& c) {
+    os << separator;
+    internal::write_json_string(os, name);
+    os << ": " << c.value();
+    separator = ", ";
+  });
+
+  separator = "";
+  os << "}, \"histograms\": {";
+  r.for_each_histogram([&](const std::string& name, const Histogram& h) {
+    os << separator;
+    internal::write_json_string(os, name);
+    os << ": {\"count\": " << h.count() << ", \"sum\": " << h.sum()
+       << ", \"max\": " << h.max() << ", \"bins\": [";
+    const char* comma = "";
+    for (std::size_t k = 0; k < Histogram::num_bins; k++) {
+      if (h.bin_count(k) == 0) continue;
+      os << comma << "[" << Histogram::lower(k) << ", " << h.bin_count(k)
+         << "]";
+      comma = ", ";
+    }
+    os << "]}";
+    separator = ", ";
+  });
+  os << "}}\n";
+}
+
+/** @brief header of write_csv */
+inline void write_csv_header(std::ostream& os) {
+  os << "step,kind,name,count,total,min,max\n";
+}
+
+/**
+ * @brief write all entries as CSV rows
+ *
+ * Columns are those of write_csv_header. Timers give times in seconds,
+ * counters give only the value as total, and histograms give the number,
+ * sum and max of values.
+ *
+ * @param step empty if negative
+ */
+inline void write_csv(std::ostream& os, long step = -1) {
+  const auto& r = registry();
+  auto row = [&os, step](const char* kind, const std::string& name) -> auto& {
+    if (step >= 0) os << step;
+    return os << "," << kind << "," << name << ",";
+  };
+  r.for_each_timer([&](const std::string& name, const Timer& t) {
+    row("timer", name) << t.count() << "," << internal::seconds(t.total())
+                       << "," << internal::seconds(t.min()) << ","
+                       << internal::seconds(t.max()) << "\n";
+  });
+  r.for_each_counter([&](const std::string& name, const Counter& c) {
+    row("counter", name) << "," << c.value() << ",,\n";
+  });
+  r.for_each_histogram([&](const std::string& name, const Histogram& h) {
+    row("histogram", name) << h.count() << "," << h.sum() << ",,"
+                           << h.max() << "\n";
+  });
+}
+
+namespace internal {
+
+/** @brief nanoseconds as microseconds with 3 decimals */
+inline void write_microseconds(std::ostream& os, std::int64_t ns) {
+  const char digits[] = {char('0' + ns / 100 % 10), char('0' + ns / 10 % 10),
+                         char('0' + ns % 10), '\0'};
+  os << ns / 1000 << "." << digits;
+}
+
+}  // namespace internal
+
+/**
+ * @brief write events in the trace event format of Chrome
+ *
+ * Each phase is a complete event ("ph": "X") on the lane ("tid") of the
+ * buffer of its thread. Buffers of finished threads go to threads started
+ * later, so a lane holds events of one thread at a time but not always of
+ * the same thread. Call it while no thread is tracing, e.g. between steps.
+ */
+inline void write_trace(std::ostream& os) {
+  std::map<const void*, std::string> names;
+  registry().for_each_timer([&names](const std::string& name, const Timer& t) {
+    names[&t] = name;
+  });
+
+  os << "{\"traceEvents\": [";
+  const char* separator = "\n";
+  internal::trace_buffers().for_each([&](const internal::TraceBuffer& b) {
+    os << separator << "{\"name\": \"thread_name\", \"ph\": \"M\", "
+       << "\"pid\": 1, \"tid\": " << b.id()
+       << ", \"args\": {\"name\": \"thread " << b.id() << "\"}}";
+    separator = ",\n";
+    b.for_each([&](const internal::TraceEvent& e) {
+      os << separator << "{\"name\": ";
+      internal::write_json_string(os, names[e.key]);
+      os << ", \"cat\": \"particles\", \"ph\": \"X\", \"pid\": 1, \"tid\": "
+         << b.id() << ", \"ts\": ";
+      internal::write_microseconds(os, e.begin);
+      os << ", \"dur\": ";
+      internal::write_microseconds(os, e.end - e.begin);
+      os << "}";
+    });
+  });
+  os << "\n], \"displayTimeUnit\": \"ms\"}\n";
+}
+
+}  // namespace instrument
+}  // namespace particles
@@ -6,9 +6,13 @@
  * @brief input and output including global overloading
  */
 
+#include "instrument.hpp"
 #include "vec.hpp"
 #include "particle.hpp"
 #include "range.hpp"
+#include "io/frame_reader.hpp"
+
+#include <cstdint>
 #include <iostream>
 #include <fstream>
 #include <string>
@@ -145,11 +149,47 @@ template <class Iterator>
 std::ostream& output_particles(std::ostream& os, Iterator first, Iterator last,
                                const std::string& delimiter = " ",
                                const std::string& newline = "\n") {
+  PARTICLES_TIME("io.output_particles");
+  std::size_t n = 0;
   auto it = first;
   while (it != last) {
     output_particle(os, *it, delimiter);
     os << newline;
     ++it;
+    n++;
+  }
+  PARTICLES_COUNT("io.particles_written", n);
+  return os;
+}
+
+/**
+ * @brief output particles as a frame in binary format
+ *
+ * Each call writes one frame, which can be read by io::FrameReader with
+ * io::Format::binary.
+ *
+ * @code
+ * std::ofstream fout("traj.bin", std::ios::binary);
+ * io::output_particles_binary(fout, v.begin(), v.end());
+ * @endcode
+ *
+ * @tparam Iterator random access iterator
+ */
+template <class Iterator>
+std::ostream& output_particles_binary(std::ostream& os, Iterator first,
+                                      Iterator last) {
+  PARTICLES_TIME("io.output_particles_binary");
+  const std::uint64_t n = last - first;
+  PARTICLES_COUNT("io.particles_written", n);
+  os.write(reinterpret_cast<const char*>(&n), sizeof(n));
+  auto it = first;
+  while (it != last) {
+    const auto& p = *it;
+    typedef typename std::remove_reference<decltype(p.position(0))>::type T;
+    constexpr auto N = std::remove_reference<decltype(p)>::type::dim();
+    os.write(reinterpret_cast<const char*>(&p.position(0)), sizeof(T) * N);
+    os.write(reinterpret_cast<const char*>(&p.velocity(0)), sizeof(T) * N);
+    ++it;
   }
   return os;
 }
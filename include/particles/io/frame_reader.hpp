@@ -0,0 +1,249 @@
+/**
+ * @file frame_reader.hpp
+ *
+ * @brief read trajectory files frame by frame
+ *
+ * Input-side counterpart of io::output_particles. A frame is read ahead on a
+ * background thread while the previous one is processed, and the two frame
+ * buffers are swapped instead of reallocated.
+ */
+
+#pragma once
+
+#include "../instrument.hpp"
+#include "../particle.hpp"
+#include "../util.hpp"
+
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <istream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace particles {
+namespace io {
+
+/**
+ * @brief format of trajectory files
+ *
+ * - text: one particle per line (position then velocity), frames separated by
+ *   blank lines. Lines which do not start with a number (e.g. a header) are
+ *   skipped. This is what io::output_particles(...) << "\n\n" emits.
+ * - binary: each frame is a std::uint64_t particle count followed by the
+ *   position and velocity of each particle as raw T. This is what
+ *   io::output_particles_binary emits.
+ */
+enum class Format { text, binary };
+
+namespace internal {
+
+/**
+ * @brief parse up to n numbers from a line
+ * @return number of parsed values
+ */
+template <class T>
+std::size_t parse_values(const std::string& line, T* values, std::size_t n) {
+  const char* s = line.c_str();
+  std::size_t k = 0;
+  while (k < n) {
+    char* end;
+    const double x = std::strtod(s, &end);
+    if (end == s) break;
+    values[k++] = static_cast<T>(x);
+    s = end;
+  }
+  return k;
+}
+
+/** @brief whether the line has only white spaces */
+inline bool is_blank(const std::string& line) {
+  return line.find_first_not_of(" \t\r") == std::string::npos;
+}
+
+/**
+ * @brief read a frame in text format
+ *
+ * If only N values are found in a line, they are taken as position and
+ * velocity is set to zero.
+ *
+ * @return false if no particle is found before the end of stream
+ */
+template <class T, std::size_t N>
+bool read_text_frame(std::istream& is, std::vector<Particle<T, N>>& frame,
+                     std::string& line) {
+  PARTICLES_TIME("io.read_text_frame");
+  std::size_t n = 0;
+  T values[N * 2];
+  while (std::getline(is, line)) {
+    if (is_blank(line)) {
+      if (n > 0) break;  // end of frame
+      continue;
+    }
+    const auto k = parse_values(line, values, N * 2);
+    if (k < N) continue;  // header or comment
+    if (n == frame.size()) frame.emplace_back();
+    auto& p = frame[n++];
+    for (std::size_t i = 0; i < N; i++) {
+      p.position(i) = values[i];
+      p.velocity(i) = k == N * 2 ? values[N + i] : T(0);
+    }
+  }
+  frame.resize(n);
+  PARTICLES_HISTOGRAM("io.frame_size", n);
+  return n > 0;
+}
+
+/**
+ * @brief read a frame in binary format
+ * @param buffer scratch space reused over frames
+ */
+template <class T, std::size_t N>
+bool read_binary_frame(std::istream& is, std::vector<Particle<T, N>>& frame,
+                       std::vector<T>& buffer) {
+  PARTICLES_TIME("io.read_binary_frame");
+  std::uint64_t n;
+  if (!is.read(reinterpret_cast<char*>(&n), sizeof(n))) return false;
+  buffer.resize(n * N * 2);
+  if (!is.read(reinterpret_cast<char*>(buffer.data()),
+               buffer.size() * sizeof(T))) {
+    return false;
+  }
+  frame.resize(n);
+  auto it = buffer.cbegin();
+  for (auto& p : frame) {
+    for (std::size_t i = 0; i < N; i++) p.position(i) = *(it++);
+    for (std::size_t i = 0; i < N; i++) p.velocity(i) = *(it++);
+  }
+  return true;
+}
+
+}  // namespace internal
+
+/**
+ * @brief read frames one by one from a stream
+ *
+ * The next frame is read on a background thread while the current one is
+ * used. Only two frame buffers live at once, so memory usage does not depend
+ * on the length of the trajectory.
+ *
+ * @code
+ * std::ifstream fin("vicsek2.dat");
+ * io::FrameReader<double, 2> reader(fin);
+ * for (const auto& frame : reader) {
+ *   // frame: const std::vector<Particle<double, 2>>&
+ * }
+ * @endcode
+ *
+ * The frame referred by the iterator is overwritten by the next increment.
+ * The stream must outlive the reader.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class FrameReader {
+ public:
+  typedef Particle<T, N> particle_type;
+  typedef std::vector<particle_type> frame_type;
+
+  /** @brief single pass iterator over frames */
+  class iterator
+      : public std::iterator<std::input_iterator_tag, const frame_type> {
+   public:
+    iterator() : reader_(nullptr) {}
+    explicit iterator(FrameReader* reader) : reader_(reader) {}
+
+    const frame_type& operator*() const { return reader_->frame(); }
+    const frame_type* operator->() const { return &reader_->frame(); }
+    iterator& operator++() {
+      if (!reader_->next()) reader_ = nullptr;
+      return *this;
+    }
+    bool operator==(const iterator& it) const { return reader_ == it.reader_; }
+    bool operator!=(const iterator& it) const { return reader_ != it.reader_; }
+
+   private:
+    FrameReader* reader_;
+  };
+
+  FrameReader(std::istream& is, Format format = Format::text)
+      : is_(is), format_(format), front_(), back_(),
+        ready_(false), eof_(false), stop_(false) {
+    worker_ = std::thread([this] { this->read_ahead(); });
+  }
+
+  ~FrameReader() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    worker_.join();
+  }
+
+  /**
+   * @brief proceed to the next frame
+   * @return false if the stream has no more frame
+   */
+  bool next() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    cond_.wait(lock, [this] { return ready_ || eof_; });
+    if (!ready_) return false;
+    front_.swap(back_);
+    ready_ = false;
+    lock.unlock();
+    cond_.notify_all();
+    return true;
+  }
+
+  /** @brief current frame */
+  const frame_type& frame() const { return front_; }
+
+  /** @brief reads the first frame and returns iterator pointing it */
+  iterator begin() { return next() ? iterator(this) : end(); }
+  iterator end() { return iterator(); }
+
+ private:
+  std::istream& is_;
+  const Format format_;
+  frame_type front_;   // frame used by the caller
+  frame_type back_;    // frame being read
+  bool ready_;         // back_ holds a frame
+  bool eof_;
+  bool stop_;
+  std::mutex mutex_;
+  std::condition_variable cond_;
+  std::thread worker_;
+
+  void read_ahead() {
+    std::string line;
+    std::vector<T> buffer;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this] { return !ready_ || stop_; });
+        if (stop_) return;
+      }
+      // back_ is owned by this thread until ready_ is set.
+      const bool ok = format_ == Format::text
+          ? internal::read_text_frame(is_, back_, line)
+          : internal::read_binary_frame(is_, back_, buffer);
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (ok) ready_ = true;
+        else    eof_ = true;
+      }
+      cond_.notify_all();
+      if (!ok) return;
+    }
+  }
+
+  DISALLOW_COPY_AND_ASSIGN(FrameReader);
+};
+
+}  // namespace io
+}  // namespace particles
@@ -0,0 +1,1004 @@
+/**
+ * @file longrange.hpp
+ *
+ * @brief sums over all pairs of particles (gravity, Coulomb-like kernels)
+ */
+
+#pragma once
+
+#include "instrument.hpp"
+#include "parallel.hpp"
+#include "particle.hpp"
+#include "details/chebyshev.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace particles {
+namespace longrange {
+
+/**
+ * @brief Barnes-Hut tree for sums of a pairwise kernel over all particles
+ *
+ * Space is divided into a quadtree (2d) or octree (3d). A node of width w
+ * seen from distance d with \f$w < \theta d\f$ is replaced by its total
+ * weight at its center of weight (monopole), and otherwise it is opened.
+ * A field at every particle costs \f$O(n \log n)\f$. \f$\theta = 0\f$
+ * opens all nodes and gives the direct sum.
+ *
+ * The kernel is called as kernel(r, w), where \f$r = x_i - x_j\f$ is the
+ * vector from a source (particle or node) to the target particle and w is
+ * the weight of the source, and returns the contribution to the field at
+ * the target.
+ *
+ * @code
+ * longrange::BarnesHut<double, 3> tree(0.5);
+ * tree.build(particles, masses);
+ * std::vector<Vec<double, 3>> field;
+ * tree.evaluate(particles, [](const Vec<double, 3>& r, double m) {
+ *   const double s = r.squared_length() + 1e-4;  // softening
+ *   return Vec<double, 3>(r * (-m / (s * std::sqrt(s))));
+ * }, field);
+ * @endcode
+ *
+ * Centers of weight use |w|, so nodes mixing signs (charges) stay inside
+ * the node, but the monopole is a poor approximation of a neutral node.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class BarnesHut {
+ public:
+  /**
+   * @param theta opening angle
+   * @param leaf_size nodes with more particles are split
+   */
+  explicit BarnesHut(T theta = 0.5, std::size_t leaf_size = 8)
+      : theta_(theta), leaf_size_(std::max<std::size_t>(leaf_size, 1)),
+        order_(), positions_(), weights_(), nodes_() {}
+
+  void set_theta(T theta) { theta_ = theta; }
+  T theta() const { return theta_; }
+
+  /** @brief number of nodes of the tree */
+  std::size_t num_nodes() const { return nodes_.size(); }
+
+  /** @brief build the tree with unit weights */
+  template <class I>
+  void build(const std::vector<Particle<T, N, I>>& particles) {
+    build(particles, std::vector<T>(particles.size(), T(1)));
+  }
+
+  /** @param weights weights (masses, charges) parallel to particles */
+  template <class I>
+  void build(const std::vector<Particle<T, N, I>>& particles,
+             const std::vector<T>& weights) {
+    PARTICLES_TIME("longrange.barnes_hut.build");
+    const std::size_t n = particles.size();
+    order_.resize(n);
+    for (std::size_t i = 0; i < n; i++) order_[i] = i;
+    nodes_.clear();
+    positions_.clear();
+    weights_.clear();
+    if (n == 0) return;
+
+    // cubic root box
+    Vec<T, N> lower = particles[0].position(), upper = lower;
+    for (const auto& p : particles) {
+      for (std::size_t d = 0; d < N; d++) {
+        lower[d] = std::min(lower[d], p.position()[d]);
+        upper[d] = std::max(upper[d], p.position()[d]);
+      }
+    }
+    T width = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      width = std::max(width, upper[d] - lower[d]);
+    }
+    Node root = Node();
+    root.lower = lower;
+    root.width = width;
+    root.first = 0;
+    root.last = n;
+    nodes_.push_back(root);
+    split(0, particles, 0);
+
+    // copy in tree order, so that leaves are contiguous in memory
+    positions_.resize(n);
+    weights_.resize(n);
+    for (std::size_t l = 0; l < n; l++) {
+      positions_[l] = particles[order_[l]].position();
+      weights_[l] = weights[order_[l]];
+    }
+    for (std::size_t k = nodes_.size(); k-- > 0;) moments(k);
+  }
+
+  /**
+   * @brief field at each particle from all the others
+   * @param particles the same as given to build
+   * @param field field[i] is the sum of kernel(x_i - x_j, w_j) over j != i
+   */
+  template <class I, class Kernel>
+  void evaluate(const std::vector<Particle<T, N, I>>& particles,
+                Kernel kernel, std::vector<Vec<T, N>>& field) const {
+    PARTICLES_TIME("longrange.barnes_hut.evaluate");
+    const std::size_t n = order_.size();
+    field.resize(n);
+    // walk in tree order, so that neighboring threads share nodes in cache
+    parallel::for_each(n, [&](std::size_t l) {
+      const auto i = order_[l];
+      field[i] = walk(particles[i].position(), l, kernel);
+    }, 64);
+  }
+
+ private:
+  struct Node {
+    Vec<T, N> lower;    // corner of the cube
+    T width;            // width of the cube
+    Vec<T, N> center;   // center of |weight|
+    T weight;           // total weight
+    T magnitude;        // total |weight|
+    std::size_t first;  // range in order_
+    std::size_t last;
+    std::size_t child;  // first of 2^N children, or 0 for a leaf
+  };
+
+  /** @brief splits stop here, e.g. for particles at the same position */
+  static constexpr std::size_t max_depth = 32;
+
+  T theta_;
+  std::size_t leaf_size_;
+  std::vector<std::size_t> order_;    // particle indices in tree order
+  std::vector<Vec<T, N>> positions_;  // positions in tree order
+  std::vector<T> weights_;
+  std::vector<Node> nodes_;
+
+  /** @brief split a node into 2^N cubes (counting sort in place) */
+  template <class Particles>
+  void split(std::size_t index, const Particles& particles,
+             std::size_t depth) {
+    const Node node = nodes_[index];
+    if (node.last - node.first <= leaf_size_ || depth >= max_depth) return;
+
+    const std::size_t m = std::size_t(1) << N;
+    const T half = node.width / 2;
+    auto box = [&](std::size_t i) {
+      const auto& x = particles[i].position();
+      std::size_t b = 0;
+      for (std::size_t d = 0; d < N; d++) {
+        b |= std::size_t(x[d] >= node.lower[d] + half) << d;
+      }
+      return b;
+    };
+
+    std::vector<std::size_t> count(m + 1, 0), sorted(node.last - node.first);
+    for (auto l = node.first; l < node.last; l++) count[box(order_[l]) + 1]++;
+    for (std::size_t b = 0; b < m; b++) count[b + 1] += count[b];
+    for (auto l = node.first; l < node.last; l++) {
+      const auto i = order_[l];
+      sorted[count[box(i)]++] = i;
+    }
+    std::copy(sorted.begin(), sorted.end(), order_.begin() + node.first);
+
+    const std::size_t child = nodes_.size();
+    nodes_[index].child = child;
+    std::size_t first = node.first;
+    for (std::size_t b = 0; b < m; b++) {
+      Node c = Node();
+      for (std::size_t d = 0; d < N; d++) {
+        c.lower[d] = node.lower[d] + ((b >> d) & 1) * half;
+      }
+      c.width = half;
+      c.first = first;
+      c.last = node.first + count[b];
+      first = c.last;
+      nodes_.push_back(c);
+    }
+    for (std::size_t b = 0; b < m; b++) {
+      split(child + b, particles, depth + 1);
+    }
+  }
+
+  /** @brief total weight and center of a node (children come after it) */
+  void moments(std::size_t index) {
+    Node& node = nodes_[index];
+    Vec<T, N> center;
+    T weight = 0, magnitude = 0;
+    if (node.child == 0) {
+      for (auto l = node.first; l < node.last; l++) {
+        const T a = std::abs(weights_[l]);
+        for (std::size_t d = 0; d < N; d++) center[d] += a * positions_[l][d];
+        weight += weights_[l];
+        magnitude += a;
+      }
+    } else {
+      for (std::size_t b = 0; b < (std::size_t(1) << N); b++) {
+        const Node& c = nodes_[node.child + b];
+        for (std::size_t d = 0; d < N; d++) {
+          center[d] += c.magnitude * c.center[d];
+        }
+        weight += c.weight;
+        magnitude += c.magnitude;
+      }
+    }
+    if (magnitude > 0) {
+      center /= magnitude;
+    } else {
+      for (std::size_t d = 0; d < N; d++) {
+        center[d] = node.lower[d] + node.width / 2;
+      }
+    }
+    node.center = center;
+    node.weight = weight;
+    node.magnitude = magnitude;
+  }
+
+  /** @brief field at x of the particle at l in tree order */
+  template <class Kernel>
+  Vec<T, N> walk(const Vec<T, N>& x, std::size_t l, Kernel& kernel) const {
+    Vec<T, N> sum;
+    const T theta2 = theta_ * theta_;
+    std::size_t stack[max_depth * ((std::size_t(1) << N) - 1) + 1];
+    std::size_t top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+      const Node& node = nodes_[stack[--top]];
+      if (node.first == node.last) continue;
+      const bool inside = node.first <= l && l < node.last;
+      if (!inside &&
+          node.width * node.width < theta2 * x.squared_distance(node.center)) {
+        const Vec<T, N> r = x - node.center;
+        sum += kernel(r, node.weight);
+      } else if (node.child == 0) {
+        for (auto k = node.first; k < node.last; k++) {
+          if (k == l) continue;
+          const Vec<T, N> r = x - positions_[k];
+          sum += kernel(r, weights_[k]);
+        }
+      } else {
+        for (std::size_t b = 0; b < (std::size_t(1) << N); b++) {
+          stack[top++] = node.child + b;
+        }
+      }
+    }
+    return sum;
+  }
+};
+
+template <class T, std::size_t N>
+constexpr std::size_t BarnesHut<T, N>::max_depth;
+
+/** @brief kernel \f$1/r\f$ (Coulomb, gravity potential in 3d) */
+template <class T>
+struct InverseDistance {
+  template <std::size_t N>
+  T operator()(const Vec<T, N>& r) const { return T(1) / r.length(); }
+
+  /** @brief \f$K(s r) = \mathrm{scale}(s) K(r) + \mathrm{shift}(s)\f$ */
+  T scale(T s) const { return T(1) / s; }
+  T shift(T) const { return T(0); }
+};
+
+/** @brief kernel \f$\log r\f$ (Coulomb, gravity potential in 2d) */
+template <class T>
+struct Logarithm {
+  template <std::size_t N>
+  T operator()(const Vec<T, N>& r) const {
+    return std::log(r.squared_length()) / 2;
+  }
+
+  /** @brief \f$K(s r) = \mathrm{scale}(s) K(r) + \mathrm{shift}(s)\f$ */
+  T scale(T) const { return T(1); }
+  T shift(T s) const { return std::log(s); }
+};
+
+namespace internal {
+
+struct IsHomogeneousImpl {
+  template <class Kernel, class T>
+  static auto check(Kernel* k, T s) -> decltype(
+    T(k->scale(s)), T(k->shift(s)),
+    std::true_type());
+
+  template <class Kernel, class T>
+  static auto check(...) -> std::false_type;
+};
+
+/** @brief whether a kernel declares scale(s) and shift(s) */
+template <class Kernel, class T>
+struct IsHomogeneous
+    : public decltype(IsHomogeneousImpl::check<Kernel, T>(nullptr, T())) {};
+
+}  // namespace internal
+
+/**
+ * @brief fast multipole method for potentials of a smooth kernel
+ *
+ * Black-box FMM (W. Fong and E. Darve, J. Comput. Phys. 228 (2009)): the
+ * kernel is interpolated on \f$p^N\f$ Chebyshev nodes of each box, so any
+ * kernel smooth away from 0 works, e.g. InverseDistance or Logarithm. The
+ * error decreases exponentially with the order p.
+ *
+ * The tree is adaptive: boxes with more than leaf_size particles are split
+ * into 2^N cubes, and empty cubes are dropped. Interaction lists come from
+ * a dual traversal of the tree, where two boxes with
+ * \f$\sqrt{N} (h_A + h_B) < \theta |c_A - c_B|\f$ (h half widths, c
+ * centers) interact through their expansions (M2L), and close leaves
+ * interact directly. For boxes of the same size, \f$\theta = 1\f$ is the
+ * classic interaction list (boxes at least one box apart, at most
+ * \f$7^N - 3^N\f$ per box), and a smaller \f$\theta\f$ is more accurate
+ * at the same order but has many more M2L pairs. Passes over a level of
+ * the tree, M2L and the leaves run in parallel. Evaluation costs
+ * \f$O(n)\f$.
+ *
+ * The kernel is translation invariant and boxes of a level are on a grid,
+ * so an M2L operator (the \f$p^N \times p^N\f$ matrix of the kernel
+ * between the nodes of two boxes) depends only on the levels of the boxes
+ * and their offset. Each distinct operator is computed once, when the
+ * order or the tree changes, and applied to all of its pairs while it is in
+ * cache. Operators take \f$p^{2N}\f$ values each (370 kB for p = 6 in
+ * 3d). Radial kernels with
+ * \f$K(s r) = \mathrm{scale}(s) K(r) + \mathrm{shift}(s)\f$, such as
+ * InverseDistance and Logarithm, declare scale and shift: then an operator
+ * depends only on the difference of the levels and on the offset up to
+ * reflections and permutations of the axes, and is scaled when applied.
+ * The number of operators does not grow with n or the depth (for uniform
+ * particles in 3d, 21 at \f$\theta = 1\f$, 8 MB with p = 6, and 79 at
+ * \f$\theta = 0.5\f$). For other kernels it grows with the depth of the
+ * tree, by a few hundred per level in 3d at \f$\theta = 1\f$. M2M and L2L
+ * use the same \f$2^N\f$ matrices at all levels.
+ *
+ * M2L costs \f$p^{2N}\f$ per pair, which dominates in 3d: 10^5 uniform
+ * particles take about 1.2 s per evaluation with p = 4 and 6 s with p = 6
+ * on one core at \f$\theta = 1\f$ (relative errors 1e-3 and 7e-5), against
+ * about 40 s for the direct sum. Operators are not compressed (e.g. by SVD
+ * as in the paper).
+ *
+ * @code
+ * longrange::FMM<double, 3, longrange::InverseDistance<double>> fmm(6);
+ * fmm.build(particles, charges);
+ * std::vector<double> potential;
+ * fmm.evaluate(potential);  // potential[i] = sum of charges[j] / r_ij
+ * @endcode
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ * @tparam Kernel kernel(r) returns the potential at r of a unit weight, and
+ *         may declare scale(s) and shift(s) (see above)
+ */
+template <class T, std::size_t N, class Kernel>
+class FMM {
+ public:
+  /**
+   * @param order number of Chebyshev nodes per dimension in each box
+   * @param theta boxes are well separated below this ratio
+   * @param leaf_size boxes with more particles are split
+   */
+  explicit FMM(std::size_t order = 4, T theta = T(1),
+               std::size_t leaf_size = 128, Kernel kernel = Kernel())
+      : chebyshev_(order), theta_(theta),
+        leaf_size_(std::max<std::size_t>(leaf_size, 1)), kernel_(kernel),
+        order_(), positions_(), weights_(), nodes_(), levels_(), leaves_(),
+        m2l_(), batches_(), p2p_(), keys_(), factors_(), operators_(),
+        symmetries_(), transfers_(), operators_order_(0), multipoles_(),
+        locals_() {}
+
+  /** @brief order of expansions, effective at the next evaluate */
+  void set_order(std::size_t order) { chebyshev_.set_order(order); }
+  std::size_t order() const { return chebyshev_.order(); }
+
+  /** @brief separation of boxes, effective at the next build */
+  void set_theta(T theta) { theta_ = theta; }
+
+  /** @brief number of boxes of the tree */
+  std::size_t num_nodes() const { return nodes_.size(); }
+
+  /** @brief number of distinct M2L operators of the tree */
+  std::size_t num_operators() const { return keys_.size(); }
+
+  /**
+   * @brief call f(target center, half width, source center, half width) for
+   *        the boxes of each M2L pair, e.g. to inspect interaction lists
+   */
+  template <class Function>
+  void for_each_m2l(Function f) const {
+    for (std::size_t t = 0; t < nodes_.size(); t++) {
+      for (auto s : m2l_[t]) {
+        f(nodes_[t].center, nodes_[t].half, nodes_[s].center, nodes_[s].half);
+      }
+    }
+  }
+
+  /** @brief build the tree with unit weights */
+  template <class I>
+  void build(const std::vector<Particle<T, N, I>>& particles) {
+    build(particles, std::vector<T>(particles.size(), T(1)));
+  }
+
+  /** @param weights weights (charges, masses) parallel to particles */
+  template <class I>
+  void build(const std::vector<Particle<T, N, I>>& particles,
+             const std::vector<T>& weights) {
+    PARTICLES_TIME("longrange.fmm.build");
+    const std::size_t n = particles.size();
+    order_.resize(n);
+    for (std::size_t i = 0; i < n; i++) order_[i] = i;
+    nodes_.clear();
+    levels_.clear();
+    leaves_.clear();
+    positions_.clear();
+    weights_.clear();
+    if (n == 0) return;
+
+    Vec<T, N> lower = particles[0].position(), upper = lower;
+    for (const auto& p : particles) {
+      for (std::size_t d = 0; d < N; d++) {
+        lower[d] = std::min(lower[d], p.position()[d]);
+        upper[d] = std::max(upper[d], p.position()[d]);
+      }
+    }
+    Node root = Node();
+    T half = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      root.center[d] = (lower[d] + upper[d]) / 2;
+      half = std::max(half, (upper[d] - lower[d]) / 2);
+    }
+    // slightly larger, so that no particle is on the boundary
+    root.half = half > 0 ? half * (1 + 8 * std::numeric_limits<T>::epsilon())
+                         : T(1);
+    root.first = 0;
+    root.last = n;
+    nodes_.push_back(root);
+    split(0, particles);
+
+    positions_.resize(n);
+    weights_.resize(n);
+    for (std::size_t l = 0; l < n; l++) {
+      positions_[l] = particles[order_[l]].position();
+      weights_[l] = weights[order_[l]];
+    }
+
+    m2l_.assign(nodes_.size(), std::vector<std::size_t>());
+    p2p_.assign(nodes_.size(), std::vector<std::size_t>());
+    interact(0, 0);
+    find_operators();
+  }
+
+  /**
+   * @brief potentials at the particles given to build
+   * @param potential potential[i] is the sum of w_j kernel(x_i - x_j) over
+   *        particles j at other positions than x_i (the kernel is singular
+   *        at 0, so coincident particles do not interact)
+   */
+  void evaluate(std::vector<T>& potential) {
+    const std::size_t n = order_.size();
+    potential.assign(n, T(0));
+    if (n == 0) return;
+    const std::size_t m = chebyshev_.size();
+    multipoles_.assign(nodes_.size() * m, T(0));
+    locals_.assign(nodes_.size() * m, T(0));
+    if (operators_order_ != chebyshev_.order()) compute_operators();
+
+    // upward pass (P2M, M2M) from the deepest level
+    {
+      PARTICLES_TIME("longrange.fmm.upward");
+      for (std::size_t level = levels_.size(); level-- > 0;) {
+        const auto& nodes = levels_[level];
+        parallel::for_each(nodes.size(), [&](std::size_t k) {
+          upward(nodes[k]);
+        }, 16);
+      }
+    }
+
+    // M2L: each box gathers from its list
+    {
+      PARTICLES_TIME("longrange.fmm.m2l");
+      parallel::for_each_block(nodes_.size(), [&](std::size_t first,
+                                                   std::size_t last,
+                                                   std::size_t) {
+        std::vector<T> buffer;
+        for (std::size_t k = 0; k < batches_.size(); k++) {
+          m2l(k, first, last, buffer);
+        }
+      }, 1);
+    }
+
+    // downward pass (L2L) from the root
+    {
+      PARTICLES_TIME("longrange.fmm.downward");
+      for (std::size_t level = 0; level < levels_.size(); level++) {
+        const auto& nodes = levels_[level];
+        parallel::for_each(nodes.size(), [&](std::size_t k) {
+          downward(nodes[k]);
+        }, 16);
+      }
+    }
+
+    // L2P and P2P at leaves
+    PARTICLES_TIME("longrange.fmm.near");
+    parallel::for_each(leaves_.size(), [&](std::size_t k) {
+      const Node& leaf = nodes_[leaves_[k]];
+      std::vector<T> s(m);
+      const T* local = &locals_[leaves_[k] * m];
+      for (auto l = leaf.first; l < leaf.last; l++) {
+        const auto& x = positions_[l];
+        chebyshev_.weights(relative(x, leaf), s.data());
+        T phi = 0;
+        for (std::size_t a = 0; a < m; a++) phi += s[a] * local[a];
+        for (auto source : p2p_[leaves_[k]]) {
+          const Node& node = nodes_[source];
+          for (auto j = node.first; j < node.last; j++) {
+            const Vec<T, N> r = x - positions_[j];
+            if (r.squared_length() == 0) continue;  // itself or coincident
+            phi += weights_[j] * kernel_(r);
+          }
+        }
+        potential[order_[l]] = phi;
+      }
+    }, 1);
+  }
+
+ private:
+  struct Node {
+    Vec<T, N> center;
+    T half;                // half width of the cube
+    std::size_t first;     // range in order_
+    std::size_t last;
+    std::size_t child;     // first child
+    std::size_t children;  // number of (nonempty) children, 0 for a leaf
+    std::size_t level;     // depth in the tree
+  };
+
+  /**
+   * @brief levels of target and source and offset in the finer width, or
+   *        for homogeneous kernels the difference of the levels, 0 and the
+   *        sorted absolute offset
+   */
+  typedef std::array<std::int64_t, N + 2> Key;
+
+  /** @brief M2L pair and how the operator of its batch applies to it */
+  struct Interaction {
+    std::size_t target;
+    std::size_t source;
+    std::size_t symmetry;  // of nodes of the operator to nodes of the boxes
+    std::size_t level;     // of the smaller box, for scale and shift
+  };
+
+  static constexpr bool homogeneous = internal::IsHomogeneous<Kernel, T>::value;
+
+  /** @brief splits stop here, e.g. for particles at the same position */
+  static constexpr std::size_t max_depth = 32;
+
+  internal::Chebyshev<T, N> chebyshev_;
+  T theta_;
+  std::size_t leaf_size_;
+  Kernel kernel_;
+  std::vector<std::size_t> order_;    // particle indices in tree order
+  std::vector<Vec<T, N>> positions_;  // positions in tree order
+  std::vector<T> weights_;
+  std::vector<Node> nodes_;
+  std::vector<std::vector<std::size_t>> levels_;  // boxes at each depth
+  std::vector<std::size_t> leaves_;
+  std::vector<std::vector<std::size_t>> m2l_;  // well separated sources
+  // pairs of each M2L operator, ordered by target
+  std::vector<std::vector<Interaction>> batches_;
+  std::vector<std::vector<std::size_t>> p2p_;  // adjacent source leaves
+  std::vector<Key> keys_;          // of each M2L operator
+  std::vector<std::pair<T, T>> factors_;  // scale and shift at each level
+  std::vector<T> operators_;       // m x m matrices, row a for target node a
+  std::vector<std::size_t> symmetries_;  // node index maps, m per symmetry
+  std::vector<T> transfers_;       // m x m matrices, row b for child node b
+  std::size_t operators_order_;    // order of operators_, 0 for none
+  std::vector<T> multipoles_;  // weights at Chebyshev nodes of each box
+  std::vector<T> locals_;      // potentials at Chebyshev nodes of each box
+
+  template <class Particles>
+  void split(std::size_t index, const Particles& particles,
+             std::size_t depth = 0) {
+    if (levels_.size() <= depth) levels_.resize(depth + 1);
+    levels_[depth].push_back(index);
+    const Node node = nodes_[index];
+    if (node.last - node.first <= leaf_size_ || depth >= max_depth) {
+      leaves_.push_back(index);
+      return;
+    }
+
+    const std::size_t m = std::size_t(1) << N;
+    auto box = [&](std::size_t i) {
+      const auto& x = particles[i].position();
+      std::size_t b = 0;
+      for (std::size_t d = 0; d < N; d++) {
+        b |= std::size_t(x[d] >= node.center[d]) << d;
+      }
+      return b;
+    };
+    std::vector<std::size_t> count(m + 1, 0), sorted(node.last - node.first);
+    for (auto l = node.first; l < node.last; l++) count[box(order_[l]) + 1]++;
+    for (std::size_t b = 0; b < m; b++) count[b + 1] += count[b];
+    for (auto l = node.first; l < node.last; l++) {
+      const auto i = order_[l];
+      sorted[count[box(i)]++] = i;
+    }
+    std::copy(sorted.begin(), sorted.end(), order_.begin() + node.first);
+
+    const std::size_t child = nodes_.size();
+    std::size_t first = node.first;
+    for (std::size_t b = 0; b < m; b++) {
+      const std::size_t last = node.first + count[b];
+      if (first == last) continue;
+      Node c = Node();
+      c.half = node.half / 2;
+      c.level = depth + 1;
+      for (std::size_t d = 0; d < N; d++) {
+        c.center[d] = node.center[d] + ((b >> d) & 1 ? c.half : -c.half);
+      }
+      c.first = first;
+      c.last = last;
+      nodes_.push_back(c);
+      first = last;
+    }
+    const std::size_t children = nodes_.size() - child;
+    nodes_[index].child = child;
+    nodes_[index].children = children;
+    for (auto c = child; c < child + children; c++) {
+      split(c, particles, depth + 1);
+    }
+  }
+
+  /**
+   * @brief whether two boxes interact through their expansions
+   *
+   * Boxes are on grids, so boxes sharing a face, an edge or a corner have no
+   * gap in any dimension, while other boxes are at least the width of the
+   * smaller one apart in some dimension. Touching boxes are never separated;
+   * at theta = 1 the distance criterion alone would leave corners to
+   * rounding.
+   */
+  bool separated(const Node& a, const Node& b) const {
+    T gap = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      gap = std::max(gap, std::abs(a.center[d] - b.center[d]) -
+                              (a.half + b.half));
+    }
+    if (gap < std::min(a.half, b.half)) return false;
+    const T size = std::sqrt(T(N)) * (a.half + b.half);
+    return size * size < theta_ * theta_ * a.center.squared_distance(b.center);
+  }
+
+  /** @brief dual traversal to make interaction lists */
+  void interact(std::size_t a, std::size_t b) {
+    const Node& na = nodes_[a];
+    const Node& nb = nodes_[b];
+    if (a == b) {
+      if (na.children == 0) {
+        p2p_[a].push_back(a);
+        return;
+      }
+      for (auto i = na.child; i < na.child + na.children; i++) {
+        for (auto j = i; j < na.child + na.children; j++) interact(i, j);
+      }
+      return;
+    }
+    if (separated(na, nb)) {
+      m2l_[a].push_back(b);
+      m2l_[b].push_back(a);
+    } else if (na.children == 0 && nb.children == 0) {
+      p2p_[a].push_back(b);
+      p2p_[b].push_back(a);
+    } else if (nb.children == 0 ||
+               (na.children > 0 && na.half >= nb.half)) {
+      for (auto i = na.child; i < na.child + na.children; i++) interact(i, b);
+    } else {
+      for (auto j = nb.child; j < nb.child + nb.children; j++) interact(a, j);
+    }
+  }
+
+  /** @brief half width of boxes at a level */
+  T level_half(std::int64_t level) const {
+    return std::ldexp(nodes_[0].half, -static_cast<int>(level));
+  }
+
+  /**
+   * @brief M2L of k-th operator to targets in [first, last)
+   *
+   * Pairs are taken in groups, and each row of the operator is applied to
+   * all pairs of a group while it is in cache. Multipoles of a group are
+   * gathered in the order of the nodes of the operator, and the results are
+   * scaled and scattered back to the nodes of the targets.
+   *
+   * @param buffer scratch of the calling thread
+   */
+  void m2l(std::size_t k, std::size_t first, std::size_t last,
+           std::vector<T>& buffer) {
+    const std::size_t m = chebyshev_.size();
+    const std::size_t group = 32;
+    const auto& pairs = batches_[k];
+    auto before = [](const Interaction& pair, std::size_t target) {
+      return pair.target < target;
+    };
+    auto begin = std::lower_bound(pairs.begin(), pairs.end(), first, before);
+    const auto end = std::lower_bound(begin, pairs.end(), last, before);
+    buffer.resize(2 * group * m);
+    T* in = buffer.data();
+    T* out = in + group * m;
+    while (begin < end) {
+      const std::size_t g = std::min<std::size_t>(group, end - begin);
+      for (std::size_t i = 0; i < g; i++) {
+        const std::size_t* map = &symmetries_[begin[i].symmetry * m];
+        const T* multipole = &multipoles_[begin[i].source * m];
+        for (std::size_t b = 0; b < m; b++) in[i * m + b] = multipole[map[b]];
+      }
+      const T* op = &operators_[k * m * m];
+      for (std::size_t a = 0; a < m; a++, op += m) {
+        for (std::size_t i = 0; i < g; i++) {
+          const T* multipole = &in[i * m];
+          // independent sums, see range::internal::pairwise_sum
+          T s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+          std::size_t b = 0;
+          for (; b + 4 <= m; b += 4) {
+            s0 += op[b] * multipole[b];
+            s1 += op[b + 1] * multipole[b + 1];
+            s2 += op[b + 2] * multipole[b + 2];
+            s3 += op[b + 3] * multipole[b + 3];
+          }
+          for (; b < m; b++) s0 += op[b] * multipole[b];
+          out[i * m + a] = (s0 + s1) + (s2 + s3);
+        }
+      }
+      for (std::size_t i = 0; i < g; i++) {
+        const std::size_t* map = &symmetries_[begin[i].symmetry * m];
+        const auto& factor = factors_[begin[i].level];
+        T weight = 0;  // the shift applies to the total weight of the source
+        if (factor.second != 0) {
+          for (std::size_t b = 0; b < m; b++) weight += in[i * m + b];
+        }
+        T* local = &locals_[begin[i].target * m];
+        for (std::size_t a = 0; a < m; a++) {
+          local[map[a]] += factor.first * out[i * m + a] +
+                           factor.second * weight;
+        }
+      }
+      begin += g;
+    }
+  }
+
+  /** @brief permutations of the axes in lexicographic order */
+  static std::vector<std::array<std::size_t, N>> permutations() {
+    std::array<std::size_t, N> axes;
+    for (std::size_t d = 0; d < N; d++) axes[d] = d;
+    std::vector<std::array<std::size_t, N>> result;
+    do {
+      result.push_back(axes);
+    } while (std::next_permutation(axes.begin(), axes.end()));
+    return result;
+  }
+
+  /**
+   * @brief M2L operator of each pair in m2l_, by levels and offset
+   *
+   * For homogeneous kernels, offsets are brought to the canonical one with
+   * nonnegative, ascending coordinates by reflections and a permutation of
+   * the axes (the symmetry of the pair), and the levels to their
+   * difference.
+   */
+  void find_operators() {
+    const auto axes_of = permutations();
+    std::map<Key, std::size_t> index;
+    keys_.clear();
+    batches_.clear();
+    for (std::size_t t = 0; t < nodes_.size(); t++) {
+      const Node& target = nodes_[t];
+      for (auto s : m2l_[t]) {
+        const Node& source = nodes_[s];
+        const T h = std::min(target.half, source.half);
+        std::array<std::int64_t, N> offset;
+        for (std::size_t d = 0; d < N; d++) {
+          offset[d] = std::llround((target.center[d] - source.center[d]) / h);
+        }
+        Interaction pair;
+        pair.target = t;
+        pair.source = s;
+        pair.symmetry = 0;
+        pair.level = std::max(target.level, source.level);
+        Key key;
+        if (homogeneous) {
+          std::size_t flips = 0;
+          for (std::size_t d = 0; d < N; d++) {
+            flips |= std::size_t(offset[d] < 0) << d;
+            offset[d] = std::abs(offset[d]);
+          }
+          std::array<std::size_t, N> axes = axes_of[0];
+          std::stable_sort(axes.begin(), axes.end(),
+                           [&offset](std::size_t i, std::size_t j) {
+            return offset[i] < offset[j];
+          });
+          const auto permutation =
+              std::find(axes_of.begin(), axes_of.end(), axes) -
+              axes_of.begin();
+          pair.symmetry = (permutation << N) | flips;
+          key[0] = std::int64_t(target.level) - std::int64_t(source.level);
+          key[1] = 0;
+          for (std::size_t k = 0; k < N; k++) key[k + 2] = offset[axes[k]];
+        } else {
+          key[0] = target.level;
+          key[1] = source.level;
+          for (std::size_t d = 0; d < N; d++) key[d + 2] = offset[d];
+        }
+        auto found = index.emplace(key, keys_.size());
+        if (found.second) {
+          keys_.push_back(key);
+          batches_.emplace_back();
+        }
+        batches_[found.first->second].push_back(pair);
+      }
+    }
+
+    factors_.resize(levels_.size());
+    for (std::size_t level = 0; level < levels_.size(); level++) {
+      factors_[level] = scale_and_shift(level_half(level));
+    }
+    operators_order_ = 0;
+  }
+
+  /** @brief K(h r) = scale K(r) + shift of homogeneous kernels */
+  template <bool Homogeneous = homogeneous>
+  typename std::enable_if<Homogeneous, std::pair<T, T>>::type
+  scale_and_shift(T h) const {
+    return std::make_pair(T(kernel_.scale(h)), T(kernel_.shift(h)));
+  }
+
+  template <bool Homogeneous = homogeneous>
+  typename std::enable_if<!Homogeneous, std::pair<T, T>>::type
+  scale_and_shift(T) const {
+    return std::make_pair(T(1), T(0));
+  }
+
+  /**
+   * @brief kernel between Chebyshev nodes for each key, maps of nodes for
+   *        each symmetry, and interpolation between a box and its children
+   *        (M2M, L2L)
+   */
+  void compute_operators() {
+    PARTICLES_TIME("longrange.fmm.operators");
+    const std::size_t m = chebyshev_.size();
+    const std::size_t p = chebyshev_.order();
+    // S(u_a, x_b) at node x_b of a child in the coordinates of its parent,
+    // the same at every level
+    transfers_.resize((std::size_t(1) << N) * m * m);
+    for (std::size_t c = 0; c < (std::size_t(1) << N); c++) {
+      Vec<T, N> center;
+      for (std::size_t d = 0; d < N; d++) {
+        center[d] = (c >> d) & 1 ? T(0.5) : T(-0.5);
+      }
+      for (std::size_t b = 0; b < m; b++) {
+        chebyshev_.weights(chebyshev_.node(b, center, T(0.5)),
+                           &transfers_[(c * m + b) * m]);
+      }
+    }
+
+    // node of a box for each node of the operator: axis k of the operator
+    // is axis axes[k] of the boxes, reflected if its flip is set (the roots
+    // are symmetric, root p - 1 - i = -root i)
+    const auto axes_of = permutations();
+    const std::size_t flips = homogeneous ? std::size_t(1) << N : 1;
+    const std::size_t count = homogeneous ? axes_of.size() * flips : 1;
+    symmetries_.resize(count * m);
+    for (std::size_t symmetry = 0; symmetry < count; symmetry++) {
+      const auto& axes = axes_of[symmetry / flips];
+      for (std::size_t a = 0; a < m; a++) {
+        std::size_t digits = a, node = 0;
+        for (std::size_t k = 0; k < N; k++) {
+          std::size_t i = digits % p;
+          digits /= p;
+          if ((symmetry >> axes[k]) & 1 && homogeneous) i = p - 1 - i;
+          std::size_t stride = 1;
+          for (std::size_t d = 0; d < axes[k]; d++) stride *= p;
+          node += i * stride;
+        }
+        symmetries_[symmetry * m + a] = node;
+      }
+    }
+
+    operators_.resize(keys_.size() * m * m);
+    parallel::for_each(keys_.size(), [&](std::size_t k) {
+      const auto& key = keys_[k];
+      // homogeneous kernels: the smaller box has half width 1
+      T ht, hs;
+      if (homogeneous) {
+        ht = std::ldexp(T(1), static_cast<int>(std::max<std::int64_t>(
+                                  -key[0], 0)));
+        hs = std::ldexp(T(1), static_cast<int>(std::max<std::int64_t>(
+                                  key[0], 0)));
+      } else {
+        ht = level_half(key[0]);
+        hs = level_half(key[1]);
+      }
+      Vec<T, N> offset;
+      for (std::size_t d = 0; d < N; d++) {
+        offset[d] = key[d + 2] * std::min(ht, hs);
+      }
+      const Vec<T, N> zero = Vec<T, N>();
+      T* op = &operators_[k * m * m];
+      for (std::size_t a = 0; a < m; a++) {
+        const auto x = chebyshev_.node(a, offset, ht);
+        for (std::size_t b = 0; b < m; b++) {
+          const Vec<T, N> r = x - chebyshev_.node(b, zero, hs);
+          op[a * m + b] = kernel_(r);
+        }
+      }
+    }, 1);
+    operators_order_ = chebyshev_.order();
+  }
+
+  /** @brief x in the coordinates of a box, [-1, 1]^N */
+  Vec<T, N> relative(const Vec<T, N>& x, const Node& node) const {
+    Vec<T, N> u;
+    for (std::size_t d = 0; d < N; d++) {
+      u[d] = (x[d] - node.center[d]) / node.half;
+    }
+    return u;
+  }
+
+  /** @brief which of the 2^N cubes of its parent the child is */
+  std::size_t orthant(const Node& child, const Node& parent) const {
+    std::size_t b = 0;
+    for (std::size_t d = 0; d < N; d++) {
+      b |= std::size_t(child.center[d] > parent.center[d]) << d;
+    }
+    return b;
+  }
+
+  /** @brief P2M at a leaf, M2M otherwise */
+  void upward(std::size_t index) {
+    const Node& node = nodes_[index];
+    const std::size_t m = chebyshev_.size();
+    T* multipole = &multipoles_[index * m];
+    if (node.children == 0) {
+      std::vector<T> s(m);
+      for (auto l = node.first; l < node.last; l++) {
+        chebyshev_.weights(relative(positions_[l], node), s.data());
+        for (std::size_t a = 0; a < m; a++) multipole[a] += weights_[l] * s[a];
+      }
+      return;
+    }
+    for (auto c = node.child; c < node.child + node.children; c++) {
+      const T* child = &multipoles_[c * m];
+      const T* s = &transfers_[orthant(nodes_[c], node) * m * m];
+      for (std::size_t b = 0; b < m; b++, s += m) {
+        for (std::size_t a = 0; a < m; a++) multipole[a] += child[b] * s[a];
+      }
+    }
+  }
+
+  /** @brief L2L to children */
+  void downward(std::size_t index) {
+    const Node& node = nodes_[index];
+    const std::size_t m = chebyshev_.size();
+    const T* local = &locals_[index * m];
+    for (auto c = node.child; c < node.child + node.children; c++) {
+      T* child = &locals_[c * m];
+      const T* s = &transfers_[orthant(nodes_[c], node) * m * m];
+      for (std::size_t b = 0; b < m; b++, s += m) {
+        T sum = 0;
+        for (std::size_t a = 0; a < m; a++) sum += s[a] * local[a];
+        child[b] += sum;
+      }
+    }
+  }
+};
+
+template <class T, std::size_t N, class Kernel>
+constexpr std::size_t FMM<T, N, Kernel>::max_depth;
+
+template <class T, std::size_t N, class Kernel>
+constexpr bool FMM<T, N, Kernel>::homogeneous;
+
+}  // namespace longrange
+}  // namespace particles
@@ -0,0 +1,158 @@
+/**
+ * @file numa.hpp
+ *
+ * @brief placement of arrays on NUMA nodes
+ *
+ * Pages of an array live on the node of the thread which touched them
+ * first. Arrays filled in parallel loops with parallel::set_affinity(true)
+ * (e.g. rows of adjacency lists made by searchers) are already local to the
+ * threads using them. Arrays filled by a single thread (e.g. particles read
+ * from a file) can be moved afterwards with distribute.
+ *
+ * @code
+ * parallel::set_affinity(true);
+ * io::FrameReader<double, 3> reader(fin);
+ * std::vector<Particle<double, 3>> particles = *reader.begin();
+ * numa::distribute(particles);
+ * @endcode
+ *
+ * On a single node, or where moving pages is not supported, nothing is done.
+ */
+
+#pragma once
+
+#include "parallel.hpp"
+#include "details/topology.hpp"
+
+#include <cstdint>
+#include <vector>
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace particles {
+namespace numa {
+
+/** @brief number of NUMA nodes with usable CPUs */
+inline std::size_t num_nodes() { return topology().num_nodes(); }
+
+/** @brief node on which b-th block out of blocks runs with affinity */
+inline std::size_t block_node(std::size_t b, std::size_t blocks) {
+  return topology().node(parallel::block_cpu(b, blocks));
+}
+
+namespace internal {
+
+inline std::uintptr_t page_size() {
+#if defined(__linux__)
+  const long size = sysconf(_SC_PAGESIZE);
+  return size > 0 ? static_cast<std::uintptr_t>(size) : 4096;
+#else
+  return 4096;
+#endif
+}
+
+/** @brief pages covering [first, last) */
+template <class T>
+void append_pages(const T* first, const T* last, int node,
+                  std::vector<void*>& pages, std::vector<int>& nodes) {
+  if (first == last) return;
+  const auto page = page_size();
+  const auto begin = reinterpret_cast<std::uintptr_t>(first) & ~(page - 1);
+  const auto end = reinterpret_cast<std::uintptr_t>(last);
+  for (auto a = begin; a < end; a += page) {
+    // a page shared with the previous block stays with it
+    if (!pages.empty() && pages.back() == reinterpret_cast<void*>(a)) continue;
+    pages.push_back(reinterpret_cast<void*>(a));
+    nodes.push_back(node);
+  }
+}
+
+/** @brief move_pages(2) without libnuma, returns pages on their nodes */
+inline std::size_t move_pages(std::vector<void*>& pages,
+                              std::vector<int>& nodes) {
+#if defined(__linux__) && defined(SYS_move_pages)
+  if (pages.empty()) return 0;
+  const int mpol_mf_move = 1 << 1;  // MPOL_MF_MOVE in <linux/mempolicy.h>
+  std::vector<int> status(pages.size(), -1);
+  if (syscall(SYS_move_pages, 0, pages.size(), pages.data(), nodes.data(),
+              status.data(), mpol_mf_move) < 0) {
+    return 0;
+  }
+  std::size_t moved = 0;
+  for (std::size_t k = 0; k < pages.size(); k++) {
+    if (status[k] == nodes[k]) moved++;
+  }
+  return moved;
+#else
+  (void)pages;
+  (void)nodes;
+  return 0;
+#endif
+}
+
+/** @brief pages of v with nodes of the blocks of parallel loops over v */
+template <class T, class Allocator>
+void block_pages(const std::vector<T, Allocator>& v, std::size_t grain,
+                 std::vector<void*>& pages, std::vector<int>& nodes) {
+  const std::size_t n = v.size();
+  const auto blocks = parallel::num_blocks(n, grain);
+  for (std::size_t b = 0; b < blocks; b++) {
+    const int node = static_cast<int>(
+        topology().physical_node(block_node(b, blocks)));
+    append_pages(v.data() + parallel::block_begin(n, b, blocks),
+                 v.data() + parallel::block_begin(n, b + 1, blocks), node,
+                 pages, nodes);
+  }
+}
+
+}  // namespace internal
+
+/**
+ * @brief move pages of an array to the nodes of the blocks processing them
+ *
+ * Blocks are those of parallel loops over the array with the grain.
+ *
+ * @return number of pages placed on their nodes
+ */
+template <class T, class Allocator>
+std::size_t distribute(const std::vector<T, Allocator>& v,
+                       std::size_t grain = 1024) {
+  if (num_nodes() < 2 || v.empty()) return 0;
+  std::vector<void*> pages;
+  std::vector<int> nodes;
+  internal::block_pages(v, grain, pages, nodes);
+  return internal::move_pages(pages, nodes);
+}
+
+/** @brief move rows (e.g. AdjacencyList::rows()) to nodes of their blocks */
+template <class T, class Allocator, class RowAllocator>
+std::size_t distribute(
+    const std::vector<std::vector<T, RowAllocator>, Allocator>& rows,
+    std::size_t grain = 1024) {
+  if (num_nodes() < 2 || rows.empty()) return 0;
+  std::vector<void*> pages;
+  std::vector<int> nodes;
+  internal::block_pages(rows, grain, pages, nodes);
+  std::size_t moved = internal::move_pages(pages, nodes);
+
+  pages.clear();
+  nodes.clear();
+  const std::size_t n = rows.size();
+  const auto blocks = parallel::num_blocks(n, grain);
+  for (std::size_t b = 0; b < blocks; b++) {
+    const int node = static_cast<int>(
+        topology().physical_node(block_node(b, blocks)));
+    const auto last = parallel::block_begin(n, b + 1, blocks);
+    for (auto i = parallel::block_begin(n, b, blocks); i < last; i++) {
+      internal::append_pages(rows[i].data(), rows[i].data() + rows[i].size(),
+                             node, pages, nodes);
+    }
+  }
+  return moved + internal::move_pages(pages, nodes);
+}
+
+}  // namespace numa
+}  // namespace particles
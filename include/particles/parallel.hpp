@@ -0,0 +1,266 @@
+/**
+ * @file parallel.hpp
+ *
+ * @brief simple fork-join loops over index ranges using std::thread
+ */
+
+#pragma once
+
+#include "instrument.hpp"
+#include "details/topology.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
+namespace particles {
+namespace parallel {
+namespace internal {
+
+inline std::size_t& num_threads_storage() {
+  static std::size_t n =
+      std::max<std::size_t>(1, std::thread::hardware_concurrency());
+  return n;
+}
+
+inline bool& affinity_storage() {
+  static bool pin = false;
+  return pin;
+}
+
+/** @brief f(first, last, b) timed (and traced) as a block */
+template <class Function>
+void run_block(Function& f, std::size_t first, std::size_t last,
+               std::size_t b) {
+  PARTICLES_TIME("parallel.block");
+  f(first, last, b);
+}
+
+/** @brief prefix[i]: total cost before i, at least 1 for each index */
+template <class Cost>
+void cost_prefix(std::size_t n, Cost& cost, std::vector<std::size_t>& prefix) {
+  prefix.assign(n + 1, 0);
+  for (std::size_t i = 0; i < n; i++) {
+    prefix[i + 1] = prefix[i] + std::max<std::size_t>(cost(i), 1);
+  }
+}
+
+/**
+ * @brief bounds of chunks of about the same total cost
+ *
+ * Chunk c is [bounds[c], bounds[c + 1]) and begins at the i where the cost
+ * before i is nearest to c / chunks of the total.
+ */
+inline std::vector<std::size_t> cost_bounds(
+    const std::vector<std::size_t>& prefix, std::size_t chunks) {
+  const auto n = prefix.size() - 1;
+  std::vector<std::size_t> bounds(chunks + 1, n);
+  bounds[0] = 0;
+  for (std::size_t c = 1; c < chunks; c++) {
+    const auto target = prefix[n] * c / chunks;
+    auto k = static_cast<std::size_t>(
+        std::lower_bound(prefix.begin(), prefix.end(), target) -
+        prefix.begin());
+    if (k > 0 && target - prefix[k - 1] < prefix[k] - target) k--;
+    bounds[c] = std::max(k, bounds[c - 1]);
+  }
+  return bounds;
+}
+
+}  // namespace internal
+
+/** @brief number of threads used by parallel loops */
+inline std::size_t num_threads() { return internal::num_threads_storage(); }
+
+/**
+ * @brief set number of threads used by parallel loops
+ * @param n 0 means number of hardware threads
+ */
+inline void set_num_threads(std::size_t n) {
+  internal::num_threads_storage() =
+      n > 0 ? n : std::max<std::size_t>(1, std::thread::hardware_concurrency());
+}
+
+/**
+ * @brief number of blocks for_each_block splits [0, n) into
+ * @param grain minimum size of a block
+ */
+inline std::size_t num_blocks(std::size_t n, std::size_t grain = 1024) {
+  grain = std::max<std::size_t>(grain, 1);
+  return std::max<std::size_t>(
+      1, std::min(num_threads(), (n + grain - 1) / grain));
+}
+
+/** @brief first index of b-th block out of blocks */
+inline std::size_t block_begin(std::size_t n, std::size_t b,
+                               std::size_t blocks) {
+  return n * b / blocks;
+}
+
+/**
+ * @brief pin threads of parallel loops to CPUs
+ *
+ * Block b of B runs on the CPU at b / B of numa::topology().cpus(), which
+ * are ordered by NUMA node. So the same part of an array is processed on
+ * the same node in every loop, and pages first touched (or placed by
+ * numa::distribute) there stay local. Threads are not pinned where it is
+ * not supported.
+ */
+inline void set_affinity(bool pin) { internal::affinity_storage() = pin; }
+
+/** @brief whether threads of parallel loops are pinned */
+inline bool affinity() { return internal::affinity_storage(); }
+
+/** @brief index in numa::topology().cpus() of b-th block out of blocks */
+inline std::size_t block_cpu(std::size_t b, std::size_t blocks) {
+  return b * numa::topology().cpus().size() / blocks;
+}
+
+/**
+ * @brief call f(first, last, block) for contiguous blocks of [0, n)
+ *
+ * Each block runs on its own thread; block 0 runs on the calling thread.
+ * Small ranges run serially.
+ *
+ * @code
+ * std::vector<double> v(n);
+ * parallel::for_each_block(n, [&](std::size_t first, std::size_t last,
+ *                                 std::size_t) {
+ *   for (auto i = first; i < last; i++) v[i] = i;
+ * });
+ * @endcode
+ */
+template <class Function>
+void for_each_block(std::size_t n, Function f, std::size_t grain = 1024) {
+  if (n == 0) return;
+  const auto blocks = num_blocks(n, grain);
+  if (!affinity() || blocks == 1) {
+    std::vector<std::thread> threads;
+    threads.reserve(blocks - 1);
+    for (std::size_t b = 1; b < blocks; b++) {
+      const auto first = block_begin(n, b, blocks);
+      const auto last = block_begin(n, b + 1, blocks);
+      threads.emplace_back([f, first, last, b]() mutable {
+        internal::run_block(f, first, last, b);
+      });
+    }
+    internal::run_block(f, 0, block_begin(n, 1, blocks), 0);
+    for (auto& t : threads) t.join();
+    return;
+  }
+
+  const auto& cpus = numa::topology().cpus();
+  std::vector<std::thread> threads;
+  threads.reserve(blocks - 1);
+  for (std::size_t b = 1; b < blocks; b++) {
+    const auto first = block_begin(n, b, blocks);
+    const auto last = block_begin(n, b + 1, blocks);
+    const auto cpu = cpus[block_cpu(b, blocks)];
+    threads.emplace_back([f, first, last, b, cpu]() mutable {
+      numa::internal::pin_current_thread(cpu);
+      internal::run_block(f, first, last, b);
+    });
+  }
+  {
+    // the calling thread gets its affinity back
+    numa::internal::ScopedAffinity restore;
+    numa::internal::pin_current_thread(cpus[block_cpu(0, blocks)]);
+    internal::run_block(f, 0, block_begin(n, 1, blocks), 0);
+  }
+  for (auto& t : threads) t.join();
+}
+
+/**
+ * @brief call f(i) for i in [0, n) in parallel
+ */
+template <class Function>
+void for_each(std::size_t n, Function f, std::size_t grain = 1024) {
+  for_each_block(n, [&f](std::size_t first, std::size_t last, std::size_t) {
+    for (auto i = first; i < last; i++) f(i);
+  }, grain);
+}
+
+/**
+ * @brief call f(i) for i in [0, n) in parallel, balanced by cost hints
+ *
+ * [0, n) is cut into chunks of about the same total cost, from the prefix
+ * sum of cost(i), several per thread. Threads take the next chunk when they
+ * finish one, so chunks costing more than their hint are made up for by
+ * the other threads. Use this instead of for_each when the work per index
+ * varies a lot, e.g. with the number of neighbors in clustered states.
+ *
+ * With set_affinity(true), chunks taken in any order would run on any node,
+ * so each thread gets one block of about the same total cost instead, on
+ * the CPU of that block as in for_each_block. Blocks follow the costs, so
+ * they stay on the same nodes as long as costs change slowly.
+ *
+ * @code
+ * // per-particle update over an adjacency list
+ * parallel::for_each_weighted(n, [&](std::size_t i) {
+ *   return adjacency_list[i].size();
+ * }, [&](std::size_t i) { ... });
+ * @endcode
+ *
+ * @param cost cost(i) returns a hint of the work for i (any unit, at least
+ *        1 is counted)
+ * @param grain minimum total cost of a chunk
+ */
+template <class Cost, class Function>
+void for_each_weighted(std::size_t n, Cost cost, Function f,
+                       std::size_t grain = 1024) {
+  if (n == 0) return;
+  grain = std::max<std::size_t>(grain, 1);
+  std::vector<std::size_t> prefix;
+  internal::cost_prefix(n, cost, prefix);
+  const auto total = prefix[n];
+
+  const auto threads = num_blocks(total, grain);
+  const auto chunks = std::min({n, 8 * threads, (total + grain - 1) / grain});
+  if (threads == 1 || chunks <= 1) {
+    for (std::size_t i = 0; i < n; i++) f(i);
+    return;
+  }
+  if (affinity()) {
+    const auto bounds = internal::cost_bounds(prefix, threads);
+    for_each_block(threads, [&](std::size_t, std::size_t, std::size_t b) {
+      for (auto i = bounds[b]; i < bounds[b + 1]; i++) f(i);
+    }, 1);
+    return;
+  }
+
+  const auto bounds = internal::cost_bounds(prefix, chunks);
+  std::atomic<std::size_t> next(0);
+  for_each_block(threads, [&](std::size_t, std::size_t, std::size_t) {
+    for (auto c = next++; c < chunks; c = next++) {
+      for (auto i = bounds[c]; i < bounds[c + 1]; i++) f(i);
+    }
+  }, 1);
+}
+
+/**
+ * @brief reduction over blocks
+ *
+ * Partial results of blocks are combined in order of blocks, so that the
+ * result does not depend on scheduling.
+ *
+ * @param init initial value of each block
+ * @param map map(first, last) returns result of a block
+ * @param combine combine(a, b) returns result of merged blocks
+ */
+template <class R, class Map, class Combine>
+R reduce(std::size_t n, const R& init, Map map, Combine combine,
+         std::size_t grain = 1024) {
+  std::vector<R> partial(num_blocks(n, grain), init);
+  for_each_block(n, [&](std::size_t first, std::size_t last, std::size_t b) {
+    partial[b] = map(first, last);
+  }, grain);
+  R res = partial[0];
+  for (std::size_t b = 1; b < partial.size(); b++) {
+    res = combine(res, partial[b]);
+  }
+  return res;
+}
+
+}  // namespace parallel
+}  // namespace particles
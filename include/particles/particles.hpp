@@ -1,11 +1,19 @@
 #pragma once
 
+#include "analysis.hpp"
 #include "boundary.hpp"
+#include "domain.hpp"
 #include "expression.hpp"
+#include "halo.hpp"
+#include "instrument.hpp"
 #include "io.hpp"
+#include "longrange.hpp"
+#include "numa.hpp"
+#include "parallel.hpp"
 #include "particle.hpp"
 #include "random.hpp"
 #include "range.hpp"
+#include "reorder.hpp"
 #include "searcher.hpp"
 #include "util.hpp"
 #include "vec.hpp"
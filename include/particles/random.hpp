@@ -5,6 +5,7 @@
 
 #pragma once
 
+#include "instrument.hpp"
 #include "util.hpp"
 
 #include <algorithm>
@@ -120,6 +121,7 @@ class UniformRand
    * @brief returns a generated random number
    */
   static T get() {
+    PARTICLES_COUNT("random.draws", 1);
     static auto& o = UniformRand::instance();
     return o.distribution_(o.engine);
   }
@@ -199,9 +201,15 @@ template <class Engine>
 class GeneratorBase {
  public:
   /** @brief set seed to the current time */
-  void seed_now() { internal::set_seed_now(engine_); }
+  void seed_now() {
+    PARTICLES_TIME("random.seed_now");
+    internal::set_seed_now(engine_);
+  }
   /** @brief set seed using device */
-  void seed_dev() { internal::set_seed_seq(engine_); }
+  void seed_dev() {
+    PARTICLES_TIME("random.seed_dev");
+    internal::set_seed_seq(engine_);
+  }
   /** @brief sed seed by your self */
   void seed(typename Engine::result_type val) { engine_.seed(val); }
 
@@ -232,7 +240,10 @@ class UniformGenerator : public GeneratorBase<Engine> {
   UniformGenerator() : distribution_() {}
   UniformGenerator(T a, T b) : distribution_(a, b) {}
 
-  value_type get() const { return distribution_(Base::engine_); }
+  value_type get() const {
+    PARTICLES_COUNT("random.draws", 1);
+    return distribution_(Base::engine_);
+  }
 
   /** @brief get a random number */
   // value_type operator()() const { return distribution_(Base::engine_); }
@@ -280,7 +291,10 @@ class UniformOnSphere<T, 2, Engine> : public GeneratorBase<Engine> {
 
   UniformOnSphere(T r=1) : r_(r), dist_theta_(0, M_PI*2) {}
 
-  value_type theta() const { return dist_theta_(Base::engine_); }
+  value_type theta() const {
+    PARTICLES_COUNT("random.draws", 1);
+    return dist_theta_(Base::engine_);
+  }
 
   /** @brief defines next value of theta */
   UniformOnSphere& operator()() { theta_ = theta(); return *this; }
@@ -309,8 +323,14 @@ class UniformOnSphere<T, 3, Engine> : public GeneratorBase<Engine> {
 
   UniformOnSphere(T r=1) : r_(r), dist_phi_(0, M_PI*2), dist_theta_(0, M_PI) {}
 
-  value_type phi()   const { return dist_phi_(Base::engine_); }
-  value_type theta() const { return dist_theta_(Base::engine_); }
+  value_type phi() const {
+    PARTICLES_COUNT("random.draws", 1);
+    return dist_phi_(Base::engine_);
+  }
+  value_type theta() const {
+    PARTICLES_COUNT("random.draws", 1);
+    return dist_theta_(Base::engine_);
+  }
 
   /** @brief defines next value of theta */
   UniformOnSphere& operator()() { phi_ = phi(); theta_ = theta(); return *this; }
@@ -12,6 +12,7 @@
 #include "expression.hpp"
 #include "util.hpp"
 #include "io.hpp"
+#include "parallel.hpp"
 #include "range/enumerate.hpp"
 #include "range/join.hpp"
 #include "range/xrange.hpp"
@@ -21,11 +22,122 @@
 #include <functional>
 #include <iterator>
 #include <memory>
+#include <type_traits>
 #include <utility>
 
 namespace particles {
+namespace range {
+namespace internal {
+
+/** @brief size of blocks summed by a plain loop in pairwise summation */
+constexpr std::size_t PAIRWISE_BLOCK = 128;
+
+/** @brief minimum number of elements summed by a thread */
+constexpr std::size_t PARALLEL_SUM_GRAIN = 1 << 15;
+
+/** @brief returns the argument itself */
+struct Identity {
+  template <class U>
+  const U& operator()(const U& u) const { return u; }
+};
+
+/** @brief iterator_category, or input_iterator_tag if it is not defined */
+template <class Iterator>
+struct IteratorCategory {
+  template <class It>
+  static typename std::iterator_traits<It>::iterator_category check(It*);
+  template <class It>
+  static std::input_iterator_tag check(...);
+
+  typedef decltype(check<Iterator>(nullptr)) type;
+};
+
+/**
+ * @brief pairwise summation of op(x) over [first, first + n)
+ *
+ * Rounding error grows as \f$O(\log n)\f$ instead of \f$O(n)\f$. Leaves
+ * are summed into 4 independent partial sums. Compilers do not reorder
+ * floating point additions (without -ffast-math), so a single accumulator
+ * would be a chain of dependent additions; independent ones can be
+ * pipelined or vectorized.
+ */
+template <class R, class RandomAccessIterator, class UnaryOperation>
+R pairwise_sum(RandomAccessIterator first, std::size_t n, UnaryOperation op) {
+  if (n <= PAIRWISE_BLOCK) {
+    R s0 = R(), s1 = R(), s2 = R(), s3 = R();
+    std::size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      s0 += op(first[i]);
+      s1 += op(first[i + 1]);
+      s2 += op(first[i + 2]);
+      s3 += op(first[i + 3]);
+    }
+    for (; i < n; i++) s0 += op(first[i]);
+    s0 += s1;
+    s2 += s3;
+    s0 += s2;
+    return s0;
+  }
+  const auto half = n / 2;
+  R res = pairwise_sum<R>(first, half, op);
+  res += pairwise_sum<R>(first + half, n - half, op);
+  return res;
+}
 
 /**
+ * @brief Kahan summation for single pass iterators
+ *
+ * Written with compound assignments only, so that R can be Vec.
+ */
+template <class R, class InputIterator, class UnaryOperation>
+R sum_impl(InputIterator first, InputIterator last, UnaryOperation op,
+           std::size_t& num, std::input_iterator_tag) {
+  R s = R(), c = R();
+  for (; first != last; ++first, ++num) {
+    R y = op(*first);
+    y -= c;
+    R t = s;
+    t += y;
+    c = t;
+    c -= s;
+    c -= y;
+    s = t;
+  }
+  return s;
+}
+
+/**
+ * @brief pairwise summation in parallel for random access iterators
+ */
+template <class R, class RandomAccessIterator, class UnaryOperation>
+R sum_impl(RandomAccessIterator first, RandomAccessIterator last,
+           UnaryOperation op, std::size_t& num,
+           std::random_access_iterator_tag) {
+  const std::size_t n = last - first;
+  num = n;
+  return parallel::reduce(
+      n, R(),
+      [&](std::size_t i, std::size_t j) {
+        return pairwise_sum<R>(first + i, j - i, op);
+      },
+      [](R a, const R& b) { a += b; return a; }, PARALLEL_SUM_GRAIN);
+}
+
+template <class R, class Iterator, class UnaryOperation>
+R compensated_sum(Iterator first, Iterator last, UnaryOperation op,
+                  std::size_t& num) {
+  num = 0;
+  return sum_impl<R>(first, last, op, num,
+                     typename IteratorCategory<Iterator>::type());
+}
+
+}  // namespace internal
+}  // namespace range
+
+/**
+ * Random access ranges are summed pairwise in parallel, and others by Kahan
+ * summation, so that rounding errors do not grow linearly in length.
+ *
  * @brief sum over iterators
  *
  * @code
@@ -35,23 +147,51 @@ namespace particles {
  */
 template <class InputIterator>
 inline auto sum(InputIterator first, InputIterator last) {
-  typedef typename std::remove_reference<decltype(*first)>::type value_type;
-  // get value type
-  // avoid uninitialized warning
-  auto res = value_type();
-  auto it = first;
-  while (it != last) {
-    res += *it;
-    ++it;
-  }
-  return res;
+  typedef typename std::decay<decltype(*first)>::type value_type;
+  std::size_t num;
+  return range::internal::compensated_sum<value_type>(
+      first, last, range::internal::Identity(), num);
 }
 
 /**
- * @todo return double when calculating average over list of int
+ * @brief sum of op(x) over iterators
  *
+ * @code
+ * std::vector<Particle<double, 2>> v;
+ * auto s = sum(v.begin(), v.end(),
+ *              [](const auto& p) { return p.velocity(); });
+ * @endcode
+ */
+template <class InputIterator, class UnaryOperation>
+inline auto sum(InputIterator first, InputIterator last, UnaryOperation op) {
+  typedef typename std::decay<decltype(op(*first))>::type value_type;
+  std::size_t num;
+  return range::internal::compensated_sum<value_type>(first, last, op, num);
+}
+
+/**
+ * @brief average of op(x) over iterators
+ * @see average
+ */
+template <class InputIterator, class UnaryOperation>
+inline auto average(InputIterator first, InputIterator last,
+                    UnaryOperation op) {
+  typedef typename std::decay<decltype(op(*first))>::type value_type;
+  typedef typename util::type_cond<
+                      std::is_integral<value_type>::value,
+                      double, value_type>::type result_type;
+  std::size_t num;
+  auto s = range::internal::compensated_sum<result_type>(first, last, op, num);
+  s /= double(num);
+  return s;
+  /** @todo return s / double(num); why it does not work for Vec? */
+}
+
+/**
  * @brief average
  *
+ * Summation is done in the same way as sum.
+ *
  * @code
  * vector<double> u {1, 2, 3};
  * average(u.begin(), u.end());    // 3
@@ -63,21 +203,7 @@ inline auto sum(InputIterator first, InputIterator last) {
  */
 template<class InputIterator>
 inline auto average(InputIterator first, InputIterator last) {
-  typedef typename std::remove_reference<decltype(*first)>::type value_type;
-  typedef typename util::type_cond<
-                      std::is_integral<value_type>::value,
-                      double, value_type>::type result_type;
-  std::size_t num = 0;
-  auto s = result_type();
-  auto it = first;
-  while (it != last) {
-    s += *it;
-    ++it;
-    num++;
-  }
-  s /= double(num);
-  return s;
-  /** @todo return s / double(num); why it does not work for Vec? */
+  return average(first, last, range::internal::Identity());
 }
 
 
@@ -0,0 +1,218 @@
+/**
+ * @file reorder.hpp
+ *
+ * @brief sort particles along a space filling curve for memory locality
+ *
+ * After many steps, particles close in space are scattered in memory and
+ * loops over neighbors miss the cache. Sorting the array along a Morton
+ * (Z-order) or Hilbert curve every few steps brings neighbors close in
+ * memory again.
+ */
+
+#pragma once
+
+#include "boundary.hpp"
+#include "parallel.hpp"
+#include "particle.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace particles {
+
+/** @brief space filling curves for reorder_particles */
+enum class Curve { morton, hilbert };
+
+namespace internal {
+
+/** @brief bits per dimension of keys of space filling curves */
+template <std::size_t N>
+constexpr std::size_t curve_bits() { return 64 / N < 32 ? 64 / N : 32; }
+
+/** @brief interleave bits of coordinates, x[0] as the most significant */
+template <std::size_t N>
+std::uint64_t interleave(const std::uint32_t (&x)[N]) {
+  std::uint64_t key = 0;
+  for (std::size_t b = curve_bits<N>(); b-- > 0;) {
+    for (std::size_t d = 0; d < N; d++) key = (key << 1) | ((x[d] >> b) & 1);
+  }
+  return key;
+}
+
+/**
+ * @brief transform coordinates into the transposed Hilbert index in place
+ *
+ * J. Skilling, "Programming the Hilbert curve", AIP Conf. Proc. 707 (2004)
+ */
+template <std::size_t N>
+void axes_to_transpose(std::uint32_t (&x)[N]) {
+  const std::uint32_t m = std::uint32_t(1) << (curve_bits<N>() - 1);
+  for (std::uint32_t q = m; q > 1; q >>= 1) {
+    const std::uint32_t p = q - 1;
+    for (std::size_t i = 0; i < N; i++) {
+      if (x[i] & q) {
+        x[0] ^= p;
+      } else {
+        const std::uint32_t t = (x[0] ^ x[i]) & p;
+        x[0] ^= t;
+        x[i] ^= t;
+      }
+    }
+  }
+  for (std::size_t i = 1; i < N; i++) x[i] ^= x[i - 1];
+  std::uint32_t t = 0;
+  for (std::uint32_t q = m; q > 1; q >>= 1) {
+    if (x[N - 1] & q) t ^= q - 1;
+  }
+  for (std::size_t i = 0; i < N; i++) x[i] ^= t;
+}
+
+/**
+ * @brief key of a position on the curve
+ *
+ * The box \f$[lower, upper]\f$ is divided into \f$2^{b}\f$ cells per
+ * dimension. Outside positions are clamped into the box, and NaN (e.g. of
+ * an empty box) goes to the first cell. Scaling is done in at least double,
+ * where the number of cells per dimension is exact, and clamped before
+ * conversion to integers.
+ */
+template <class T, std::size_t N>
+std::uint64_t curve_key(const Vec<T, N>& x, const Vec<T, N>& lower,
+                        const Vec<T, N>& upper, Curve curve) {
+  typedef typename std::common_type<T, double>::type S;
+  const std::uint64_t cells = std::uint64_t(1) << curve_bits<N>();
+  std::uint32_t c[N];
+  for (std::size_t d = 0; d < N; d++) {
+    const S u = (S(x[d]) - S(lower[d])) / (S(upper[d]) - S(lower[d])) *
+                static_cast<S>(cells);
+    if (!(u > 0)) {
+      c[d] = 0;
+    } else if (u >= static_cast<S>(cells)) {
+      c[d] = static_cast<std::uint32_t>(cells - 1);
+    } else {
+      c[d] = static_cast<std::uint32_t>(u);
+    }
+  }
+  if (curve == Curve::hilbert) axes_to_transpose<N>(c);
+  return interleave<N>(c);
+}
+
+}  // namespace internal
+
+/**
+ * @brief reorder v so that v[k] becomes the old v[permutation[k]]
+ *
+ * Use this to remap arrays parallel to particles after reorder_particles.
+ */
+template <class U>
+void apply_permutation(std::vector<U>& v,
+                       const std::vector<std::size_t>& permutation) {
+  std::vector<U> sorted;
+  sorted.reserve(v.size());
+  for (auto i : permutation) sorted.push_back(std::move(v[i]));
+  v.swap(sorted);
+}
+
+/**
+ * @brief permutation sorting particles along a space filling curve
+ * @return permutation[k] is the index of the particle to be k-th
+ */
+template <class T, std::size_t N, class I>
+std::vector<std::size_t> curve_order(
+    const std::vector<Particle<T, N, I>>& particles, const Vec<T, N>& lower,
+    const Vec<T, N>& upper, Curve curve = Curve::hilbert) {
+  std::vector<std::pair<std::uint64_t, std::size_t>> keys(particles.size());
+  parallel::for_each(particles.size(), [&](std::size_t i) {
+    keys[i].first = internal::curve_key(particles[i].position(), lower, upper,
+                                        curve);
+    keys[i].second = i;
+  });
+  std::sort(keys.begin(), keys.end());
+
+  std::vector<std::size_t> permutation(keys.size());
+  for (std::size_t k = 0; k < keys.size(); k++) permutation[k] = keys[k].second;
+  return permutation;
+}
+
+/**
+ * @brief sort particles along a space filling curve
+ *
+ * Pointers to particles (e.g. adjacency lists) are invalidated, so search
+ * again after reordering.
+ *
+ * @code
+ * auto permutation = reorder_particles(particles, lower, upper);
+ * apply_permutation(charges, permutation);  // arrays parallel to particles
+ * @endcode
+ *
+ * @param lower, upper box containing particles
+ * @return permutation applied to particles (see apply_permutation)
+ */
+template <class T, std::size_t N, class I>
+std::vector<std::size_t> reorder_particles(
+    std::vector<Particle<T, N, I>>& particles, const Vec<T, N>& lower,
+    const Vec<T, N>& upper, Curve curve = Curve::hilbert) {
+  auto permutation = curve_order(particles, lower, upper, curve);
+  apply_permutation(particles, permutation);
+  return permutation;
+}
+
+/** @brief sort particles in the box of a periodic boundary */
+template <class T, std::size_t N, class I>
+std::vector<std::size_t> reorder_particles(
+    std::vector<Particle<T, N, I>>& particles,
+    const boundary::PeriodicBoundary<T, N>& boundary,
+    Curve curve = Curve::hilbert) {
+  Vec<T, N> lower, upper;
+  for (std::size_t d = 0; d < N; d++) {
+    lower[d] = boundary.left()[d];
+    upper[d] = boundary.right()[d];
+  }
+  return reorder_particles(particles, lower, upper, curve);
+}
+
+/**
+ * @brief reorder particles every k steps in the time loop
+ *
+ * @code
+ * Reorderer<double, 2> reorder(lower, upper, 100);
+ * for (std::size_t t = 0; t < steps; ++t) {
+ *   if (reorder(t, particles)) apply_permutation(ids, reorder.permutation());
+ *   searcher.search(adjacency_list, particles);
+ *   ...
+ * }
+ * @endcode
+ */
+template <class T, std::size_t N>
+class Reorderer {
+ public:
+  /** @param every reorder when step is multiple of this (0 never) */
+  Reorderer(const Vec<T, N>& lower, const Vec<T, N>& upper,
+            std::size_t every, Curve curve = Curve::hilbert)
+      : lower_(lower), upper_(upper), every_(every), curve_(curve),
+        permutation_() {}
+
+  /** @return whether particles are reordered at this step */
+  template <class I>
+  bool operator()(std::size_t step, std::vector<Particle<T, N, I>>& particles) {
+    if (every_ == 0 || step % every_ != 0) return false;
+    permutation_ = reorder_particles(particles, lower_, upper_, curve_);
+    return true;
+  }
+
+  /** @brief permutation of the last reordering */
+  const std::vector<std::size_t>& permutation() const { return permutation_; }
+
+ private:
+  const Vec<T, N> lower_;
+  const Vec<T, N> upper_;
+  const std::size_t every_;
+  const Curve curve_;
+  std::vector<std::size_t> permutation_;
+};
+
+}  // namespace particles
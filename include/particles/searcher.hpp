@@ -8,11 +8,21 @@
 
 #pragma once
 
+#include "instrument.hpp"
+#include "parallel.hpp"
 #include "particle.hpp"
 #include "range.hpp"
+#include "details/adjacency_list.hpp"
+#include "details/csr.hpp"
 #include "details/delaunay_search.hpp"
+#include "details/dual_tree.hpp"
 #include "details/kdtree_search.hpp"
+#include "details/radius_search.hpp"
+#include "details/sparse_grid.hpp"
 
+#include <algorithm>
+#include <functional>
+#include <iterator>
 #include <utility>
 #include <vector>
 
@@ -23,44 +33,86 @@ namespace search {
 /**
  * @brief find particles distance within r
  *
+ * Candidates farther than r are erased from the range.
+ *
  * @todo floating point exception??
  */
 template <class Range, class T, std::size_t N>
 auto distance_within(Range& candidates, const Particle<T, N>& p, const T r) {
+  const T r2 = r * r;
   auto last = std::remove_if(std::begin(candidates), std::end(candidates),
-                             [&p, r](const Particle<T, N>* q) {
-    return p.squared_distance(q) > r * r;
+                             [&p, r2](const Particle<T, N>* q) {
+    return p.squared_distance(q) > r2;
   });
-  candidates.resize(last - candidates.begin());
-  return last;
+  candidates.erase(last, std::end(candidates));
+  return std::end(candidates);
 }
 
 /**
  * @brief find n nearest particles
  *
+ * Only the n nearest candidates are sorted (by distance from p), and the
+ * others are erased.
+ *
  * @param candidates list of pointer to particles
  */
 template <class Range, class T, std::size_t N>
 auto nearest(Range& candidates, const Particle<T, N>& p,
              const std::size_t n = 1) {
   typedef Particle<T, N> P;
-
-  // sort by distance from p
-  std::sort(std::begin(candidates), std::end(candidates),
-            [&p](const P* p1, const P* p2) {
+  auto closer = [&p](const P* p1, const P* p2) {
     return p.squared_distance(p1) < p.squared_distance(p2);
-  });
-  const auto sz =
-      std::min<std::size_t>(n, std::end(candidates) - std::begin(candidates));
-  candidates.resize(sz);
-  return candidates.end();
+  };
+
+  const auto first = std::begin(candidates);
+  const auto last = std::end(candidates);
+  const auto middle =
+      first + std::min<std::size_t>(n, std::distance(first, last));
+  if (middle != last) std::nth_element(first, middle, last, closer);
+  std::sort(first, middle, closer);
+  candidates.erase(middle, last);
+  return std::end(candidates);
 }
 
-template <class T, std::size_t N>
+/**
+ * @brief distance_within for candidates[i] around queries[i] in parallel
+ *
+ * @code
+ * searcher.search(adjacency_list, particles);
+ * search::distance_within(adjacency_list, particles, r);
+ * @endcode
+ */
+template <class Range, class T, std::size_t N>
+void distance_within(std::vector<Range>& candidates,
+                     const std::vector<Particle<T, N>>& queries, const T r) {
+  parallel::for_each(std::min(candidates.size(), queries.size()),
+                     [&](std::size_t i) {
+    distance_within(candidates[i], queries[i], r);
+  }, 256);
+}
+
+/** @brief nearest for candidates[i] around queries[i] in parallel */
+template <class Range, class T, std::size_t N>
+void nearest(std::vector<Range>& candidates,
+             const std::vector<Particle<T, N>>& queries,
+             const std::size_t n = 1) {
+  parallel::for_each(std::min(candidates.size(), queries.size()),
+                     [&](std::size_t i) {
+    nearest(candidates[i], queries[i], n);
+  }, 256);
+}
+
+/**
+ * @brief interface of searchers
+ * @tparam T floating point
+ * @tparam N dimension
+ * @tparam I info of particles
+ */
+template <class T, std::size_t N, class I = void>
 class SearcherBase {
  public:
-  typedef Particle<T, N> particle_type;
-  typedef std::vector<std::vector<const particle_type*>> adjacency_list_type;
+  typedef Particle<T, N, I> particle_type;
+  typedef AdjacencyList<particle_type> adjacency_list_type;
 
   virtual ~SearcherBase() {}
   /**
@@ -100,15 +152,16 @@ class SimpleRangeSearch : public SearcherBase<T,N> {
 
   void search(adjacency_list_type& adjacency_list,
               const std::vector<particle_type>& particles) {
-    adjacency_list.resize(particles.size());
-    for (auto l : adjacency_list) l.clear();
+    internal::reset_rows(adjacency_list, particles.size());
 
+    PARTICLES_TIME("search.simple.query");
+    const T d2 = distance_ * distance_;
     for (std::size_t i = 0; i < particles.size(); i++) {
       adjacency_list[i].push_back(&particles[i]);
+      const auto& pi = particles[i].position();
       for (std::size_t j = i+1; j < particles.size(); j++) {
-        const auto& pi = particles[i].position();
         const auto& pj = particles[j].position();
-        if (pi.squared_distance(pj) <= distance_ * distance_) {
+        if (pi.squared_distance(pj) <= d2) {
           adjacency_list[i].push_back(&particles[j]);
           adjacency_list[j].push_back(&particles[i]);
         }
@@ -122,6 +175,21 @@ class SimpleRangeSearch : public SearcherBase<T,N> {
 
 /**
  * @brief searchs adjacencies using Delaunay triangulation
+ *
+ * The triangulation is always computed in double (see DelaunayType), so
+ * float particles are converted. Voronoi volumes and faces are returned in T.
+ *
+ * Optionally computes Voronoi cells from the same triangulation. Results are
+ * stored in arrays parallel to particles and the adjacency list.
+ *
+ * @code
+ * search::DelaunaySearcher<double, 2> searcher(true);
+ * searcher.search(adjacency_list, particles);
+ * searcher.voronoi_volumes()[i];    // area of the cell of i-th particle
+ * searcher.voronoi_faces()[i][k];   // length of the edge shared with
+ *                                   // adjacency_list[i][k]
+ * @endcode
+ *
  * @tparam T floating point
  * @tparam N dimension
  */
@@ -133,22 +201,49 @@ class DelaunaySearcher : public SearcherBase<T, N> {
   typedef typename SearcherBase<T, N>::particle_type particle_type;
   typedef typename SearcherBase<T, N>::adjacency_list_type adjacency_list_type;
 
-  DelaunaySearcher<T, N>() : delaunay_() {}
+  /** @param voronoi compute Voronoi cells as well */
+  explicit DelaunaySearcher<T, N>(bool voronoi = false)
+      : impl_(), voronoi_(voronoi), volumes_(), faces_() {}
 
   void search(adjacency_list_type& adjacency_list,
               const std::vector<particle_type>& particles) {
-    internal::DelaunaySearchImpl<Delaunay, T, N>::search(
-        delaunay_, adjacency_list, particles);
+    if (voronoi_) {
+      impl_.search(adjacency_list, particles, volumes_, faces_);
+    } else {
+      impl_.search(adjacency_list, particles);
+    }
   }
 
+  /** @brief enable or disable computation of Voronoi cells */
+  void set_voronoi(bool voronoi) { voronoi_ = voronoi; }
+
+  /**
+   * @brief area (2d) or volume (3d) of Voronoi cells at the last search
+   *
+   * Unbounded cells (on the convex hull) are infinity.
+   */
+  const std::vector<T>& voronoi_volumes() const { return volumes_; }
+
+  /**
+   * @brief length (2d) or area (3d) of Voronoi faces at the last search
+   *
+   * voronoi_faces()[i][k] is the face shared by i-th particle and
+   * adjacency_list[i][k].
+   */
+  const std::vector<std::vector<T>>& voronoi_faces() const { return faces_; }
+
  private:
-  Delaunay delaunay_;
+  internal::DelaunaySearchImpl<Delaunay, T, N> impl_;
+  bool voronoi_;
+  std::vector<T> volumes_;
+  std::vector<std::vector<T>> faces_;
 };
 
 /**
  * @brief searchs adjacencies using KdTree
  *
- * Pick particles with distance less than \f$r\f$
+ * Pick particles with distance less than \f$r\f$. The tree holds indices
+ * and reads positions in place (in T), and is reused over searches.
  *
  * @tparam T floating point
  * @tparam N dimension
@@ -159,11 +254,160 @@ class KdTreeSearcher : public SearcherBase<T, N> {
   typedef typename SearcherBase<T, N>::particle_type particle_type;
   typedef typename SearcherBase<T, N>::adjacency_list_type adjacency_list_type;
 
-  KdTreeSearcher(T r) : r_(r) {}
+  KdTreeSearcher(T r) : r_(r), impl_() {}
+
+  void search(adjacency_list_type& adjacency_list,
+              const std::vector<particle_type>& particles) {
+    impl_.search(adjacency_list, particles, r_);
+  }
+
+  /** @brief set searching radious */
+  void set_r(T r) { r_ = r; }
+
+ private:
+  T r_;
+  internal::KdTreeSearchImpl<T, N> impl_;
+};
+
+/**
+ * @brief searchs k nearest neighbors using KdTree
+ *
+ * Topological neighbors: adjacency_list[i] holds the i-th particle itself
+ * and its k nearest particles (k + 1 in total if there are enough).
+ *
+ * @code
+ * search::KnnSearcher<double, 2> searcher(6);
+ * searcher.search(adjacency_list, particles);
+ * @endcode
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class KnnSearcher : public SearcherBase<T, N> {
+ public:
+  typedef typename SearcherBase<T, N>::particle_type particle_type;
+  typedef typename SearcherBase<T, N>::adjacency_list_type adjacency_list_type;
+
+  KnnSearcher(std::size_t k) : k_(k), impl_() {}
+
+  void search(adjacency_list_type& adjacency_list,
+              const std::vector<particle_type>& particles) {
+    impl_.search_nearest(adjacency_list, particles, k_);
+  }
+
+  /** @brief set number of neighbors */
+  void set_k(std::size_t k) { k_ = k; }
+
+ private:
+  std::size_t k_;
+  internal::KdTreeSearchImpl<T, N> impl_;
+};
+
+/**
+ * @brief range search with per-particle radius
+ *
+ * Particles i and j are adjacent if their distance is within the cutoff
+ * given by RadiusRule: \f$r_i + r_j\f$ (default) or \f$\max(r_i, r_j)\f$.
+ * Particles are bucketed by radius into a grid per class, so that a
+ * polydisperse system is not searched with the largest radius. Like
+ * KdTreeSearcher, each particle is adjacent to itself.
+ *
+ * @code
+ * typedef Particle<double, 2, double> P;  // info is radius
+ * search::VariableRadiusSearcher<double, 2, double> searcher;
+ * searcher.search(adjacency_list, particles);
+ *
+ * // or with any accessor
+ * search::VariableRadiusSearcher<double, 2> searcher2(
+ *     [&](const Particle<double, 2>& p) { return radius[&p - &particles[0]]; },
+ *     search::RadiusRule::max);
+ * @endcode
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ * @tparam I info of particles
+ */
+template <class T, std::size_t N, class I = void>
+class VariableRadiusSearcher : public SearcherBase<T, N, I> {
+ public:
+  typedef typename SearcherBase<T, N, I>::particle_type particle_type;
+  typedef typename SearcherBase<T, N, I>::adjacency_list_type
+      adjacency_list_type;
+  typedef std::function<T(const particle_type&)> radius_type;
+
+  /** @param radius radius(p) returns the radius of p */
+  VariableRadiusSearcher(radius_type radius,
+                         RadiusRule rule = RadiusRule::sum)
+      : radius_(radius), rule_(rule), impl_() {}
+
+  /** @brief radius is read from info of particles */
+  template <class U = I, enable_if<std::is_arithmetic<U>{}> = enabler>
+  explicit VariableRadiusSearcher(RadiusRule rule = RadiusRule::sum)
+      : radius_([](const particle_type& p) {
+          return static_cast<T>(p.info());
+        }),
+        rule_(rule), impl_() {}
+
+  void search(adjacency_list_type& adjacency_list,
+              const std::vector<particle_type>& particles) {
+    impl_.search(adjacency_list, particles, radius_, rule_);
+  }
+
+  void set_rule(RadiusRule rule) { rule_ = rule; }
+
+ private:
+  radius_type radius_;
+  RadiusRule rule_;
+  internal::RadiusClassSearchImpl<T, N> impl_;
+};
+
+/**
+ * @brief searchs adjacencies using a sparse grid refined in crowded cells
+ *
+ * Pick particles with distance less than \f$r\f$ (including the particle
+ * itself). Memory is proportional to the number of occupied cells, and
+ * crowded cells are split like an octree, so that strongly inhomogeneous
+ * systems (e.g. dense bands in empty space) are searched at the cost of the
+ * number of neighbors. Queries are spread over threads by the number of
+ * neighbors found at the last search. The boundary is free.
+ *
+ * @see internal::SparseGrid
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class AdaptiveGridSearcher : public SearcherBase<T, N> {
+ public:
+  typedef typename SearcherBase<T, N>::particle_type particle_type;
+  typedef typename SearcherBase<T, N>::adjacency_list_type adjacency_list_type;
+
+  /** @param leaf_size cells holding more particles are split */
+  AdaptiveGridSearcher(T r, std::size_t leaf_size = 16) : r_(r), grid_() {
+    grid_.set_leaf_size(leaf_size);
+  }
 
   void search(adjacency_list_type& adjacency_list,
               const std::vector<particle_type>& particles) {
-    internal::KdTreeSearchImpl<T, N>::search(adjacency_list, particles, r_);
+    auto positions = [&particles](std::size_t i) -> const Vec<T, N>& {
+      return particles[i].position();
+    };
+    {
+      PARTICLES_TIME("search.adaptive_grid.build");
+      grid_.build(particles.size(), positions, r_);
+    }
+
+    internal::reset_rows(adjacency_list, particles.size());
+    PARTICLES_TIME("search.adaptive_grid.query");
+    parallel::for_each_weighted(particles.size(),
+                                internal::row_capacity(adjacency_list),
+                                [&](std::size_t i) {
+      auto& neighbors = adjacency_list[i];
+      grid_.for_each_within(particles[i].position(), positions,
+                            [&](std::size_t j) {
+        neighbors.push_back(&particles[j]);
+      });
+    }, 1024);
   }
 
   /** @brief set searching radious */
@@ -171,6 +415,190 @@ class KdTreeSearcher : public SearcherBase<T, N> {
 
  private:
   T r_;
+  internal::SparseGrid<T, N> grid_;
+};
+
+/**
+ * @brief searchs adjacencies by dual-tree traversal of a kdtree
+ *
+ * Pick particles with distance less than \f$r\f$ (including the particle
+ * itself). Instead of querying the tree once per particle, pairs of nodes
+ * are walked together, and a pair of nodes entirely within r gives all of
+ * its pairs at once. Each pair is found once and added to both lists. This
+ * pays off for clustered data with many neighbors. The boundary is free.
+ *
+ * @see internal::DualTree
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class DualTreeSearcher : public SearcherBase<T, N> {
+ public:
+  typedef typename SearcherBase<T, N>::particle_type particle_type;
+  typedef typename SearcherBase<T, N>::adjacency_list_type adjacency_list_type;
+
+  /** @param leaf_size nodes holding more particles are split */
+  DualTreeSearcher(T r, std::size_t leaf_size = 16)
+      : r_(r), tree_(), buffers_(), counts_() {
+    tree_.set_leaf_size(leaf_size);
+  }
+
+  void search(adjacency_list_type& adjacency_list,
+              const std::vector<particle_type>& particles) {
+    const std::size_t n = particles.size();
+    auto positions = [&particles](std::size_t i) -> const Vec<T, N>& {
+      return particles[i].position();
+    };
+    {
+      PARTICLES_TIME("search.dual_tree.build");
+      tree_.build(n, positions);
+    }
+    {
+      PARTICLES_TIME("search.dual_tree.pairs");
+      tree_.for_each_pair(positions, std::max<T>(r_, 0), buffers_);
+    }
+
+    // reserve rows from the counts so that merging does not reallocate
+    counts_.assign(n, 1);
+    for (const auto& buffer : buffers_) {
+      for (const auto& ij : buffer) {
+        counts_[ij.first]++;
+        counts_[ij.second]++;
+      }
+    }
+    internal::reset_rows(adjacency_list, n);
+    PARTICLES_TIME("search.dual_tree.fill");
+    parallel::for_each(n, [&](std::size_t i) {
+      adjacency_list[i].reserve(counts_[i]);
+      adjacency_list[i].push_back(&particles[i]);
+    }, 1024);
+    for (const auto& buffer : buffers_) {
+      for (const auto& ij : buffer) {
+        adjacency_list[ij.first].push_back(&particles[ij.second]);
+        adjacency_list[ij.second].push_back(&particles[ij.first]);
+      }
+    }
+  }
+
+  /** @brief set searching radious */
+  void set_r(T r) { r_ = r; }
+
+ private:
+  T r_;
+  internal::DualTree<T, N> tree_;
+  std::vector<std::vector<typename internal::DualTree<T, N>::pair_type>>
+      buffers_;
+  std::vector<std::size_t> counts_;
+};
+
+/**
+ * @brief kdtree built once over particles for batched queries
+ *
+ * Probe points, tracers or another species can be queried against the same
+ * tree without rebuilding it. The particles must outlive the index.
+ *
+ * @code
+ * search::KdTreeIndex<double, 2> index(particles);
+ * search::CSR found;
+ * index.query(probes, 0.5, found);
+ * for (auto it = found.begin(q); it != found.end(q); ++it) {
+ *   particles[*it];  // within 0.5 from probes[q]
+ * }
+ * @endcode
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class KdTreeIndex {
+ public:
+  typedef Particle<T, N> particle_type;
+
+  KdTreeIndex() : impl_(), points_() {}
+  explicit KdTreeIndex(const std::vector<particle_type>& particles)
+      : impl_(), points_() {
+    build(particles);
+  }
+
+  /** @brief (re)build the tree over particles */
+  void build(const std::vector<particle_type>& particles) {
+    impl_.build(particles);
+  }
+
+  /** @brief number of indexed particles */
+  std::size_t size() const { return impl_.size(); }
+
+  /** @brief indices of particles within r from each point */
+  void query(const std::vector<Vec<T, N>>& points, T r, CSR& csr) {
+    impl_.query(points, r, csr);
+  }
+
+  /** @brief indices of particles within r from each of others */
+  void query(const std::vector<particle_type>& others, T r, CSR& csr) {
+    points_.resize(others.size());
+    for (std::size_t i = 0; i < others.size(); i++) {
+      points_[i] = others[i].position();
+    }
+    impl_.query(points_, r, csr);
+  }
+
+ private:
+  internal::KdTreeSearchImpl<T, N> impl_;
+  std::vector<Vec<T, N>> points_;
+};
+
+/**
+ * @brief sparse grid built once over particles for batched queries
+ *
+ * Same as KdTreeIndex using internal::SparseGrid. Queries are fastest with
+ * radius up to the width of cells.
+ *
+ * @tparam T floating point
+ * @tparam N dimension
+ */
+template <class T, std::size_t N>
+class GridIndex {
+ public:
+  typedef Particle<T, N> particle_type;
+
+  GridIndex() : particles_(nullptr), grid_() {}
+  GridIndex(const std::vector<particle_type>& particles, T width)
+      : particles_(nullptr), grid_() {
+    build(particles, width);
+  }
+
+  /** @brief (re)build the grid with cells of width */
+  void build(const std::vector<particle_type>& particles, T width) {
+    particles_ = &particles;
+    grid_.build(particles.size(), positions(), width);
+  }
+
+  std::size_t size() const { return particles_ ? particles_->size() : 0; }
+
+  /** @brief indices of particles within r from each point */
+  void query(const std::vector<Vec<T, N>>& points, T r, CSR& csr) const {
+    internal::fill_csr(points.size(), [&](std::size_t q, auto f) {
+      grid_.for_each_within(points[q], r, positions(), f);
+    }, csr);
+  }
+
+  /** @brief indices of particles within r from each of others */
+  void query(const std::vector<particle_type>& others, T r, CSR& csr) const {
+    internal::fill_csr(others.size(), [&](std::size_t q, auto f) {
+      grid_.for_each_within(others[q].position(), r, positions(), f);
+    }, csr);
+  }
+
+ private:
+  const std::vector<particle_type>* particles_;
+  internal::SparseGrid<T, N> grid_;
+
+  auto positions() const {
+    const auto* particles = particles_;
+    return [particles](std::size_t i) -> const Vec<T, N>& {
+      return (*particles)[i].position();
+    };
+  }
 };
 
 }  // namespace search
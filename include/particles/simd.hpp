@@ -0,0 +1,147 @@
+/**
+ * @file simd.hpp
+ *
+ * @brief portable arithmetic on short arrays held in vector registers
+ *
+ * Each operation works on W contiguous values. If W * sizeof(T) is 8, 16, 32
+ * or 64 bytes and the compiler supports GCC vector extensions (GCC, Clang),
+ * the values are processed as one vector, which is lowered to SSE/AVX/NEON
+ * instructions available on the target. Otherwise plain loops are used.
+ */
+
+#pragma once
+
+#include <cstring>
+#include <type_traits>
+
+namespace particles {
+namespace simd {
+namespace internal {
+
+constexpr bool is_register_size(std::size_t bytes) {
+  return bytes == 8 || bytes == 16 || bytes == 32 || bytes == 64;
+}
+
+/** @brief fallback with scalar loops */
+template <class T, std::size_t W, class Enable = void>
+struct Pack {
+  static constexpr bool native = false;
+
+  static void add(T* a, const T* b) {
+    for (std::size_t i = 0; i < W; i++) a[i] += b[i];
+  }
+  static void sub(T* a, const T* b) {
+    for (std::size_t i = 0; i < W; i++) a[i] -= b[i];
+  }
+  static void mul(T* a, T s) {
+    for (std::size_t i = 0; i < W; i++) a[i] *= s;
+  }
+  static void div(T* a, T s) {
+    for (std::size_t i = 0; i < W; i++) a[i] /= s;
+  }
+  static T dot(const T* a, const T* b) {
+    T s = 0;
+    for (std::size_t i = 0; i < W; i++) s += a[i] * b[i];
+    return s;
+  }
+  static T squared_distance(const T* a, const T* b) {
+    T s = 0;
+    for (std::size_t i = 0; i < W; i++) s += (a[i] - b[i]) * (a[i] - b[i]);
+    return s;
+  }
+};
+
+#if defined(__GNUC__)
+/** @brief W values of T in a vector register */
+template <class T, std::size_t W>
+struct Pack<T, W, typename std::enable_if<
+    std::is_floating_point<T>{} && is_register_size(sizeof(T) * W)>::type> {
+  static constexpr bool native = true;
+  typedef T type __attribute__((vector_size(sizeof(T) * W)));
+
+  // Registers are not passed across functions, which would depend on the
+  // ABI of the target. memcpy does not assume alignment of the register.
+  static void add(T* a, const T* b) {
+    type x, y;
+    std::memcpy(&x, a, sizeof(x));
+    std::memcpy(&y, b, sizeof(y));
+    x += y;
+    std::memcpy(a, &x, sizeof(x));
+  }
+  static void sub(T* a, const T* b) {
+    type x, y;
+    std::memcpy(&x, a, sizeof(x));
+    std::memcpy(&y, b, sizeof(y));
+    x -= y;
+    std::memcpy(a, &x, sizeof(x));
+  }
+  static void mul(T* a, T s) {
+    type x;
+    std::memcpy(&x, a, sizeof(x));
+    x *= s;
+    std::memcpy(a, &x, sizeof(x));
+  }
+  static void div(T* a, T s) {
+    type x;
+    std::memcpy(&x, a, sizeof(x));
+    x /= s;
+    std::memcpy(a, &x, sizeof(x));
+  }
+  static T dot(const T* a, const T* b) {
+    type x, y;
+    std::memcpy(&x, a, sizeof(x));
+    std::memcpy(&y, b, sizeof(y));
+    x *= y;
+    T s = 0;
+    for (std::size_t i = 0; i < W; i++) s += x[i];
+    return s;
+  }
+  static T squared_distance(const T* a, const T* b) {
+    type x, y;
+    std::memcpy(&x, a, sizeof(x));
+    std::memcpy(&y, b, sizeof(y));
+    x -= y;
+    x *= x;
+    T s = 0;
+    for (std::size_t i = 0; i < W; i++) s += x[i];
+    return s;
+  }
+};
+#endif
+
+}  // namespace internal
+
+/** @brief whether W values of T are processed as a vector register */
+template <class T, std::size_t W>
+constexpr bool is_native() { return internal::Pack<T, W>::native; }
+
+/** @brief a[i] += b[i] */
+template <std::size_t W, class T>
+inline void add(T* a, const T* b) { internal::Pack<T, W>::add(a, b); }
+
+/** @brief a[i] -= b[i] */
+template <std::size_t W, class T>
+inline void sub(T* a, const T* b) { internal::Pack<T, W>::sub(a, b); }
+
+/** @brief a[i] *= s */
+template <std::size_t W, class T>
+inline void mul(T* a, T s) { internal::Pack<T, W>::mul(a, s); }
+
+/** @brief a[i] /= s */
+template <std::size_t W, class T>
+inline void div(T* a, T s) { internal::Pack<T, W>::div(a, s); }
+
+/** @brief sum of a[i] * b[i] */
+template <std::size_t W, class T>
+inline T dot(const T* a, const T* b) {
+  return internal::Pack<T, W>::dot(a, b);
+}
+
+/** @brief sum of (a[i] - b[i])^2 */
+template <std::size_t W, class T>
+inline T squared_distance(const T* a, const T* b) {
+  return internal::Pack<T, W>::squared_distance(a, b);
+}
+
+}  // namespace simd
+}  // namespace particles
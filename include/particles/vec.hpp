@@ -9,10 +9,13 @@
 
 #include "decl_overloads.h"
 #include "expression.hpp"
+#include "simd.hpp"
 #include "util.hpp"
 
+#include <algorithm>
 #include <array>
 #include <cmath>
+#include <cstddef>
 #include <initializer_list>
 #include <ostream>
 
@@ -20,11 +23,78 @@ extern void* enabler;
 
 
 namespace particles {
+namespace internal {
+
+#if defined(__cpp_aligned_new)
+constexpr std::size_t max_vec_alignment(std::size_t bytes) { return bytes; }
+#else
+// operator new before C++17 only guarantees alignment of max_align_t
+constexpr std::size_t max_vec_alignment(std::size_t bytes) {
+  return bytes < alignof(std::max_align_t) ? bytes : alignof(std::max_align_t);
+}
+#endif
+
+/**
+ * @brief storage of Vec<T, N>
+ *
+ * width is the number of stored values. Values after N are padding and kept
+ * zero, so that whole-width arithmetic gives the same result.
+ */
+template <class T, std::size_t N>
+struct VecLayout {
+  static constexpr std::size_t width = N;
+  static constexpr std::size_t alignment = alignof(std::array<T, N>);
+};
+
+/** @brief padded to W lanes and aligned for vector registers */
+template <class T, std::size_t W>
+struct AlignedVecLayout {
+  static constexpr std::size_t width = W;
+  static constexpr std::size_t alignment = max_vec_alignment(sizeof(T) * W);
+};
+
+#ifdef PARTICLES_ALIGNED_VEC
+// Define PARTICLES_ALIGNED_VEC before including particles to make 3-d vectors
+// 4 lanes wide. This changes sizeof(Vec) and the layout of Particle.
+template <> struct VecLayout<float, 2> : AlignedVecLayout<float, 2> {};
+template <> struct VecLayout<float, 3> : AlignedVecLayout<float, 4> {};
+template <> struct VecLayout<float, 4> : AlignedVecLayout<float, 4> {};
+template <> struct VecLayout<double, 2> : AlignedVecLayout<double, 2> {};
+template <> struct VecLayout<double, 3> : AlignedVecLayout<double, 4> {};
+template <> struct VecLayout<double, 4> : AlignedVecLayout<double, 4> {};
+#endif
+
+/**
+ * @brief whether E can be evaluated at every lane of a W-wide Vec
+ *
+ * True for Vec, ET::Scalar and ET::Exp of them.
+ */
+template <class E, std::size_t W>
+struct is_lane_safe : std::false_type {};
+
+template <class T, std::size_t N, std::size_t W>
+struct is_lane_safe<Vec<T, N>, W>
+    : std::integral_constant<bool, (VecLayout<T, N>::width >= W)> {};
+
+template <class T, std::size_t W>
+struct is_lane_safe<ET::Scalar<T>, W> : std::true_type {};
+
+template <class L, class Op, class R, std::size_t W>
+struct is_lane_safe<ET::Exp<L, Op, R>, W>
+    : std::integral_constant<bool, is_lane_safe<L, W>{} &&
+                                   is_lane_safe<R, W>{}> {};
+
+}  // namespace internal
 
 /**
  * @brief N-d vector in cartesian
  * @tparam T floating point
  * @tparam N dimension
+ *
+ * If PARTICLES_ALIGNED_VEC is defined, Vec<float, 3> and Vec<double, 3> hold
+ * a zero padding lane and are aligned, so that arithmetic between Vecs runs
+ * on vector registers (see simd.hpp).
+ *
  * @todo output to ostream
  */
 template <class T, std::size_t N>
@@ -33,12 +103,14 @@ class Vec {
 
  public:
   typedef T value_type;
-  typedef std::array<T, N> array_t;
+  /** @brief number of stored values including padding */
+  static constexpr std::size_t width = internal::VecLayout<T, N>::width;
+  typedef std::array<T, width> array_t;
 
   Vec() : value_() { value_.fill(0); }
   Vec(const Vec& v) : value_(v.value_) {}
   template <class E>
-  Vec(const E& r) { for(std::size_t i=0; i<N; i++) value_[i] = r[i]; }
+  Vec(const E& r) : value_() { AssignImpl_<E, false>::apply(*this, r); }
   Vec(std::initializer_list<T> init_list);
   template <class... Args>
   Vec(Args... args);
@@ -53,7 +125,9 @@ class Vec {
   /** @brief access I-th element using std::get */
   template <std::size_t I>
   const T& get() const { return std::get<I>(value_); }
-  void fill(const T val) { value_.fill(val); }
+  void fill(const T val) {
+    std::fill(value_.begin(), value_.begin() + N, val);
+  }
   void swap(Vec& v) { value_.swap(v.value_); }
 
   value_type& x() {
@@ -86,6 +160,8 @@ class Vec {
   Vec& operator+=(const E& v);
   template <class E>
   Vec& operator-=(const E& v);
+  Vec& operator+=(const Vec& v);
+  Vec& operator-=(const Vec& v);
   Vec& operator*=(T x);
   Vec& operator/=(T x);
 
@@ -96,14 +172,18 @@ class Vec {
 
   // Iterators
   auto begin() { return value_.begin(); }
-  auto end() { return value_.end(); }
+  auto end() { return value_.begin() + N; }
   auto cbegin() const { return value_.cbegin(); }
-  auto cend() const { return value_.cend(); }
-  auto rbegin() { return value_.rbegin(); }
+  auto cend() const { return value_.cbegin() + N; }
+  auto rbegin() { return value_.rbegin() + (width - N); }
   auto rend() { return value_.rend(); }
-  auto crbegin() const { return value_.crbegin(); }
+  auto crbegin() const { return value_.crbegin() + (width - N); }
   auto crend() const { return value_.crend(); }
 
+  /** @brief pointer to the first value */
+  T* data() { return value_.data(); }
+  const T* data() const { return value_.data(); }
+
   // Mathematical functions
 
   /** @brief zero vector */
@@ -125,7 +205,11 @@ class Vec {
 
  private:
   /** @brief Container to hold values */
-  array_t value_;
+  alignas(internal::VecLayout<T, N>::alignment) array_t value_;
+
+  void clear_padding() {
+    for (std::size_t i = N; i < width; i++) value_[i] = 0;
+  }
 
   template <class U, bool IsArithmetic = std::is_arithmetic<U>{}>
   struct AssignImpl_;
@@ -136,14 +220,21 @@ class Vec {
   };
   template <class U>
   struct AssignImpl_<U, false> {
+    // Lane-safe expressions are evaluated at the padding too, which lets
+    // the compiler use a vector instruction for the whole loop.
     static void apply(Vec& v, const U& u) {
-      for (std::size_t i=0; i<N; i++) v[i] = u[i];
+      constexpr std::size_t M = internal::is_lane_safe<U, width>{} ? width : N;
+      for (std::size_t i=0; i<M; i++) v.value_[i] = u[i];
+      v.clear_padding();
     }
   };
 };
 
 template <class T, std::size_t N>
-Vec<T, N>::Vec(std::initializer_list<T> init_list) {
+constexpr std::size_t Vec<T, N>::width;
+
+template <class T, std::size_t N>
+Vec<T, N>::Vec(std::initializer_list<T> init_list) : value_() {
   /** @todo size check */
   auto it = value_.begin();
   for (auto x : init_list) *(it++) = x;
@@ -151,7 +242,7 @@ Vec<T, N>::Vec(std::initializer_list<T> init_list) {
 
 template <class T, std::size_t N>
 template <class... Args>
-Vec<T, N>::Vec(Args... args) {
+Vec<T, N>::Vec(Args... args) : value_() {
   static_assert(N == sizeof...(args), "size mismatch.");
   expression::assign(value_, args...);
 }
@@ -192,15 +283,29 @@ inline Vec<T, N>& Vec<T, N>::operator-=(const E& r) {
   return *this;
 }
 
+template <class T, std::size_t N>
+inline Vec<T, N>& Vec<T, N>::operator+=(const Vec<T, N>& v) {
+  simd::add<width>(data(), v.data());
+  return *this;
+}
+
+template <class T, std::size_t N>
+inline Vec<T, N>& Vec<T, N>::operator-=(const Vec<T, N>& v) {
+  simd::sub<width>(data(), v.data());
+  return *this;
+}
+
 template <class T, std::size_t N>
 inline Vec<T, N>& Vec<T, N>::operator*=(T x) {
-  for (std::size_t i = 0; i < N; ++i) (*this)[i] *= x;
+  simd::mul<width>(data(), x);
+  clear_padding();  // 0 * inf
   return *this;
 }
 
 template <class T, std::size_t N>
 inline Vec<T, N>& Vec<T, N>::operator/=(T x) {
-  for (std::size_t i = 0; i < N; ++i) (*this)[i] /= x;
+  simd::div<width>(data(), x);
+  clear_padding();  // 0 / 0
   return *this;
 }
 
@@ -211,15 +316,12 @@ inline auto Vec<T, N>::operator*(const Vec<T, N>& u) const {
 
 template <class T, std::size_t N>
 inline T Vec<T, N>::squared_distance(const Vec<T, N>& v) const {
-  T d = 0;
-  for (std::size_t i = 0; i < N; ++i)
-    d += ((*this)[i] - v[i]) * ((*this)[i] - v[i]);
-  return d;
+  return simd::squared_distance<width>(data(), v.data());
 }
 
 template <class T, std::size_t N>
 inline T Vec<T, N>::squared_length() const {
-  return Vec<T, N>::squared_distance(Vec<T, N>::zero());
+  return dot(*this);
 }
 
 template <class T, std::size_t N>
@@ -234,14 +336,14 @@ inline T Vec<T, N>::length() const {
 
 template <class T, std::size_t N>
 inline T Vec<T, N>::dot(const Vec<T, N>& v) const {
-  return inner_prod(*this, v);
+  return simd::dot<width>(data(), v.data());
 }
 
 template <class T, std::size_t N>
 inline Vec<T,N>& Vec<T, N>::normalize(T len) {
-  if (length() == 0) return *this;  // zero vector
-  *this /= length();
-  return *this *= len;
+  const T l = length();
+  if (l == 0) return *this;  // zero vector
+  return *this *= len / l;
 }
 
 template <class T, std::size_t N>
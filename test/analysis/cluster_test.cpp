@@ -0,0 +1,74 @@
+#include "particles/analysis/cluster.hpp"
+#include "particles/random.hpp"
+
+#include <gtest/gtest.h>
+
+#include <queue>
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 2> P2;
+
+TEST(ClusterTest, chains) {
+  // 0-1-2  3  4-5
+  std::vector<P2> particles(6);
+  std::vector<std::vector<const P2*>> adjacency_list(6);
+  auto link = [&](int i, int j) {
+    adjacency_list[i].push_back(&particles[j]);
+    adjacency_list[j].push_back(&particles[i]);
+  };
+  link(1, 2);
+  link(0, 1);
+  link(5, 4);
+  adjacency_list[3].push_back(&particles[3]);
+
+  auto c = analysis::clusters(particles, adjacency_list);
+  ASSERT_EQ(3, c.num_clusters());
+  EXPECT_EQ((std::vector<std::size_t>{0, 0, 0, 1, 2, 2}), c.label);
+  EXPECT_EQ((std::vector<std::size_t>{3, 1, 2}), c.sizes);
+  EXPECT_EQ((std::vector<std::size_t>{0, 1, 1, 1}), c.size_distribution());
+}
+
+TEST(ClusterTest, random_graph) {
+  const std::size_t n = 20000;
+  random::UniformGenerator<std::size_t> gen(0, n - 1);
+  gen.seed(3);
+  std::vector<P2> particles(n);
+  std::vector<std::vector<const P2*>> adjacency_list(n);
+  for (std::size_t e = 0; e < n * 2 / 3; e++) {
+    std::size_t i = gen, j = gen;
+    adjacency_list[i].push_back(&particles[j]);
+  }
+  parallel::set_num_threads(4);
+  auto c = analysis::clusters(particles, adjacency_list);
+  parallel::set_num_threads(0);
+
+  // serial BFS on undirected graph
+  std::vector<std::vector<std::size_t>> graph(n);
+  for (std::size_t i = 0; i < n; i++) {
+    for (auto* q : adjacency_list[i]) {
+      graph[i].push_back(q - particles.data());
+      graph[q - particles.data()].push_back(i);
+    }
+  }
+  std::vector<long> label(n, -1);
+  std::vector<std::size_t> sizes;
+  for (std::size_t s = 0; s < n; s++) {
+    if (label[s] >= 0) continue;
+    std::queue<std::size_t> q;
+    q.push(s);
+    label[s] = sizes.size();
+    sizes.push_back(0);
+    while (!q.empty()) {
+      auto i = q.front();
+      q.pop();
+      sizes.back()++;
+      for (auto j : graph[i]) {
+        if (label[j] < 0) { label[j] = label[s]; q.push(j); }
+      }
+    }
+  }
+  ASSERT_EQ(sizes, c.sizes);
+  for (std::size_t i = 0; i < n; i++) ASSERT_EQ(label[i], c.label[i]);
+}
@@ -0,0 +1,75 @@
+#include "particles/analysis/pipeline.hpp"
+
+#include <gtest/gtest.h>
+
+#include <sstream>
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 2> P2;
+
+class PipelineTest : public ::testing::Test {
+ protected:
+  typedef analysis::StageBase<double, 2>::adjacency_list_type
+      adjacency_list_type;
+
+  virtual void SetUp() {
+    particles.push_back(P2({0.5, 0.5}, {1, 0}));
+    particles.push_back(P2({0.6, 0.5}, {1, 0}));
+    particles.push_back(P2({1.5, 1.5}, {0, 1}));
+    particles.push_back(P2({1.5, 0.5}, {0, -1}));
+    adjacency_list.resize(particles.size());
+    adjacency_list[0] = {&particles[0], &particles[1]};
+    adjacency_list[1] = {&particles[1], &particles[0]};
+    adjacency_list[2] = {&particles[2]};
+    adjacency_list[3] = {&particles[3]};
+  }
+  std::vector<P2> particles;
+  adjacency_list_type adjacency_list;
+  std::stringstream ss;
+};
+
+TEST_F(PipelineTest, PolarOrder) {
+  analysis::PolarOrder<double, 2> stage(ss, 1.0);
+  stage.observe(3, particles, adjacency_list);
+  EXPECT_DOUBLE_EQ(0.5, stage.value());
+  EXPECT_EQ("3 0.5\n", ss.str());
+}
+
+TEST_F(PipelineTest, NeighborCount) {
+  analysis::NeighborCount<double, 2> stage(ss);
+  stage.observe(0, particles, adjacency_list);
+  EXPECT_DOUBLE_EQ(1.5, stage.mean());
+  EXPECT_DOUBLE_EQ(0.25, stage.variance());
+  EXPECT_EQ("0 1.5 0.25 1 2\n", ss.str());
+}
+
+TEST_F(PipelineTest, DensityHistogram) {
+  analysis::DensityHistogram<double, 2> stage(ss, {0, 0}, {2, 2}, 2);
+  stage.observe(0, particles, adjacency_list);
+  // boxes: 2, 1, 1, 0 particles
+  const auto& h = stage.histogram();
+  ASSERT_EQ(3, h.size());
+  EXPECT_EQ(1, h[0]);
+  EXPECT_EQ(2, h[1]);
+  EXPECT_EQ(1, h[2]);
+  EXPECT_EQ("0 1 2 1\n", ss.str());
+}
+
+TEST_F(PipelineTest, every) {
+  analysis::Pipeline<double, 2> pipeline;
+  std::stringstream ss2;
+  pipeline.emplace<analysis::PolarOrder<double, 2>>(2, ss, 1.0);
+  pipeline.emplace<analysis::NeighborCount<double, 2>>(3, ss2);
+  EXPECT_EQ(2, pipeline.size());
+
+  for (std::size_t t = 0; t < 7; t++) pipeline(t, particles, adjacency_list);
+
+  std::size_t lines = 0, lines2 = 0;
+  std::string line;
+  while (std::getline(ss, line)) lines++;
+  while (std::getline(ss2, line)) lines2++;
+  EXPECT_EQ(4, lines);   // 0, 2, 4, 6
+  EXPECT_EQ(3, lines2);  // 0, 3, 6
+}
@@ -0,0 +1,66 @@
+#include "particles/analysis/rdf.hpp"
+#include "particles/random.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 2> P2;
+typedef Particle<double, 3> P3;
+
+TEST(RDFTest, lattice) {
+  // square lattice with spacing 1
+  std::vector<P2> particles;
+  for (int x = 0; x < 10; x++) {
+    for (int y = 0; y < 10; y++) particles.push_back(P2{x + 0.5, y + 0.5});
+  }
+  boundary::PeriodicBoundary<double, 2> boundary(10.);
+  auto g = analysis::rdf(particles, boundary, 1.6, 16);
+
+  ASSERT_EQ(16, g.counts.size());
+  EXPECT_DOUBLE_EQ(0.05, g.r[0]);
+  std::size_t total = 0;
+  for (auto c : g.counts) total += c;
+  EXPECT_EQ(100 * 8, total);           // 4 at r=1, 4 at r=sqrt(2)
+  EXPECT_EQ(100 * 4, g.counts[10]);    // [1.0, 1.1)
+  EXPECT_EQ(100 * 4, g.counts[14]);    // [1.4, 1.5)
+}
+
+TEST(RDFTest, ideal_gas) {
+  random::UniformGenerator<double> gen(0, 20);
+  gen.seed(1);
+  std::vector<P3> particles(8000);
+  for (auto& p : particles) p.position() = gen;
+
+  boundary::PeriodicBoundary<double, 3> boundary(20.);
+  auto g = analysis::rdf(particles, boundary, 4.0, 4);
+  for (auto x : g.g) EXPECT_NEAR(1.0, x, 0.1);
+}
+
+TEST(RDFTest, adjacency_list) {
+  random::UniformGenerator<double> gen(0, 5);
+  gen.seed(2);
+  std::vector<P2> particles(300);
+  for (auto& p : particles) p.position() = gen;
+  boundary::PeriodicBoundary<double, 2> boundary(5.);
+
+  // all pairs within r_max (including itself)
+  std::vector<std::vector<const P2*>> adjacency_list(particles.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    const auto& x = particles[i].position();
+    for (const auto& q : particles) {
+      if (boundary.squared_distance(x, q.position()) < 4) {
+        adjacency_list[i].push_back(&q);
+      }
+    }
+  }
+  auto g1 = analysis::rdf(particles, adjacency_list, boundary, 2.0, 10);
+  auto g2 = analysis::rdf(particles, boundary, 2.0, 10);
+  ASSERT_EQ(g1.counts.size(), g2.counts.size());
+  for (std::size_t k = 0; k < g1.counts.size(); k++) {
+    EXPECT_EQ(g1.counts[k], g2.counts[k]);
+    EXPECT_DOUBLE_EQ(g1.g[k], g2.g[k]);
+  }
+}
@@ -0,0 +1,68 @@
+#include "particles/analysis/reduction.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 2> P2;
+
+TEST(ReductionTest, Statistics) {
+  analysis::Statistics a, b, all;
+  for (int i = 0; i < 10; i++) {
+    (i < 3 ? a : b).add(i);
+    all.add(i);
+  }
+  auto s = analysis::Statistics::merge(a, b);
+  EXPECT_EQ(10, s.count);
+  EXPECT_DOUBLE_EQ(4.5, s.mean);
+  EXPECT_DOUBLE_EQ(8.25, s.variance);
+  EXPECT_DOUBLE_EQ(8.25, all.variance);
+  EXPECT_DOUBLE_EQ(0, s.min);
+  EXPECT_DOUBLE_EQ(9, s.max);
+}
+
+TEST(ReductionTest, polar_order) {
+  std::vector<P2> particles;
+  EXPECT_DOUBLE_EQ(0, analysis::polar_order(particles, 1.0));
+
+  for (int i = 0; i < 100000; i++) {
+    particles.push_back(P2({0, 0}, {0, 2}));
+  }
+  EXPECT_DOUBLE_EQ(1, analysis::polar_order(particles, 2.0));
+
+  for (std::size_t i = 1; i < particles.size(); i += 2) {
+    particles[i].velocity(1) *= -1;
+  }
+  particles[0].velocity() = {2, 0};
+  EXPECT_NEAR(std::sqrt(2.0) / particles.size(),
+              analysis::polar_order(particles, 2.0), 1e-12);
+}
+
+TEST(ReductionTest, neighbor_statistics) {
+  std::vector<std::vector<const P2*>> adjacency_list(100000);
+  for (std::size_t i = 0; i < adjacency_list.size(); i++) {
+    adjacency_list[i].resize(i % 2 == 0 ? 1 : 3);
+  }
+  auto s = analysis::neighbor_statistics(adjacency_list);
+  EXPECT_EQ(100000, s.count);
+  EXPECT_DOUBLE_EQ(2, s.mean);
+  EXPECT_NEAR(1, s.variance, 1e-12);
+  EXPECT_DOUBLE_EQ(1, s.min);
+  EXPECT_DOUBLE_EQ(3, s.max);
+}
+
+TEST(ReductionTest, velocity_histogram) {
+  std::vector<P2> particles;
+  for (int i = 0; i < 100000; i++) {
+    particles.push_back(P2({0, 0}, {0.0, (i % 4) * 0.5 + 0.25}));
+  }
+  particles[0].velocity() = {3, 4};  // out of range
+  auto h = analysis::velocity_histogram(particles, 2.0, 4);
+  ASSERT_EQ(4, h.size());
+  EXPECT_EQ(24999, h[0]);
+  EXPECT_EQ(25000, h[1]);
+  EXPECT_EQ(25000, h[2]);
+  EXPECT_EQ(25000, h[3]);
+}
@@ -49,3 +49,17 @@ TEST(BoundaryTest, PeriodicBoundaryConstructor) {
   EXPECT_DOUBLE_EQ(0.2, p.position(0));
   EXPECT_DOUBLE_EQ(0.9, p.position(1));
 }
+
+TEST(BoundaryTest, PeriodicBoundaryDisplacement) {
+  boundary::PeriodicBoundary<double, 2> pb(0., 10., -1., 1.);
+  EXPECT_DOUBLE_EQ(10, pb.length(0));
+  EXPECT_DOUBLE_EQ(2, pb.length(1));
+  EXPECT_DOUBLE_EQ(-1, pb.left()[1]);
+  EXPECT_DOUBLE_EQ(10, pb.right()[0]);
+
+  Vec<double, 2> u {0.5, -0.9}, v {9.5, 0.8};
+  auto d = pb.displacement(u, v);
+  EXPECT_DOUBLE_EQ(-1.0, d[0]);
+  EXPECT_NEAR(-0.3, d[1], 1e-12);
+  EXPECT_NEAR(1.09, pb.squared_distance(u, v), 1e-12);
+}
@@ -0,0 +1,161 @@
+#include "particles/domain.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 2, int> P2;  // info is id
+
+std::vector<P2> random_particles(std::size_t n, double lx, double ly) {
+  std::mt19937 engine(0);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<P2> particles(n);
+  for (std::size_t i = 0; i < n; i++) {
+    particles[i].position() = {lx * uniform(engine), ly * uniform(engine)};
+    particles[i].velocity() = {uniform(engine) - 0.5, uniform(engine) - 0.5};
+    particles[i].info() = static_cast<int>(i);
+  }
+  return particles;
+}
+
+TEST(DomainTest, InProcessTransport) {
+  domain::InProcessTransport<int> transport(2);
+  std::thread sender([&transport] {
+    for (int k = 0; k < 100; k++) transport.send(0, 1, k % 2, {k});
+  });
+  for (int k = 0; k < 100; k += 2) {
+    EXPECT_EQ(std::vector<int>{k + 1}, transport.receive(1, 0, 1));
+    EXPECT_EQ(std::vector<int>{k}, transport.receive(1, 0, 0));
+  }
+  sender.join();
+}
+
+TEST(DomainTest, Grid) {
+  boundary::PeriodicBoundary<double, 2> boundary(0., 12., 0., 4.);
+  domain::Grid<double, 2> grid(boundary, 6);
+  EXPECT_EQ(6u, grid.size());
+  EXPECT_EQ(6u, grid.dims()[0]);
+  EXPECT_EQ(1u, grid.dims()[1]);
+  EXPECT_EQ(5u, grid.rank(Vec<double, 2>{11.5, 3}));
+  EXPECT_DOUBLE_EQ(4, grid.lower(2, 0));
+  EXPECT_EQ((std::vector<std::size_t>{1, 5}), grid.neighbors(0));
+  EXPECT_EQ(1u, grid.next_hop(0, 2));
+  EXPECT_EQ(5u, grid.next_hop(0, 4));  // across the periodic boundary
+  EXPECT_EQ(3u, grid.max_hops());
+}
+
+// ghosts of subdomains give periodic neighbors
+void check_halo(std::size_t count) {
+  const double r = 0.7;
+  boundary::PeriodicBoundary<double, 2> boundary(0., 6., 0., 5.);
+  const auto particles = random_particles(400, 6, 5);
+  domain::DomainDecomposition<double, 2, int> dd(boundary, count, r);
+  dd.scatter(particles);
+
+  // neighbors of each particle (by id) seen by the subdomains
+  std::mutex mutex;
+  std::vector<std::vector<int>> found(particles.size());
+  dd.run(1, [&](domain::Subdomain<double, 2, int>& s, std::size_t) {
+    const auto& ps = s.particles();
+    for (std::size_t i = 0; i < s.num_owned(); i++) {
+      std::vector<int> ids;
+      for (std::size_t k = 0; k < ps.size(); k++) {
+        if (k != i && ps[i].position().squared_distance(ps[k].position()) <=
+                          r * r) {
+          ids.push_back(ps[k].info());
+        }
+      }
+      std::sort(ids.begin(), ids.end());
+      std::lock_guard<std::mutex> lock(mutex);
+      found[ps[i].info()] = ids;
+    }
+  });
+
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    std::vector<int> expected;
+    for (std::size_t j = 0; j < particles.size(); j++) {
+      if (i != j && boundary.squared_distance(particles[i].position(),
+                                              particles[j].position()) <=
+                        r * r) {
+        expected.push_back(static_cast<int>(j));
+      }
+    }
+    EXPECT_EQ(expected, found[i]);
+  }
+}
+
+// particles moved in subdomains end up as if moved in a single box
+void check_migrate(std::size_t count) {
+  boundary::PeriodicBoundary<double, 2> boundary(0., 6., 0., 5.);
+  auto particles = random_particles(400, 6, 5);
+  domain::DomainDecomposition<double, 2, int> dd(boundary, count, 0.5);
+  dd.scatter(particles);
+
+  const double dt = 0.1;
+  const std::size_t steps = 30;
+  dd.run(steps, [&](domain::Subdomain<double, 2, int>& s, std::size_t) {
+    for (std::size_t i = 0; i < s.num_owned(); i++) {
+      auto& p = s.particles()[i];
+      p.position() += p.velocity() * dt;
+    }
+  });
+
+  // every particle is owned once by the subdomain containing it
+  for (std::size_t r = 0; r < dd.size(); r++) {
+    const auto& s = dd.subdomain(r);
+    for (std::size_t i = 0; i < s.num_owned(); i++) {
+      EXPECT_EQ(r, dd.grid().rank(s.particles()[i].position()));
+    }
+  }
+  auto result = dd.gather();
+  ASSERT_EQ(particles.size(), result.size());
+  std::sort(result.begin(), result.end(), [](const P2& a, const P2& b) {
+    return a.info() < b.info();
+  });
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    auto& p = particles[i];
+    for (std::size_t t = 0; t < steps; t++) {
+      p.position() += p.velocity() * dt;
+    }
+    const auto d = boundary.displacement(p.position(), result[i].position());
+    EXPECT_NEAR(0, d.length(), 1e-9);
+  }
+}
+
+// particles jumping over subdomains are passed on to their owners
+TEST(DomainTest, migrate_far) {
+  boundary::PeriodicBoundary<double, 2> boundary(0., 12., 0., 4.);
+  auto particles = random_particles(200, 12, 4);
+  domain::DomainDecomposition<double, 2, int> dd(boundary, 6, 0.5);
+  dd.scatter(particles);
+  dd.run(1, [&](domain::Subdomain<double, 2, int>& s, std::size_t) {
+    for (std::size_t i = 0; i < s.num_owned(); i++) {
+      auto& p = s.particles()[i];
+      p.position()[0] += p.info() % 2 ? 6.5 : -5.0;  // 2 to 3 subdomains
+    }
+  });
+
+  std::size_t total = 0;
+  for (std::size_t r = 0; r < dd.size(); r++) {
+    const auto& s = dd.subdomain(r);
+    total += s.num_owned();
+    for (std::size_t i = 0; i < s.num_owned(); i++) {
+      EXPECT_EQ(r, dd.grid().rank(s.particles()[i].position()));
+    }
+  }
+  EXPECT_EQ(particles.size(), total);
+}
+
+TEST(DomainTest, halo) {
+  for (std::size_t count : {1, 2, 4, 6}) check_halo(count);
+}
+
+TEST(DomainTest, migrate) {
+  for (std::size_t count : {1, 2, 4, 6}) check_migrate(count);
+}
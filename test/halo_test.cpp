@@ -0,0 +1,107 @@
+#include "particles/halo.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 2> P2;
+
+// neighbors of originals within r in the minimum image convention
+std::vector<std::vector<std::size_t>> minimum_image(
+    const std::vector<P2>& particles,
+    const boundary::PeriodicBoundary<double, 2>& boundary, double r) {
+  std::vector<std::vector<std::size_t>> neighbors(particles.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    for (std::size_t j = 0; j < particles.size(); j++) {
+      if (i != j && boundary.squared_distance(particles[i].position(),
+                                              particles[j].position()) <=
+                        r * r) {
+        neighbors[i].push_back(j);
+      }
+    }
+  }
+  return neighbors;
+}
+
+// neighbors of originals within r in the extended array
+std::vector<std::vector<std::size_t>> extended_neighbors(
+    const std::vector<P2>& extended, std::size_t n,
+    const boundary::Halo<double, 2>& halo, double r) {
+  std::vector<std::vector<std::size_t>> neighbors(n);
+  for (std::size_t i = 0; i < n; i++) {
+    for (std::size_t k = 0; k < extended.size(); k++) {
+      if (k != i && extended[i].position().squared_distance(
+                        extended[k].position()) <= r * r) {
+        neighbors[i].push_back(halo.origin(k));
+      }
+    }
+    std::sort(neighbors[i].begin(), neighbors[i].end());
+  }
+  return neighbors;
+}
+
+TEST(HaloTest, update) {
+  boundary::PeriodicBoundary<double, 2> boundary(0., 1., 0., 2.);
+  const double r = 0.15;
+  boundary::Halo<double, 2> halo(boundary, r, 0.05);
+
+  std::mt19937 engine(0);
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::uniform_real_distribution<double> step(-0.005, 0.005);
+  std::vector<P2> particles(400), extended;
+  for (auto& p : particles) {
+    p.position() = {uniform(engine), 2 * uniform(engine)};
+  }
+
+  std::size_t rebuilds = 0;
+  for (int t = 0; t < 40; t++) {
+    rebuilds += halo.update(particles, extended);
+    ASSERT_EQ(particles.size() + halo.size(), extended.size());
+    EXPECT_EQ(minimum_image(particles, boundary, r),
+              extended_neighbors(extended, particles.size(), halo, r));
+
+    for (auto& p : particles) {
+      p.position() += Vec<double, 2>{step(engine), step(engine)};
+      boundary.apply(p);
+    }
+  }
+  EXPECT_GT(rebuilds, 1u);
+  EXPECT_LT(rebuilds, 20u);
+}
+
+TEST(HaloTest, corners) {
+  // a particle at a corner has images at 3 sides in 2d
+  boundary::PeriodicBoundary<double, 2> boundary(1.);
+  boundary::Halo<double, 2> halo(boundary, 0.1);
+  std::vector<P2> particles{P2{0.05, 0.95}, P2{0.5, 0.5}}, extended;
+  halo.update(particles, extended);
+
+  ASSERT_EQ(3u, halo.size());
+  EXPECT_EQ(5u, extended.size());
+  for (std::size_t k = 2; k < extended.size(); k++) {
+    EXPECT_EQ(0u, halo.origin(k));
+  }
+  std::vector<Vec<double, 2>> expected{{1.05, 0.95}, {0.05, -0.05},
+                                       {1.05, -0.05}};
+  for (std::size_t g = 0; g < 3; g++) {
+    EXPECT_NEAR(0, extended[2 + g].position().distance(expected[g]), 1e-12);
+  }
+}
+
+TEST(HaloTest, fold) {
+  boundary::PeriodicBoundary<double, 2> boundary(1.);
+  boundary::Halo<double, 2> halo(boundary, 0.1);
+  std::vector<P2> particles{P2{0.05, 0.5}, P2{0.5, 0.5}}, extended;
+  halo.update(particles, extended);
+  ASSERT_EQ(1u, halo.size());
+
+  std::vector<double> forces{1, 2, 10};
+  halo.fold(forces);
+  ASSERT_EQ(2u, forces.size());
+  EXPECT_DOUBLE_EQ(11, forces[0]);
+  EXPECT_DOUBLE_EQ(2, forces[1]);
+}
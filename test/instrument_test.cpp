@@ -0,0 +1,166 @@
+#define PARTICLES_TRACE  // and PARTICLES_INSTRUMENT
+#include "particles/instrument.hpp"
+#include "particles/boundary.hpp"
+#include "particles/io.hpp"
+#include "particles/parallel.hpp"
+#include "particles/random.hpp"
+
+#include <gtest/gtest.h>
+
+#include <set>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace particles;
+
+class InstrumentTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() { instrument::reset(); }
+};
+
+void sleep_timed() {
+  PARTICLES_TIME("test.sleep");
+  std::this_thread::sleep_for(std::chrono::milliseconds(2));
+}
+
+TEST_F(InstrumentTest, timer) {
+  for (int i = 0; i < 3; i++) sleep_timed();
+  auto& t = instrument::registry().timer("test.sleep");
+  EXPECT_EQ(3, t.count());
+  EXPECT_GE(t.min(), 2000000);
+  EXPECT_LE(t.min(), t.max());
+  EXPECT_GE(t.total(), 3 * t.min());
+
+  instrument::reset();
+  EXPECT_EQ(0, t.count());
+  EXPECT_EQ(0, t.total());
+  EXPECT_EQ(0, t.min());
+
+  { instrument::ScopedTimer scope(t); }
+  EXPECT_EQ(1, t.count());
+}
+
+TEST_F(InstrumentTest, counter) {
+  parallel::set_num_threads(4);
+  parallel::for_each(10000, [](std::size_t) {
+    PARTICLES_COUNT("test.count", 1);
+  }, 100);
+  parallel::set_num_threads(0);
+  EXPECT_EQ(10000, instrument::registry().counter("test.count").value());
+}
+
+TEST_F(InstrumentTest, histogram) {
+  for (std::uint64_t v : {0, 1, 2, 3, 4, 100}) {
+    PARTICLES_HISTOGRAM("test.histogram", v);
+  }
+  const auto& h = instrument::registry().histogram("test.histogram");
+  EXPECT_EQ(6, h.count());
+  EXPECT_EQ(110, h.sum());
+  EXPECT_EQ(100, h.max());
+  EXPECT_EQ(1, h.bin_count(0));  // 0
+  EXPECT_EQ(1, h.bin_count(1));  // 1
+  EXPECT_EQ(2, h.bin_count(2));  // 2, 3
+  EXPECT_EQ(1, h.bin_count(3));  // 4
+  EXPECT_EQ(1, h.bin_count(7));  // 64 ... 127
+  EXPECT_EQ(64u, instrument::Histogram::lower(7));
+}
+
+TEST_F(InstrumentTest, hooks) {
+  boundary::PeriodicBoundary<double, 2> boundary(1.);
+  std::vector<Particle<double, 2>> particles(10);
+  for (auto& p : particles) boundary.apply(p);
+  std::ostringstream os;
+  io::output_particles(os, particles.begin(), particles.end());
+  random::UniformGenerator<double> uniform(0, 1);
+  for (int i = 0; i < 5; i++) uniform.get();
+
+  auto& r = instrument::registry();
+  EXPECT_EQ(10, r.counter("boundary.periodic.apply").value());
+  EXPECT_EQ(10, r.counter("io.particles_written").value());
+  EXPECT_EQ(1, r.timer("io.output_particles").count());
+  EXPECT_EQ(5, r.counter("random.draws").value());
+}
+
+TEST_F(InstrumentTest, report) {
+  instrument::reset();
+  PARTICLES_COUNT("test.report \"quoted\"", 7);
+  PARTICLES_HISTOGRAM("test.report", 5);
+  { PARTICLES_TIME("test.report"); }
+
+  std::ostringstream json;
+  instrument::write_json(json, 3);
+  const auto s = json.str();
+  EXPECT_EQ(0u, s.find("{\"step\": 3, \"timers\": {"));
+  EXPECT_NE(std::string::npos, s.find("\"test.report \\\"quoted\\\"\": 7"));
+  EXPECT_NE(std::string::npos,
+            s.find("\"test.report\": {\"count\": 1, \"sum\": 5, \"max\": 5, "
+                   "\"bins\": [[4, 1]]}"));
+  EXPECT_EQ("}}\n", s.substr(s.size() - 3));
+
+  std::ostringstream csv;
+  instrument::write_csv_header(csv);
+  instrument::write_csv(csv, 3);
+  EXPECT_EQ(0u, csv.str().find("step,kind,name,count,total,min,max\n"));
+  EXPECT_NE(std::string::npos, csv.str().find("\n3,timer,test.report,1,"));
+  EXPECT_NE(std::string::npos,
+            csv.str().find("\n3,counter,test.report \"quoted\",,7,,\n"));
+  EXPECT_NE(std::string::npos,
+            csv.str().find("\n3,histogram,test.report,1,5,,5\n"));
+}
+
+std::size_t count(const std::string& s, const std::string& pattern) {
+  std::size_t n = 0;
+  for (auto i = s.find(pattern); i != std::string::npos;
+       i = s.find(pattern, i + 1)) {
+    n++;
+  }
+  return n;
+}
+
+TEST_F(InstrumentTest, trace) {
+  instrument::clear_trace();
+  parallel::set_num_threads(4);
+  for (int t = 0; t < 3; t++) {
+    PARTICLES_TIME("test.step");
+    parallel::for_each_block(1000, [](std::size_t, std::size_t, std::size_t) {
+      std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }, 10);
+  }
+  parallel::set_num_threads(0);
+
+  std::ostringstream os;
+  instrument::write_trace(os);
+  const auto s = os.str();
+  EXPECT_EQ(0u, s.find("{\"traceEvents\": ["));
+  EXPECT_EQ("\n], \"displayTimeUnit\": \"ms\"}\n",
+            s.substr(s.size() - 29));
+  EXPECT_EQ(3u, count(s, "\"name\": \"test.step\""));
+  EXPECT_EQ(12u, count(s, "\"name\": \"parallel.block\""));
+  // blocks of workers are on lanes other than that of the main thread
+  const std::string lane = "\"ph\": \"X\", \"pid\": 1, \"tid\": ";
+  std::set<std::string> lanes;
+  for (auto i = s.find(lane); i != std::string::npos; i = s.find(lane, i + 1)) {
+    lanes.insert(s.substr(i + lane.size(), s.find(',', i + lane.size()) -
+                                               i - lane.size()));
+  }
+  EXPECT_GE(lanes.size(), 2u);
+
+  instrument::clear_trace();
+  std::ostringstream cleared;
+  instrument::write_trace(cleared);
+  EXPECT_EQ(0u, count(cleared.str(), "\"ph\": \"X\""));
+}
+
+TEST_F(InstrumentTest, ring_buffer) {
+  instrument::internal::TraceBuffer buffer(0, 8);
+  for (int i = 0; i < 20; i++) buffer.push({nullptr, i, i + 1});
+  std::vector<std::int64_t> begins;
+  buffer.for_each([&begins](const instrument::internal::TraceEvent& e) {
+    begins.push_back(e.begin);
+  });
+  EXPECT_EQ((std::vector<std::int64_t>{12, 13, 14, 15, 16, 17, 18, 19}),
+            begins);
+  EXPECT_EQ(12u, buffer.dropped());
+}
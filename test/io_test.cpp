@@ -135,3 +135,67 @@ TEST_F(IOTest, csv_out_tie) {
   csv_out(ss, ",", std::tie(a, b, c)) << "@";
   EXPECT_EQ("1,2,3@", ss.str());
 }
+
+class FrameReaderTest : public IOTest {
+ protected:
+  typedef Particle<double, 2> P;
+  virtual void SetUp() {
+    IOTest::SetUp();
+    frames.resize(3);
+    for (int t = 0; t < 3; t++) {
+      for (int i = 0; i <= t; i++) {
+        frames[t].push_back(P({t + 0.5, i * 0.25}, {-1.0 * i, 2.0 * t}));
+      }
+    }
+  }
+  void expect_frames(io::FrameReader<double, 2>& reader) {
+    std::size_t t = 0;
+    for (const auto& frame : reader) {
+      ASSERT_LT(t, frames.size());
+      ASSERT_EQ(frames[t].size(), frame.size());
+      for (std::size_t i = 0; i < frame.size(); i++) {
+        EXPECT_EQ(frames[t][i].position(), frame[i].position());
+        EXPECT_EQ(frames[t][i].velocity(), frame[i].velocity());
+      }
+      t++;
+    }
+    EXPECT_EQ(frames.size(), t);
+  }
+  std::vector<std::vector<P>> frames;
+};
+
+TEST_F(FrameReaderTest, text) {
+  // Same layout as example/vicsek2.cpp
+  ss << "x\ty\tu\tv" << std::endl;
+  for (const auto& frame : frames) {
+    io::output_particles(ss, frame.begin(), frame.end(), "\t") << "\n\n";
+  }
+  io::FrameReader<double, 2> reader(ss);
+  expect_frames(reader);
+}
+
+TEST_F(FrameReaderTest, binary) {
+  for (const auto& frame : frames) {
+    io::output_particles_binary(ss, frame.begin(), frame.end());
+  }
+  io::FrameReader<double, 2> reader(ss, io::Format::binary);
+  expect_frames(reader);
+}
+
+TEST_F(FrameReaderTest, position_only) {
+  ss << "1 2\n3 4\n\n5 6\n";
+  io::FrameReader<double, 2> reader(ss);
+  auto it = reader.begin();
+  ASSERT_EQ(2, it->size());
+  EXPECT_DOUBLE_EQ(3, (*it)[1].position(0));
+  EXPECT_DOUBLE_EQ(0, (*it)[1].velocity(1));
+  ++it;
+  ASSERT_EQ(1, it->size());
+  EXPECT_DOUBLE_EQ(6, (*it)[0].position(1));
+  EXPECT_TRUE(++it == reader.end());
+}
+
+TEST_F(FrameReaderTest, empty) {
+  io::FrameReader<double, 2> reader(ss);
+  EXPECT_TRUE(reader.begin() == reader.end());
+}
@@ -0,0 +1,273 @@
+#include "particles/longrange.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <random>
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 3> P3;
+
+// softened gravity
+Vec<double, 3> gravity(const Vec<double, 3>& r, double m) {
+  const double s = r.squared_length() + 1e-6;
+  return Vec<double, 3>(r * (-m / (s * std::sqrt(s))));
+}
+
+std::vector<Vec<double, 3>> direct_sum(const std::vector<P3>& particles,
+                                       const std::vector<double>& masses) {
+  std::vector<Vec<double, 3>> field(particles.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    for (std::size_t j = 0; j < particles.size(); j++) {
+      if (i == j) continue;
+      const Vec<double, 3> r = particles[i].position() -
+                               particles[j].position();
+      field[i] += gravity(r, masses[j]);
+    }
+  }
+  return field;
+}
+
+class BarnesHutTest : public ::testing::Test {
+ protected:
+  void SetUp() {
+    std::mt19937 engine(0);
+    std::normal_distribution<double> normal(0, 1);
+    std::uniform_real_distribution<double> uniform(0.5, 1.5);
+    particles.resize(2000);
+    masses.resize(particles.size());
+    for (std::size_t i = 0; i < particles.size(); i++) {
+      // two clusters
+      const double c = i % 2 ? 3 : -3;
+      particles[i].position() = {c + normal(engine), normal(engine),
+                                 normal(engine)};
+      masses[i] = uniform(engine);
+    }
+    expected = direct_sum(particles, masses);
+  }
+
+  std::vector<P3> particles;
+  std::vector<double> masses;
+  std::vector<Vec<double, 3>> expected;
+};
+
+TEST_F(BarnesHutTest, exact) {
+  longrange::BarnesHut<double, 3> tree(0);
+  tree.build(particles, masses);
+  std::vector<Vec<double, 3>> field;
+  tree.evaluate(particles, gravity, field);
+
+  ASSERT_EQ(particles.size(), field.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    EXPECT_LT(field[i].distance(expected[i]), 1e-9 * expected[i].length());
+  }
+}
+
+TEST_F(BarnesHutTest, approximate) {
+  for (double theta : {0.3, 0.6}) {
+    longrange::BarnesHut<double, 3> tree(theta, 4);
+    tree.build(particles, masses);
+    std::vector<Vec<double, 3>> field;
+    tree.evaluate(particles, gravity, field);
+
+    double error = 0, norm = 0;
+    for (std::size_t i = 0; i < particles.size(); i++) {
+      error += field[i].squared_distance(expected[i]);
+      norm += expected[i].squared_length();
+    }
+    EXPECT_LT(std::sqrt(error / norm), theta * theta / 10);
+  }
+}
+
+TEST(BarnesHut, degenerate) {
+  // empty, single particle and particles at the same position
+  longrange::BarnesHut<double, 2> tree(0.5, 1);
+  std::vector<Particle<double, 2>> particles;
+  std::vector<Vec<double, 2>> field;
+  auto kernel = [](const Vec<double, 2>& r, double w) {
+    return Vec<double, 2>(r * w);
+  };
+  tree.build(particles);
+  tree.evaluate(particles, kernel, field);
+  EXPECT_TRUE(field.empty());
+
+  particles.resize(1);
+  tree.build(particles);
+  tree.evaluate(particles, kernel, field);
+  EXPECT_EQ(0, field[0].length());
+
+  particles.resize(10, Particle<double, 2>{1, 1});
+  particles[0].position() = {0, 0};
+  tree.build(particles);
+  tree.evaluate(particles, kernel, field);
+  EXPECT_DOUBLE_EQ(-9, field[0][0]);
+  EXPECT_DOUBLE_EQ(1, field[1][0]);
+}
+
+template <std::size_t N, class Kernel>
+double fmm_error(std::size_t order) {
+  std::mt19937 engine(1);
+  std::normal_distribution<double> normal(0, 1);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  std::vector<Particle<double, N>> particles(1500);
+  std::vector<double> charges(particles.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    // a dense and a sparse cluster
+    const double scale = i % 4 ? 0.5 : 2;
+    for (std::size_t d = 0; d < N; d++) {
+      particles[i].position()[d] = scale * normal(engine);
+    }
+    charges[i] = uniform(engine);
+  }
+
+  longrange::FMM<double, N, Kernel> fmm(order, 0.5, 16);
+  fmm.build(particles, charges);
+  std::vector<double> potential;
+  fmm.evaluate(potential);
+
+  Kernel kernel;
+  double error = 0, norm = 0;
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    double expected = 0;
+    for (std::size_t j = 0; j < particles.size(); j++) {
+      if (i == j) continue;
+      const Vec<double, N> r = particles[i].position() -
+                               particles[j].position();
+      expected += charges[j] * kernel(r);
+    }
+    error += (potential[i] - expected) * (potential[i] - expected);
+    norm += expected * expected;
+  }
+  return std::sqrt(error / norm);
+}
+
+TEST(FMM, inverse_distance) {
+  typedef longrange::InverseDistance<double> Kernel;
+  const double low = fmm_error<3, Kernel>(3);
+  const double high = fmm_error<3, Kernel>(5);
+  EXPECT_LT(low, 1e-2);
+  EXPECT_LT(high, 1e-4);
+  EXPECT_LT(high, low / 10);
+}
+
+TEST(FMM, logarithm) {
+  typedef longrange::Logarithm<double> Kernel;
+  const double low = fmm_error<2, Kernel>(4);
+  const double high = fmm_error<2, Kernel>(8);
+  EXPECT_LT(low, 1e-3);
+  EXPECT_LT(high, 1e-6);
+  EXPECT_LT(high, low / 10);
+}
+
+TEST(FMM, set_order) {
+  // operators are computed again for a new order
+  std::mt19937 engine(1);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  std::vector<Particle<double, 3>> particles(2000);
+  for (auto& p : particles) {
+    p.position() = {uniform(engine), uniform(engine), uniform(engine)};
+  }
+  typedef longrange::FMM<double, 3, longrange::InverseDistance<double>> FMM;
+  FMM fmm(3, 1, 16), fresh(5, 1, 16);
+  fmm.build(particles);
+  fresh.build(particles);
+  EXPECT_LT(0, fmm.num_operators());
+  std::vector<double> low, high, expected;
+  fmm.evaluate(low);
+  fmm.set_order(5);
+  fmm.evaluate(high);
+  fresh.evaluate(expected);
+  EXPECT_NE(low, high);
+  EXPECT_EQ(expected, high);
+}
+
+TEST(FMM, separated) {
+  // at the default theta, boxes touching at a corner are at the limit of the
+  // distance criterion: no M2L pair may share a face, an edge or a corner
+  std::mt19937 engine(2);
+  std::uniform_real_distribution<double> uniform(-1, 1);
+  std::vector<Particle<double, 3>> particles(20000);
+  for (auto& p : particles) {
+    p.position() = {uniform(engine), uniform(engine), uniform(engine)};
+  }
+  longrange::FMM<double, 3, longrange::InverseDistance<double>> fmm;
+  fmm.build(particles);
+  std::size_t pairs = 0;
+  fmm.for_each_m2l([&](const Vec<double, 3>& a, double ha,
+                       const Vec<double, 3>& b, double hb) {
+    double gap = -ha - hb;
+    for (std::size_t d = 0; d < 3; d++) {
+      gap = std::max(gap, std::abs(a[d] - b[d]) - ha - hb);
+    }
+    EXPECT_LT(std::min(ha, hb), gap);
+    pairs++;
+  });
+  EXPECT_LT(0u, pairs);
+}
+
+/** @brief the same as InverseDistance without scale and shift */
+struct PlainInverseDistance {
+  template <std::size_t N>
+  double operator()(const Vec<double, N>& r) const { return 1 / r.length(); }
+};
+
+TEST(FMM, operators) {
+  // operators of homogeneous kernels are shared by levels and symmetries
+  std::mt19937 engine(3);
+  std::normal_distribution<double> normal(0, 1);
+  std::vector<Particle<double, 3>> particles(3000);
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    const double scale = i % 4 ? 0.2 : 2;
+    particles[i].position() = {scale * normal(engine), scale * normal(engine),
+                               scale * normal(engine)};
+  }
+  longrange::FMM<double, 3, longrange::InverseDistance<double>> shared(3, 0.5,
+                                                                       8);
+  longrange::FMM<double, 3, PlainInverseDistance> plain(3, 0.5, 8);
+  shared.build(particles);
+  plain.build(particles);
+  EXPECT_LT(10 * shared.num_operators(), plain.num_operators());
+
+  std::vector<double> expected, potential;
+  plain.evaluate(expected);
+  shared.evaluate(potential);
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    EXPECT_NEAR(expected[i], potential[i], 1e-10 * std::abs(expected[i]));
+  }
+
+  // and their number does not grow with the depth of the tree
+  std::uniform_real_distribution<double> uniform(0, 1);
+  std::vector<std::size_t> operators;
+  for (std::size_t n : {4000, 32000}) {
+    particles.resize(n);
+    for (auto& p : particles) {
+      p.position() = {uniform(engine), uniform(engine), uniform(engine)};
+    }
+    shared.set_theta(1);
+    shared.build(particles);
+    operators.push_back(shared.num_operators());
+  }
+  EXPECT_EQ(operators[0], operators[1]);
+}
+
+TEST(FMM, degenerate) {
+  longrange::FMM<double, 2, longrange::Logarithm<double>> fmm;
+  std::vector<Particle<double, 2>> particles;
+  std::vector<double> potential;
+  fmm.build(particles);
+  fmm.evaluate(potential);
+  EXPECT_TRUE(potential.empty());
+
+  // particles at the same position are never split apart
+  particles.resize(300, Particle<double, 2>{1, 1});
+  particles[0].position() = {0, 0};
+  fmm.build(particles);
+  fmm.evaluate(potential);
+  const double expected = 299 * std::log(std::sqrt(2.0));
+  EXPECT_NEAR(expected, potential[0], 1e-3 * expected);
+  // coincident particles do not interact, only particles[0] counts
+  EXPECT_NEAR(std::log(std::sqrt(2.0)), potential[1], 1e-3);
+  EXPECT_NEAR(std::log(std::sqrt(2.0)), potential[299], 1e-3);
+}
@@ -0,0 +1,90 @@
+#include "particles/numa.hpp"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using namespace particles;
+
+class NumaTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() {
+    parallel::set_num_threads(4);
+    parallel::set_affinity(true);
+  }
+  virtual void TearDown() {
+    parallel::set_affinity(false);
+    parallel::set_num_threads(0);
+  }
+};
+
+TEST_F(NumaTest, topology) {
+  const auto& topology = numa::topology();
+  ASSERT_GE(topology.num_nodes(), 1u);
+  ASSERT_FALSE(topology.cpus().empty());
+  for (std::size_t k = 0; k < topology.cpus().size(); k++) {
+    EXPECT_LT(topology.node(k), topology.num_nodes());
+    // ordered by node
+    if (k > 0) {
+      EXPECT_LE(topology.node(k - 1), topology.node(k));
+    }
+  }
+  for (std::size_t b = 0; b < 4; b++) {
+    EXPECT_LT(parallel::block_cpu(b, 4), topology.cpus().size());
+  }
+}
+
+TEST_F(NumaTest, for_each_block) {
+#if defined(__linux__)
+  cpu_set_t before, after;
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(before), &before));
+#endif
+  std::vector<int> v(1000);
+  std::vector<int> cpus(4, -1);
+  parallel::for_each_block(v.size(), [&](std::size_t first, std::size_t last,
+                                         std::size_t b) {
+    for (auto i = first; i < last; i++) v[i]++;
+#if defined(__linux__)
+    cpus[b] = sched_getcpu();
+#endif
+  }, 10);
+  for (auto x : v) EXPECT_EQ(1, x);
+#if defined(__linux__)
+  for (std::size_t b = 0; b < cpus.size(); b++) {
+    EXPECT_EQ(numa::topology().cpus()[parallel::block_cpu(b, 4)],
+              static_cast<std::size_t>(cpus[b]));
+  }
+  // the calling thread is not left pinned
+  ASSERT_EQ(0, sched_getaffinity(0, sizeof(after), &after));
+  EXPECT_TRUE(CPU_EQUAL(&before, &after));
+#endif
+}
+
+TEST_F(NumaTest, distribute) {
+  std::vector<double> v(100000);
+  for (std::size_t i = 0; i < v.size(); i++) v[i] = i;
+  std::vector<std::vector<int>> rows(5000, std::vector<int>(10, 1));
+
+  const auto moved = numa::distribute(v);
+  numa::distribute(rows);
+  if (numa::num_nodes() == 1) {
+    EXPECT_EQ(0u, moved);
+  }
+
+  // every page of the array once, in order
+  std::vector<void*> pages;
+  std::vector<int> nodes;
+  numa::internal::block_pages(v, 1024, pages, nodes);
+  ASSERT_EQ(pages.size(), nodes.size());
+  EXPECT_LE(moved, pages.size());
+  const auto page = numa::internal::page_size();
+  EXPECT_GE(pages.size() * page, v.size() * sizeof(double));
+  EXPECT_LE(reinterpret_cast<std::uintptr_t>(pages.front()),
+            reinterpret_cast<std::uintptr_t>(v.data()));
+  for (std::size_t k = 1; k < pages.size(); k++) {
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(pages[k - 1]) + page,
+              reinterpret_cast<std::uintptr_t>(pages[k]));
+  }
+  for (std::size_t i = 0; i < v.size(); i++) ASSERT_EQ(double(i), v[i]);
+  for (const auto& row : rows) ASSERT_EQ(std::vector<int>(10, 1), row);
+}
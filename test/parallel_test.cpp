@@ -0,0 +1,103 @@
+#include "particles/parallel.hpp"
+
+#include <gtest/gtest.h>
+
+#include <numeric>
+#include <thread>
+#include <vector>
+
+using namespace particles;
+
+class ParallelTest : public ::testing::Test {
+ protected:
+  virtual void SetUp() { parallel::set_num_threads(4); }
+  virtual void TearDown() { parallel::set_num_threads(0); }
+};
+
+TEST_F(ParallelTest, num_blocks) {
+  EXPECT_EQ(1, parallel::num_blocks(0, 10));
+  EXPECT_EQ(1, parallel::num_blocks(10, 10));
+  EXPECT_EQ(2, parallel::num_blocks(11, 10));
+  EXPECT_EQ(4, parallel::num_blocks(1000, 10));
+}
+
+TEST_F(ParallelTest, for_each_block) {
+  std::vector<int> v(1000);
+  std::vector<int> owner(1000, -1);
+  parallel::for_each_block(v.size(), [&](std::size_t first, std::size_t last,
+                                         std::size_t b) {
+    for (auto i = first; i < last; i++) {
+      v[i]++;
+      owner[i] = b;
+    }
+  }, 10);
+  for (auto x : v) EXPECT_EQ(1, x);
+  // blocks are contiguous and ordered
+  EXPECT_EQ(0, owner.front());
+  EXPECT_EQ(3, owner.back());
+  EXPECT_TRUE(std::is_sorted(owner.begin(), owner.end()));
+}
+
+TEST_F(ParallelTest, for_each) {
+  std::vector<std::size_t> v(100);
+  parallel::for_each(v.size(), [&](std::size_t i) { v[i] = i * i; }, 1);
+  for (std::size_t i = 0; i < v.size(); i++) EXPECT_EQ(i * i, v[i]);
+}
+
+TEST_F(ParallelTest, reduce) {
+  std::vector<int> v(12345);
+  std::iota(v.begin(), v.end(), 0);
+  auto s = parallel::reduce(v.size(), 0L,
+                            [&](std::size_t first, std::size_t last) {
+    return std::accumulate(v.begin() + first, v.begin() + last, 0L);
+  }, [](long a, long b) { return a + b; }, 100);
+  EXPECT_EQ(12345L * 12344 / 2, s);
+  EXPECT_EQ(7, parallel::reduce(0, 7, [](std::size_t, std::size_t) {
+    return 0; }, [](int a, int b) { return a + b; }));
+}
+
+TEST_F(ParallelTest, for_each_weighted) {
+  // a few heavy indices at the front, as in dense clusters
+  auto cost = [](std::size_t i) -> std::size_t { return i < 10 ? 1000 : 0; };
+  std::vector<int> v(1000);
+  parallel::for_each_weighted(v.size(), cost, [&](std::size_t i) { v[i]++; },
+                              10);
+  for (auto x : v) EXPECT_EQ(1, x);
+
+  parallel::for_each_weighted(0, cost, [&](std::size_t) { FAIL(); });
+  parallel::set_num_threads(1);
+  parallel::for_each_weighted(v.size(), cost, [&](std::size_t i) { v[i]++; });
+  for (auto x : v) EXPECT_EQ(2, x);
+}
+
+TEST_F(ParallelTest, cost_bounds) {
+  auto cost = [](std::size_t i) -> std::size_t { return i < 4 ? 100 : 0; };
+  std::vector<std::size_t> prefix;
+  parallel::internal::cost_prefix(100, cost, prefix);
+  EXPECT_EQ(496, prefix.back());  // empty indices count 1
+
+  // boundaries nearest to 124, 248 and 372
+  auto bounds = parallel::internal::cost_bounds(prefix, 4);
+  EXPECT_EQ((std::vector<std::size_t>{0, 1, 2, 4, 100}), bounds);
+
+  // heavy indices get chunks of their own with enough chunks
+  bounds = parallel::internal::cost_bounds(prefix, 5);
+  EXPECT_EQ((std::vector<std::size_t>{0, 1, 2, 3, 4, 100}), bounds);
+}
+
+TEST_F(ParallelTest, for_each_weighted_affinity) {
+  // static blocks, each on the thread of its block
+  parallel::set_affinity(true);
+  std::vector<int> v(1000);
+  std::vector<std::thread::id> owner(v.size());
+  parallel::for_each_weighted(v.size(), [](std::size_t i) { return i; },
+                              [&](std::size_t i) {
+    v[i]++;
+    owner[i] = std::this_thread::get_id();
+  }, 10);
+  parallel::set_affinity(false);
+  for (auto x : v) EXPECT_EQ(1, x);
+  // the last (heaviest) indices run on a thread of their own
+  EXPECT_NE(owner.front(), owner.back());
+  EXPECT_EQ(std::this_thread::get_id(), owner.front());
+}
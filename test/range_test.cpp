@@ -46,3 +46,28 @@ TEST(RangeTest, suite_last_test) {
   EXPECT_EQ( 9, suite_last(0,  9, 3));
   EXPECT_EQ(12, suite_last(0, 10, 3));
 }
+
+TEST(RangeTest, sum_op) {
+  std::vector<std::pair<int, double>> v = {{1, 0.5}, {2, 1.5}};
+  EXPECT_DOUBLE_EQ(2.0, sum(v.begin(), v.end(),
+                            [](const std::pair<int, double>& p) {
+                              return p.second;
+                            }));
+  EXPECT_DOUBLE_EQ(1.5, average(v.begin(), v.end(),
+                                [](const std::pair<int, double>& p) {
+                                  return p.first;
+                                }));
+}
+
+TEST(RangeTest, sum_precision) {
+  // Naive summation loses all of the small values (error ~1e-10)
+  std::vector<double> v(1 << 20, 1e-16);
+  v[0] = 1;
+  EXPECT_NEAR(1 + (v.size() - 1) * 1e-16, sum(v.begin(), v.end()), 1e-13);
+
+  // Kahan summation for single pass iterators
+  auto it = transform_iterator(v.begin(), v.end(), [](double x) { return x; });
+  EXPECT_DOUBLE_EQ(1 + (v.size() - 1) * 1e-16, sum(it.first, it.second));
+  EXPECT_NEAR((1 + (v.size() - 1) * 1e-16) / v.size(),
+              average(v.begin(), v.end()), 1e-13 / v.size());
+}
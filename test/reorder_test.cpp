@@ -0,0 +1,98 @@
+#include "particles/reorder.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <random>
+#include <vector>
+
+using namespace particles;
+
+typedef Particle<double, 2> P2;
+
+// cells of a 2^b grid visited by the curve
+std::vector<std::pair<int, int>> visit_cells(Curve curve, int b) {
+  const int n = 1 << b;
+  std::vector<P2> particles;
+  for (int x = 0; x < n; x++) {
+    for (int y = 0; y < n; y++) particles.push_back(P2{x + 0.5, y + 0.5});
+  }
+  reorder_particles(particles, Vec<double, 2>{0, 0}, Vec<double, 2>{double(n), double(n)},
+                    curve);
+  std::vector<std::pair<int, int>> cells;
+  for (const auto& p : particles) {
+    cells.emplace_back(p.position(0), p.position(1));
+  }
+  return cells;
+}
+
+TEST(ReorderTest, hilbert_is_continuous) {
+  const auto cells = visit_cells(Curve::hilbert, 3);
+  ASSERT_EQ(64, cells.size());
+  for (std::size_t k = 1; k < cells.size(); k++) {
+    const int d = std::abs(cells[k].first - cells[k - 1].first) +
+                  std::abs(cells[k].second - cells[k - 1].second);
+    EXPECT_EQ(1, d);
+  }
+}
+
+TEST(ReorderTest, morton) {
+  const auto cells = visit_cells(Curve::morton, 1);
+  // Z-order in the first quadrants
+  ASSERT_EQ(4, cells.size());
+  EXPECT_EQ(std::make_pair(0, 0), cells[0]);
+  EXPECT_EQ(std::make_pair(0, 1), cells[1]);
+  EXPECT_EQ(std::make_pair(1, 0), cells[2]);
+  EXPECT_EQ(std::make_pair(1, 1), cells[3]);
+}
+
+TEST(ReorderTest, clamp_float) {
+  // 2^32 cells per dimension are not exact in float
+  typedef Vec<float, 2> V;
+  const V lower{0, 0}, upper{1, 1};
+  auto key = [&](const V& x) {
+    return internal::curve_key(x, lower, upper, Curve::morton);
+  };
+  EXPECT_NE(key(V{0, 0.5}), key(V{1, 0.5}));
+  EXPECT_LT(key(V{0.5, 0.5}), key(V{1, 0.5}));
+  EXPECT_EQ(key(V{1, 0.5}), key(V{2, 0.5}));  // clamped into the box
+  EXPECT_EQ(key(V{0, 0.5}), key(V{-1, 0.5}));
+  EXPECT_EQ(key(V{0, 0.5}), key(V{std::nanf(""), 0.5}));
+  // empty box
+  EXPECT_EQ(0, internal::curve_key(V{1, 1}, upper, upper, Curve::hilbert));
+}
+
+TEST(ReorderTest, permutation) {
+  std::mt19937 engine(1);
+  std::uniform_real_distribution<double> uniform(0, 10);
+  std::vector<P2> particles(1000);
+  std::vector<int> ids(particles.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    particles[i].position() = {uniform(engine), uniform(engine)};
+    ids[i] = i;
+  }
+  const auto original = particles;
+
+  boundary::PeriodicBoundary<double, 2> boundary(10.0);
+  const auto permutation = reorder_particles(particles, boundary);
+  apply_permutation(ids, permutation);
+
+  auto sorted = permutation;
+  std::sort(sorted.begin(), sorted.end());
+  for (std::size_t k = 0; k < sorted.size(); k++) EXPECT_EQ(k, sorted[k]);
+  for (std::size_t k = 0; k < particles.size(); k++) {
+    EXPECT_EQ(original[ids[k]].position(), particles[k].position());
+  }
+}
+
+TEST(ReorderTest, Reorderer) {
+  std::vector<P2> particles{P2{0.9, 0.9}, P2{0.1, 0.1}};
+  Reorderer<double, 2> reorder({0, 0}, {1, 1}, 10);
+  EXPECT_FALSE(reorder(5, particles));
+  EXPECT_DOUBLE_EQ(0.9, particles[0].position(0));
+  EXPECT_TRUE(reorder(10, particles));
+  EXPECT_DOUBLE_EQ(0.1, particles[0].position(0));
+  EXPECT_EQ(1, reorder.permutation()[0]);
+}
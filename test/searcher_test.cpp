@@ -2,9 +2,13 @@
 
 #include <gtest/gtest.h>
 
+#include <algorithm>
+#include <cmath>
 #include <iostream>
+#include <random>
 #include <fstream>
 #include <string>
+#include <type_traits>
 #include <vector>
 #include <unistd.h>
 
@@ -72,6 +76,91 @@ TEST(SearchTest, nearest) {
   EXPECT_DOUBLE_EQ(0.1, candidates[1]->position()[0]);
 }
 
+TEST(SearchTest, batch) {
+  std::vector<P2> particles;
+  for (int i = 0; i < 10; i++) particles.push_back(P2{0.1 * i, 0});
+
+  std::vector<std::vector<const P2*>> candidates(particles.size());
+  for (auto& c : candidates) {
+    for (auto it = particles.rbegin(); it != particles.rend(); ++it) {
+      c.push_back(&*it);
+    }
+  }
+  auto within = candidates;
+  search::distance_within(within, particles, 0.25);
+  EXPECT_EQ(3, within[0].size());
+  EXPECT_EQ(5, within[5].size());
+
+  search::nearest(candidates, particles, 3);
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    ASSERT_EQ(3, candidates[i].size());
+    EXPECT_EQ(&particles[i], candidates[i][0]);
+  }
+  EXPECT_EQ(&particles[1], candidates[0][1]);
+  EXPECT_EQ(&particles[2], candidates[0][2]);
+  EXPECT_EQ(&particles[8], candidates[9][1]);
+}
+
+TEST(SearchTest, adjacency_list) {
+  std::mt19937 engine(7);
+  std::uniform_real_distribution<double> uniform(0, 10);
+  std::uniform_real_distribution<double> step(-0.05, 0.05);
+  std::vector<P2> particles(500);
+  for (auto& p : particles) p.position() = {uniform(engine), uniform(engine)};
+
+  search::SimpleRangeSearch<double, 2> searcher(1.0);
+  auto adjacency_list = searcher.create_adjacency_list();
+  searcher.search(adjacency_list, particles);
+  const auto copy = adjacency_list;  // on the heap
+  std::vector<std::vector<const P2*>> first;
+  for (const auto& row : adjacency_list) {
+    first.emplace_back(row.begin(), row.end());
+  }
+
+  // the arena settles after the first searches
+  std::size_t capacity = 0;
+  for (int t = 0; t < 5; t++) {
+    for (auto& p : particles) {
+      p.position() += Vec<double, 2>{step(engine), step(engine)};
+    }
+    searcher.search(adjacency_list, particles);
+    if (t == 2) capacity = adjacency_list.arena_capacity();
+    if (t > 2) {
+      EXPECT_EQ(capacity, adjacency_list.arena_capacity());
+    }
+
+    for (std::size_t i = 0; i < particles.size(); i++) {
+      std::vector<const P2*> expected;
+      for (std::size_t j = 0; j < particles.size(); j++) {
+        if (particles[i].position().squared_distance(
+                particles[j].position()) <= 1.0) {
+          expected.push_back(&particles[j]);
+        }
+      }
+      std::sort(adjacency_list[i].begin(), adjacency_list[i].end());
+      EXPECT_EQ(expected, std::vector<const P2*>(adjacency_list[i].begin(),
+                                                 adjacency_list[i].end()));
+    }
+  }
+  EXPECT_GT(capacity, 0u);
+
+  // copies do not depend on the arena
+  ASSERT_EQ(particles.size(), copy.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    EXPECT_EQ(first[i], std::vector<const P2*>(copy[i].begin(),
+                                               copy[i].end()));
+  }
+
+  // rows are added only through resize, which allocates them in the arena
+  typedef search::AdjacencyList<P2> List;
+  static_assert(!std::is_convertible<List*, List::rows_type*>::value,
+                "rows must not be resized bypassing the arena");
+  adjacency_list.resize(particles.size() + 10);
+  for (const auto& row : adjacency_list) {
+    EXPECT_TRUE(row.get_allocator() == adjacency_list.row_allocator());
+  }
+}
+
 TEST(SearchTest, SimpleRangeSearch) {
   search::SimpleRangeSearch<double, 2> searcher(1.001);
   typename decltype(searcher)::adjacency_list_type adjacency_list;
@@ -136,3 +225,332 @@ TEST(SearchTest, kdtree) {
   EXPECT_EQ(3, adjacency_list[2].size());
   EXPECT_EQ(3, adjacency_list[3].size());
 }
+
+TEST(SearchTest, knn) {
+  std::mt19937 engine(1);
+  std::uniform_real_distribution<double> uniform(0, 10);
+  std::vector<P2> particles(500);
+  for (auto& p : particles) p.position() = {uniform(engine), uniform(engine)};
+
+  const std::size_t k = 6;
+  search::KnnSearcher<double, 2> searcher(k);
+  auto adjacency_list = searcher.create_adjacency_list();
+  searcher.search(adjacency_list, particles);
+
+  ASSERT_EQ(particles.size(), adjacency_list.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    std::vector<const P2*> expected;
+    for (const auto& p : particles) expected.push_back(&p);
+    const auto& x = particles[i].position();
+    std::sort(expected.begin(), expected.end(),
+              [&x](const P2* a, const P2* b) {
+      return x.squared_distance(a->position()) <
+             x.squared_distance(b->position());
+    });
+    expected.resize(k + 1);
+
+    ASSERT_EQ(k + 1, adjacency_list[i].size());
+    EXPECT_EQ(&particles[i], adjacency_list[i][0]);
+    std::sort(expected.begin(), expected.end());
+    std::sort(adjacency_list[i].begin(), adjacency_list[i].end());
+    EXPECT_EQ(expected, std::vector<const P2*>(adjacency_list[i].begin(),
+                                               adjacency_list[i].end()));
+  }
+}
+
+TEST(SearchTest, knn_ties) {
+  // lattice with a coincident pair: neighbors at equal distances may be any
+  // of them, so compare distances with brute force
+  std::vector<P2> particles;
+  for (int x = 0; x < 5; x++) {
+    for (int y = 0; y < 5; y++) particles.push_back(P2{double(x), double(y)});
+  }
+  particles.push_back(P2{2.0, 2.0});
+
+  for (std::size_t k : {1, 4, 8, 25, 40}) {
+    search::KnnSearcher<double, 2> searcher(k);
+    auto adjacency_list = searcher.create_adjacency_list();
+    searcher.search(adjacency_list, particles);
+
+    ASSERT_EQ(particles.size(), adjacency_list.size());
+    const std::size_t m = std::min(k, particles.size() - 1);
+    for (std::size_t i = 0; i < particles.size(); i++) {
+      const auto& x = particles[i].position();
+      std::vector<double> expected;
+      for (std::size_t j = 0; j < particles.size(); j++) {
+        if (j == i) continue;
+        expected.push_back(x.squared_distance(particles[j].position()));
+      }
+      std::sort(expected.begin(), expected.end());
+      expected.resize(m);
+
+      const auto& neighbors = adjacency_list[i];
+      ASSERT_EQ(m + 1, neighbors.size()) << "k = " << k;
+      EXPECT_EQ(&particles[i], neighbors[0]);
+      std::vector<double> result;
+      for (std::size_t l = 1; l < neighbors.size(); l++) {
+        EXPECT_NE(&particles[i], neighbors[l]);
+        result.push_back(x.squared_distance(neighbors[l]->position()));
+      }
+      EXPECT_TRUE(std::is_sorted(result.begin(), result.end()));
+      EXPECT_EQ(expected, result) << "k = " << k << ", i = " << i;
+
+      std::vector<const P2*> unique(neighbors.begin(), neighbors.end());
+      std::sort(unique.begin(), unique.end());
+      EXPECT_EQ(unique.end(), std::unique(unique.begin(), unique.end()));
+    }
+  }
+}
+
+TEST(SearchTest, variable_radius) {
+  typedef Particle<double, 2, double> PR;  // info is radius
+  std::mt19937 engine(2);
+  std::uniform_real_distribution<double> uniform(0, 10);
+  std::uniform_real_distribution<double> exponent(-4, 0);
+  std::vector<PR> particles(1000);
+  for (auto& p : particles) {
+    p.position() = {uniform(engine), uniform(engine)};
+    p.info() = 0.5 * std::exp2(exponent(engine));
+  }
+
+  for (auto rule : {search::RadiusRule::sum, search::RadiusRule::max}) {
+    search::VariableRadiusSearcher<double, 2, double> searcher(rule);
+    auto adjacency_list = searcher.create_adjacency_list();
+    searcher.search(adjacency_list, particles);
+
+    ASSERT_EQ(particles.size(), adjacency_list.size());
+    for (std::size_t i = 0; i < particles.size(); i++) {
+      const auto& p = particles[i];
+      std::vector<const PR*> expected;
+      for (const auto& q : particles) {
+        const double r = rule == search::RadiusRule::sum
+            ? p.info() + q.info() : std::max(p.info(), q.info());
+        if (p.position().squared_distance(q.position()) <= r * r) {
+          expected.push_back(&q);
+        }
+      }
+      std::sort(expected.begin(), expected.end());
+      std::sort(adjacency_list[i].begin(), adjacency_list[i].end());
+      EXPECT_EQ(expected, std::vector<const PR*>(adjacency_list[i].begin(),
+                                                 adjacency_list[i].end()));
+    }
+  }
+}
+
+TEST(SearchTest, adaptive_grid) {
+  // dense bands separated by empty space
+  std::mt19937 engine(4);
+  std::uniform_real_distribution<double> uniform(0, 100);
+  std::uniform_real_distribution<double> band(0, 0.5);
+  std::vector<P2> particles(3000);
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    const double y = (i % 3) * 40 + band(engine);
+    particles[i].position() = {uniform(engine), y};
+  }
+
+  search::SimpleRangeSearch<double, 2> simple(1.5);
+  search::AdaptiveGridSearcher<double, 2> adaptive(1.5, 4);
+  auto expected = simple.create_adjacency_list();
+  auto result = adaptive.create_adjacency_list();
+  simple.search(expected, particles);
+  adaptive.search(result, particles);
+
+  ASSERT_EQ(particles.size(), result.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    std::sort(expected[i].begin(), expected[i].end());
+    std::sort(result[i].begin(), result[i].end());
+    EXPECT_EQ(expected[i], result[i]);
+  }
+}
+
+TEST(SearchTest, adaptive_grid_extremes) {
+  // cell indices far beyond the range of int64 are clamped
+  std::vector<P2> particles {P2{1e300, 0.0}, P2{1e300, 1e-3},
+                             P2{-1e300, 0.0}, P2{0.0, 0.0}, P2{0.0, 1e-3}};
+  search::AdaptiveGridSearcher<double, 2> adaptive(1e-2);
+  auto result = adaptive.create_adjacency_list();
+  adaptive.search(result, particles);
+  std::vector<std::size_t> sizes;
+  for (const auto& neighbors : result) sizes.push_back(neighbors.size());
+  EXPECT_EQ(std::vector<std::size_t>({2, 2, 1, 2, 2}), sizes);
+
+  // a radius spanning more cells than are occupied scans every cell
+  search::GridIndex<double, 2> index(particles, 1e-2);
+  search::CSR csr;
+  index.query(std::vector<Vec<double, 2>>{{0.0, 0.0}}, 1e100, csr);
+  EXPECT_EQ(2, csr.size(0));
+  index.query(std::vector<Vec<double, 2>>{{0.0, 0.0}}, -1.0, csr);
+  EXPECT_EQ(0, csr.size(0));
+
+  search::AdaptiveGridSearcher<double, 2> zero(0);
+  EXPECT_DEATH(zero.search(result, particles), "positive");
+}
+
+TEST(SearchTest, dual_tree) {
+  // gaussian clusters in 3d
+  std::mt19937 engine(6);
+  std::uniform_real_distribution<double> uniform(0, 20);
+  std::normal_distribution<double> normal(0, 0.5);
+  std::vector<Vec<double, 3>> centers(8);
+  for (auto& c : centers) {
+    c = {uniform(engine), uniform(engine), uniform(engine)};
+  }
+  std::vector<P3> particles(3000);
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    const auto& c = centers[i % centers.size()];
+    particles[i].position() = {c[0] + normal(engine), c[1] + normal(engine),
+                               c[2] + normal(engine)};
+  }
+
+  search::SimpleRangeSearch<double, 3> simple(0.4);
+  search::DualTreeSearcher<double, 3> dual(0.4, 8);
+  auto expected = simple.create_adjacency_list();
+  auto result = dual.create_adjacency_list();
+  simple.search(expected, particles);
+  dual.search(result, particles);
+
+  ASSERT_EQ(particles.size(), result.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    EXPECT_EQ(&particles[i], result[i].front());
+    std::sort(expected[i].begin(), expected[i].end());
+    std::sort(result[i].begin(), result[i].end());
+    EXPECT_EQ(expected[i], result[i]);
+  }
+}
+
+TEST(SearchTest, index) {
+  std::mt19937 engine(5);
+  std::uniform_real_distribution<double> uniform(0, 10);
+  std::vector<P2> particles(2000);
+  for (auto& p : particles) p.position() = {uniform(engine), uniform(engine)};
+  std::vector<Vec<double, 2>> probes(300);
+  for (auto& x : probes) x = {uniform(engine), uniform(engine)};
+
+  search::KdTreeIndex<double, 2> kdtree(particles);
+  search::GridIndex<double, 2> grid(particles, 0.5);
+  for (double r : {0.3, 0.8}) {
+    search::CSR found_kdtree, found_grid;
+    kdtree.query(probes, r, found_kdtree);
+    grid.query(probes, r, found_grid);
+    ASSERT_EQ(probes.size(), found_kdtree.size());
+    ASSERT_EQ(probes.size(), found_grid.size());
+
+    for (std::size_t q = 0; q < probes.size(); q++) {
+      std::vector<std::size_t> expected;
+      for (std::size_t i = 0; i < particles.size(); i++) {
+        if (probes[q].squared_distance(particles[i].position()) <= r * r) {
+          expected.push_back(i);
+        }
+      }
+      std::vector<std::size_t> a(found_kdtree.begin(q), found_kdtree.end(q));
+      std::vector<std::size_t> b(found_grid.begin(q), found_grid.end(q));
+      std::sort(a.begin(), a.end());
+      std::sort(b.begin(), b.end());
+      EXPECT_EQ(expected, a);
+      EXPECT_EQ(expected, b);
+    }
+  }
+}
+
+TEST(SearchTest, float) {
+  typedef Particle<float, 2> PF;
+  std::vector<PF> particles;
+  for (int i = 0; i < 20; i++) {
+    for (int j = 0; j < 20; j++) {
+      particles.push_back(PF({0.5f * i, 0.5f * j + 0.01f * i}, {0, 0}));
+    }
+  }
+
+  search::SimpleRangeSearch<float, 2> simple(0.75f);
+  search::KdTreeSearcher<float, 2> kdtree(0.75f);
+  auto expected = simple.create_adjacency_list();
+  auto result = kdtree.create_adjacency_list();
+  simple.search(expected, particles);
+  kdtree.search(result, particles);
+
+  ASSERT_EQ(particles.size(), result.size());
+  for (std::size_t i = 0; i < particles.size(); i++) {
+    std::sort(expected[i].begin(), expected[i].end());
+    std::sort(result[i].begin(), result[i].end());
+    EXPECT_EQ(expected[i], result[i]);
+  }
+
+  auto p2 = read_particles2("../../test/data/2d.xyz");
+  std::vector<PF> pf;
+  for (const auto& p : p2) {
+    pf.push_back(PF({static_cast<float>(p.position(0)),
+                     static_cast<float>(p.position(1))}, {0, 0}));
+  }
+  search::DelaunaySearcher<float, 2> delaunay;
+  auto adjacency_list = delaunay.create_adjacency_list();
+  delaunay.search(adjacency_list, pf);
+  EXPECT_EQ(3, adjacency_list[0].size());
+  EXPECT_EQ(4, adjacency_list[2].size());
+}
+
+TEST(SearchTest, voronoi2) {
+  // square lattice with spacing 1
+  std::vector<P2> particles;
+  for (int x = 0; x < 3; x++) {
+    for (int y = 0; y < 3; y++) particles.push_back(P2{double(x), double(y)});
+  }
+  search::DelaunaySearcher<double, 2> searcher(true);
+  auto adjacency_list = searcher.create_adjacency_list();
+  searcher.search(adjacency_list, particles);
+
+  const auto& volumes = searcher.voronoi_volumes();
+  const auto& faces = searcher.voronoi_faces();
+  ASSERT_EQ(particles.size(), volumes.size());
+  ASSERT_EQ(adjacency_list[4].size(), faces[4].size());
+
+  // center
+  EXPECT_NEAR(1.0, volumes[4], 1e-12);
+  double perimeter = 0;
+  for (auto l : faces[4]) perimeter += l;
+  EXPECT_NEAR(4.0, perimeter, 1e-12);
+  // on the convex hull
+  EXPECT_TRUE(std::isinf(volumes[0]));
+}
+
+TEST(SearchTest, voronoi3) {
+  // cubic lattice with spacing 1
+  std::vector<P3> particles;
+  for (int x = 0; x < 3; x++) {
+    for (int y = 0; y < 3; y++) {
+      for (int z = 0; z < 3; z++) {
+        particles.push_back(P3({double(x), double(y), double(z)}, {0, 0, 0}));
+      }
+    }
+  }
+  search::DelaunaySearcher<double, 3> searcher(true);
+  auto adjacency_list = searcher.create_adjacency_list();
+  searcher.search(adjacency_list, particles);
+
+  const auto& volumes = searcher.voronoi_volumes();
+  const auto& faces = searcher.voronoi_faces();
+  EXPECT_NEAR(1.0, volumes[13], 1e-12);
+  double surface = 0;
+  for (auto a : faces[13]) surface += a;
+  EXPECT_NEAR(6.0, surface, 1e-12);
+  EXPECT_TRUE(std::isinf(volumes[0]));
+}
+
+TEST(SearchTest, voronoi3_degenerate) {
+  // a triangle has no 3d cells: every cell and face is unbounded
+  std::vector<P3> particles {P3({0, 0, 0}, {0, 0, 0}),
+                             P3({1, 0, 0}, {0, 0, 0}),
+                             P3({0, 1, 0}, {0, 0, 0})};
+  search::DelaunaySearcher<double, 3> searcher(true);
+  auto adjacency_list = searcher.create_adjacency_list();
+  searcher.search(adjacency_list, particles);
+
+  const auto& volumes = searcher.voronoi_volumes();
+  const auto& faces = searcher.voronoi_faces();
+  ASSERT_EQ(3, volumes.size());
+  for (std::size_t i = 0; i < 3; i++) {
+    EXPECT_EQ(2, adjacency_list[i].size());
+    EXPECT_TRUE(std::isinf(volumes[i]));
+    ASSERT_EQ(2, faces[i].size());
+    for (auto a : faces[i]) EXPECT_TRUE(std::isinf(a));
+  }
+}
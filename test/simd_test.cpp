@@ -0,0 +1,87 @@
+#define PARTICLES_ALIGNED_VEC
+#include "particles/simd.hpp"
+#include "particles/vec.hpp"
+
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+using namespace particles;
+
+TEST(SimdTest, operations) {
+  double a[4] = {1, 2, 3, 4};
+  const double b[4] = {4, 3, 2, 1};
+  EXPECT_DOUBLE_EQ(20, simd::dot<4>(a, b));
+  EXPECT_DOUBLE_EQ(20, simd::squared_distance<4>(a, b));
+  simd::add<4>(a, b);
+  for (auto x : a) EXPECT_DOUBLE_EQ(5, x);
+  simd::mul<4>(a, 2.0);
+  simd::sub<4>(a, b);
+  EXPECT_DOUBLE_EQ(6, a[0]);
+  EXPECT_DOUBLE_EQ(9, a[3]);
+  simd::div<4>(a, 3.0);
+  EXPECT_DOUBLE_EQ(2, a[0]);
+
+  // fallback
+  int c[3] = {1, 2, 3};
+  const int d[3] = {1, 1, 1};
+  simd::add<3>(c, d);
+  EXPECT_EQ(29, simd::dot<3>(c, c));
+  static_assert(!simd::is_native<int, 3>(), "");
+}
+
+TEST(SimdTest, layout) {
+  static_assert(Vec<double, 3>::width == 4, "");
+  static_assert(Vec<float, 3>::width == 4, "");
+  static_assert(Vec<int, 3>::width == 3, "");
+  EXPECT_EQ(4 * sizeof(double), sizeof(Vec<double, 3>));
+  EXPECT_EQ(4 * sizeof(float), sizeof(Vec<float, 3>));
+  EXPECT_EQ(16u, alignof(Vec<float, 3>));
+  EXPECT_LE(16u, alignof(Vec<double, 3>));
+
+  std::vector<Vec<double, 3>> v(10);
+  for (const auto& x : v) {
+    EXPECT_EQ(0u, reinterpret_cast<std::uintptr_t>(&x) % 16);
+  }
+
+  Vec<double, 3> u{1, 2, 3};
+  EXPECT_EQ(3, std::distance(u.begin(), u.end()));
+  EXPECT_DOUBLE_EQ(3, *u.rbegin());
+  u.fill(1);
+  EXPECT_DOUBLE_EQ(0, u.data()[3]);
+}
+
+TEST(SimdTest, arithmetic) {
+  Vec<double, 3> u{1, 2, 3}, v{4, 5, 6};
+  u += v;
+  EXPECT_EQ((Vec<double, 3>{5, 7, 9}), u);
+  u -= v;
+  EXPECT_EQ((Vec<double, 3>{1, 2, 3}), u);
+  EXPECT_DOUBLE_EQ(32, u.dot(v));
+  EXPECT_DOUBLE_EQ(27, u.squared_distance(v));
+  EXPECT_DOUBLE_EQ(14, u.squared_length());
+
+  Vec<double, 3> w = u * 2 + v;
+  EXPECT_EQ((Vec<double, 3>{6, 9, 12}), w);
+  w = (u - v) / 3.0;
+  EXPECT_EQ((Vec<double, 3>{-1, -1, -1}), w);
+
+  Vec<float, 3> f{3, 0, 4};
+  f.normalize(10);
+  EXPECT_FLOAT_EQ(6, f[0]);
+  EXPECT_FLOAT_EQ(8, f[2]);
+}
+
+TEST(SimdTest, padding_stays_zero) {
+  Vec<double, 3> u{1, 2, 3};
+  u *= std::numeric_limits<double>::infinity();
+  EXPECT_DOUBLE_EQ(0, u.data()[3]);
+
+  Vec<double, 3> v{1, 2, 3};
+  v = v / 0.0;
+  EXPECT_DOUBLE_EQ(0, v.data()[3]);
+  EXPECT_TRUE(std::isinf(v.squared_length()));
+}